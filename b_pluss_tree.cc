@@ -3,6 +3,51 @@
 #include <memory>
 #include <algorithm>
 #include <optional>
+#include <functional>
+#include <future>
+#include <thread>
+#include <type_traits>
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <unordered_map>
+#include <map>
+#include <set>
+#include <unordered_set>
+#include <utility>
+#include <array>
+#include <cerrno>
+#include <cstdlib>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#define BPLUSTREE_HAVE_IO_URING 1
+#endif
+#if __has_include(<linux/futex.h>)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#define BPLUSTREE_HAVE_FUTEX 1
+#endif
+// McsLatch が複数のコアで眠る前に回る回数の既定値。多コアでの実測に基づく値ではないので、
+// 環境に合わせてコンパイル時に上書きする
+#ifndef BPLUSTREE_MCS_SPIN_BUDGET
+#define BPLUSTREE_MCS_SPIN_BUDGET 256
+#endif
 
 namespace BPlusTree {
 static constexpr int kOrder = 4;
@@ -13,6 +58,8 @@ static constexpr int kOrder = 4;
 class BPlusNode {
 public:
     bool isLeaf_;
+    // 自身または子孫が最後に書き換えられた時点の木のエポック
+    uint64_t dirtyVersion_ = 0;
     
     BPlusNode(bool leaf) : isLeaf_(leaf) {}
     virtual ~BPlusNode() = default;
@@ -21,17 +68,321 @@ protected:
     static constexpr int kOrder = 4;
 };
 
+/**
+ * @brief 葉ノード単位の文字列キー辞書
+ * @details キーを区切り文字で成分に分け、葉に現れる成分を昇順に並べた辞書の
+ *          番号 (コード) の列としてキーを保持する。区切り文字が成分中のどの文字
+ *          よりも小さければ、コード列の辞書式比較は元の文字列の比較と一致する。
+ *          辞書とコード列は葉ノードが持つ 1 本のバッファに詰めて保持し、
+ *          このクラスはそのバッファを読む。バッファの配置は uint16_t 単位で
+ *          [区切り文字, 成分数 C, キー数 N, 成分の開始位置 (C + 1 個),
+ *           キーのコード列の開始位置 (N + 1 個), コード列, 成分の文字列]
+ */
+class KeyDictionary {
+public:
+    // 1 キーあたりの最大成分数
+    static constexpr size_t kMaxComponents = 16;
+
+    explicit KeyDictionary(std::string_view buffer) : buffer_(buffer) {}
+
+    /**
+     * @brief 昇順に並んだキーから辞書のバッファを作る
+     * @param keys 
+     * @param separator 成分の区切り文字
+     * @return std::string 
+     * @retval 作成したバッファ
+     * @retval 順序を保った符号化ができないキーを含む場合は空文字列
+     */
+    static std::string build(const std::vector<std::string>& keys, char separator) {
+        std::vector<std::string_view> components;
+        size_t codeCount = 0;
+        for (auto& key : keys) {
+            size_t count = 0;
+            bool encodable = forEachComponent(key, separator, [&](std::string_view component) {
+                for (unsigned char ch : component) {
+                    if (ch <= (unsigned char)separator) {
+                        return false;
+                    }
+                }
+                components.push_back(component);
+                return ++count <= kMaxComponents;
+            });
+            if (!encodable) {
+                return {};
+            }
+            codeCount += count;
+        }
+        std::sort(components.begin(), components.end());
+        components.erase(std::unique(components.begin(), components.end()), components.end());
+        size_t textSize = 0;
+        for (auto component : components) {
+            textSize += component.size();
+        }
+        if (textSize > UINT16_MAX || codeCount > UINT16_MAX) {
+            return {};
+        }
+
+        std::vector<uint16_t> words{(uint16_t)(unsigned char)separator,
+                                    (uint16_t)components.size(), (uint16_t)keys.size()};
+        uint16_t offset = 0;
+        for (auto component : components) {
+            words.push_back(offset);
+            offset += (uint16_t)component.size();
+        }
+        words.push_back(offset);
+        size_t keyOffsetsBase = words.size();
+        words.resize(words.size() + keys.size() + 1);
+        size_t codeIndex = 0;
+        for (size_t i = 0; i < keys.size(); i++) {
+            words[keyOffsetsBase + i] = (uint16_t)codeIndex;
+            forEachComponent(keys[i], separator, [&](std::string_view component) {
+                auto it = std::lower_bound(components.begin(), components.end(), component);
+                words.push_back((uint16_t)(it - components.begin()));
+                codeIndex++;
+                return true;
+            });
+        }
+        words[keyOffsetsBase + keys.size()] = (uint16_t)codeIndex;
+
+        std::string buffer(words.size() * sizeof(uint16_t), '\0');
+        std::memcpy(buffer.data(), words.data(), buffer.size());
+        for (auto component : components) {
+            buffer += component;
+        }
+        return buffer;
+    }
+
+    /**
+     * @brief 符号化されているキーの数
+     * @return size_t 
+     */
+    size_t size() const {
+        return word(2);
+    }
+
+    /**
+     * @brief コードに対応する成分
+     * @param code 
+     * @return std::string_view 
+     */
+    std::string_view component(size_t code) const {
+        size_t begin = word(3 + code);
+        return buffer_.substr(textBase() + begin, word(3 + code + 1) - begin);
+    }
+
+    /**
+     * @brief 成分に対応するコードを返す
+     * @param component 
+     * @return std::optional<size_t> 
+     * @retval 成分のコード
+     * @retval 辞書にない成分の場合は std::nullopt
+     */
+    std::optional<size_t> codeOf(std::string_view component) const {
+        size_t lo = 0;
+        size_t hi = componentCount();
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (this->component(mid) < component) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        if (lo < componentCount() && this->component(lo) == component) {
+            return lo;
+        }
+        return std::nullopt;
+    }
+
+    /**
+     * @brief キーと等しいキーの位置を探す
+     * @details 探すキーを一度だけコード列に変換し、以降の比較はコード同士で行う
+     * @param key 
+     * @return std::optional<size_t> 
+     * @retval キーの位置
+     * @retval 見つからない場合は std::nullopt
+     */
+    std::optional<size_t> find(std::string_view key) const {
+        uint16_t probe[kMaxComponents];
+        size_t length = 0;
+        bool encodable = forEachComponent(key, separator(), [&](std::string_view component) {
+            auto code = codeOf(component);
+            if (!code || length == kMaxComponents) {
+                return false;
+            }
+            probe[length++] = (uint16_t)*code;
+            return true;
+        });
+        if (!encodable) {
+            return std::nullopt;
+        }
+        size_t lo = 0;
+        size_t hi = size();
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (compareCodes(mid, probe, length) < 0) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        if (lo < size() && compareCodes(lo, probe, length) == 0) {
+            return lo;
+        }
+        return std::nullopt;
+    }
+
+    /**
+     * @brief キー i と key を文字列として比較する
+     * @details キーを復元せず、成分と区切り文字を順に key と突き合わせる
+     * @param i 
+     * @param key 
+     * @return int 負なら キー i が前、0 なら等しい、正なら後
+     */
+    int compare(size_t i, std::string_view key) const {
+        size_t pos = 0;
+        for (size_t j = keyOffset(i); j < keyOffset(i + 1); j++) {
+            if (j > keyOffset(i)) {
+                if (pos == key.size()) {
+                    return 1;
+                }
+                int diff = (int)(unsigned char)separator() - (int)(unsigned char)key[pos++];
+                if (diff != 0) {
+                    return diff;
+                }
+            }
+            std::string_view part = component(word(codesBase() + j));
+            size_t n = std::min(part.size(), key.size() - pos);
+            int diff = std::char_traits<char>::compare(part.data(), key.data() + pos, n);
+            if (diff != 0) {
+                return diff;
+            }
+            if (n < part.size()) {
+                return 1;
+            }
+            pos += n;
+        }
+        return pos == key.size() ? 0 : -1;
+    }
+
+    /**
+     * @brief キー i を文字列に戻す
+     * @details out の領域を使い回すので、同じ out で繰り返し呼べば確保は起きない
+     * @param i 
+     * @param out 
+     */
+    void decodeInto(size_t i, std::string& out) const {
+        out.clear();
+        for (size_t j = keyOffset(i); j < keyOffset(i + 1); j++) {
+            if (j > keyOffset(i)) {
+                out += separator();
+            }
+            out += component(word(codesBase() + j));
+        }
+    }
+
+    /**
+     * @brief 全てのキーを文字列に戻す
+     * @return std::vector<std::string> 
+     */
+    std::vector<std::string> decodeAll() const {
+        std::vector<std::string> keys(size());
+        for (size_t i = 0; i < keys.size(); i++) {
+            decodeInto(i, keys[i]);
+        }
+        return keys;
+    }
+
+private:
+    std::string_view buffer_;
+
+    uint16_t word(size_t i) const {
+        uint16_t value;
+        std::memcpy(&value, buffer_.data() + i * sizeof(uint16_t), sizeof(value));
+        return value;
+    }
+    char separator() const { return (char)word(0); }
+    size_t componentCount() const { return word(1); }
+    size_t keyOffset(size_t i) const { return word(4 + componentCount() + i); }
+    size_t codesBase() const { return 4 + componentCount() + size() + 1; }
+    size_t textBase() const { return (codesBase() + keyOffset(size())) * sizeof(uint16_t); }
+
+    /**
+     * @brief キー i のコード列と probe を辞書式に比較する
+     * @return int 負なら キー i が前、0 なら等しい、正なら後
+     */
+    int compareCodes(size_t i, const uint16_t* probe, size_t length) const {
+        size_t begin = keyOffset(i);
+        size_t n = keyOffset(i + 1) - begin;
+        for (size_t j = 0; j < n && j < length; j++) {
+            int diff = (int)word(codesBase() + begin + j) - (int)probe[j];
+            if (diff != 0) {
+                return diff;
+            }
+        }
+        return (int)n - (int)length;
+    }
+
+    /**
+     * @brief キーを区切り文字で分け、成分ごとに fn を呼ぶ
+     * @return bool fn が false を返した場合 false
+     */
+    template <typename Fn>
+    static bool forEachComponent(std::string_view key, char separator, Fn&& fn) {
+        size_t begin = 0;
+        while (true) {
+            size_t end = key.find(separator, begin);
+            if (!fn(key.substr(begin, end == std::string_view::npos ? std::string_view::npos : end - begin))) {
+                return false;
+            }
+            if (end == std::string_view::npos) {
+                return true;
+            }
+            begin = end + 1;
+        }
+    }
+};
+
+/**
+ * @brief 葉ノードのキー符号化領域
+ * @details 文字列以外のキーは符号化しないため空
+ */
+template <typename Key>
+class LeafKeyEncoding {};
+
+/**
+ * @brief 文字列キーの葉ノードの符号化領域
+ * @details encodedKeys_ が空でない間、keys_ は空でキーは KeyDictionary の
+ *          バッファとして encodedKeys_ が保持する
+ */
+template <>
+class LeafKeyEncoding<std::string> {
+public:
+    std::string encodedKeys_;
+};
+
 /**
  * @brief 葉ノードのクラス
  * @details B+ 木の葉ノードクラス。キーと値のペアを保持する
  */
-class BPlusLeafNode : public BPlusNode {
+template <typename Key, typename Value>
+class BPlusLeafNode : public BPlusNode, public LeafKeyEncoding<Key> {
 public:
-    std::vector<int> keys_;
-    std::vector<int> values_;
+    std::vector<Key> keys_;
+    std::vector<Value> values_;
 
     std::shared_ptr<BPlusLeafNode> next_;
 
+    // 作られた時点の木のエポック
+    uint64_t birthEpoch_ = 0;
+    // オンラインバックアップがこの葉を読んだ (または退避した) エポック
+    uint64_t backupEpoch_ = 0;
+    // 内容を書き換えるたびに増える版 (楽観的トランザクションの検証に使う)
+    uint64_t version_ = 0;
+    // この葉を書き換えた回数と、そのために更新が排他区間を待ったナノ秒数 (leafHeat() で読む)
+    uint64_t writes_ = 0;
+    uint64_t waitNanos_ = 0;
+
     BPlusLeafNode() : BPlusNode(true) {}
 };
 
@@ -39,9 +390,10 @@ public:
  * @brief 内部ノードのクラス
  * @details B+ 木の内部ノードクラス。キーと子ポインタを保持する
  */
+template <typename Key>
 class BPlusInternalNode : public BPlusNode {
 public:
-    std::vector<int> keys_;
+    std::vector<Key> keys_;
 
     std::vector<std::shared_ptr<BPlusNode>> childPointers_;
 
@@ -49,251 +401,6117 @@ public:
 };
 
 /**
- * @brief 木構造を表現するクラス
+ * @brief キー範囲を表す構造体
+ * @details 半開区間 [lo, hi)。std::nullopt はその側に境界がないことを表す
  */
-class BPlusTree {
+template <typename Key>
+struct KeyRange {
+    std::optional<Key> lo;
+    std::optional<Key> hi;
+};
+
+/**
+ * @brief scanInto() の結果を表す構造体
+ */
+template <typename Key>
+struct ScanResult {
+    // 呼び出し側のバッファへ書き込んだ要素数
+    size_t count;
+    // 続きを読むときの下限キー。範囲を読み終えた場合は std::nullopt
+    std::optional<Key> resumeKey;
+};
+
+/**
+ * @brief キーの使用メモリ量の集計
+ */
+struct KeyMemoryUsage {
+    // 葉ノードの数
+    size_t leaves;
+    // 辞書符号化されている葉ノードの数
+    size_t encodedLeaves;
+    // 葉ノードのキーが使用しているバイト数
+    size_t bytes;
+};
+
+/**
+ * @brief 葉ノード 1 つ分の書き込みの集中度
+ */
+template <typename Key>
+struct LeafHeat {
+    // 葉の先頭のキー。空の葉なら std::nullopt
+    std::optional<Key> firstKey;
+    // 葉のキーの数
+    size_t size;
+    // 葉を書き換えた回数
+    uint64_t writes;
+    // 葉を書き換えた更新が、排他区間に入るまで待ったナノ秒数の合計
+    uint64_t waitNanos;
+};
+
+/**
+ * @brief T どうしを == で比べられるか
+ */
+template <typename T, typename = void>
+struct IsEqualityComparable : std::false_type {};
+template <typename T>
+struct IsEqualityComparable<T, std::void_t<decltype(std::declval<const T&>() == std::declval<const T&>())>>
+    : std::is_convertible<decltype(std::declval<const T&>() == std::declval<const T&>()), bool> {};
+
+/**
+ * @brief 比較関数が表す順序の向き
+ * @details std::less / std::greater は 1 / -1、それ以外の比較関数は 0
+ */
+template <typename Key, typename Compare>
+struct OrderDirection : std::integral_constant<int, 0> {};
+template <typename Key>
+struct OrderDirection<Key, std::less<>> : std::integral_constant<int, 1> {};
+template <typename Key>
+struct OrderDirection<Key, std::less<Key>> : std::integral_constant<int, 1> {};
+template <typename Key>
+struct OrderDirection<Key, std::greater<>> : std::integral_constant<int, -1> {};
+template <typename Key>
+struct OrderDirection<Key, std::greater<Key>> : std::integral_constant<int, -1> {};
+
+/**
+ * @brief ノード内のキー探索
+ * @details 汎用版。比較関数による二分探索で位置を求める
+ */
+template <typename Key, typename Compare, typename = void>
+struct NodeSearch {
+    /**
+     * @brief key より前に並ぶキーの数 (key 以上となる最初の位置)
+     */
+    template <typename K>
+    static size_t lowerIndex(const std::vector<Key>& keys, const K& key, const Compare& comp) {
+        return std::lower_bound(keys.begin(), keys.end(), key, comp) - keys.begin();
+    }
+
+    /**
+     * @brief key 以前に並ぶキーの数 (key より後となる最初の位置)
+     */
+    template <typename K>
+    static size_t upperIndex(const std::vector<Key>& keys, const K& key, const Compare& comp) {
+        return std::upper_bound(keys.begin(), keys.end(), key, comp) - keys.begin();
+    }
+};
+
+/**
+ * @brief 算術型のキーを昇順・降順で比較する場合のノード内探索
+ * @details 比較結果を分岐なしで数え上げて位置を求める。ノード内のキーは
+ *          kOrder 個以下なので二分探索より速く、ループはベクトル化される。
+ *          キーと異なる型で検索された場合は汎用版に任せる
+ */
+template <typename Key, typename Compare>
+struct NodeSearch<Key, Compare,
+                  std::enable_if_t<std::is_arithmetic_v<Key> && OrderDirection<Key, Compare>::value != 0>> {
+    static constexpr bool kAscending = OrderDirection<Key, Compare>::value > 0;
+
+    template <typename K>
+    static size_t lowerIndex(const std::vector<Key>& keys, const K& key, const Compare& comp) {
+        if constexpr (std::is_same_v<K, Key>) {
+            const Key* data = keys.data();
+            size_t n = 0;
+            for (size_t i = 0; i < keys.size(); i++) {
+                n += kAscending ? (data[i] < key) : (key < data[i]);
+            }
+            return n;
+        } else {
+            // 第 3 引数が void 以外なら汎用版が選ばれる
+            return NodeSearch<Key, Compare, int>::lowerIndex(keys, key, comp);
+        }
+    }
+
+    template <typename K>
+    static size_t upperIndex(const std::vector<Key>& keys, const K& key, const Compare& comp) {
+        if constexpr (std::is_same_v<K, Key>) {
+            const Key* data = keys.data();
+            size_t n = 0;
+            for (size_t i = 0; i < keys.size(); i++) {
+                n += kAscending ? !(key < data[i]) : !(data[i] < key);
+            }
+            return n;
+        } else {
+            return NodeSearch<Key, Compare, int>::upperIndex(keys, key, comp);
+        }
+    }
+};
+
+/**
+ * @brief futex による待機と起床
+ * @details futex がない環境では wait() は yield するだけなので、呼び出し側は
+ *          戻るたびに値を調べ直すこと
+ */
+struct Futex {
+    /**
+     * @brief word が value の間だけ眠る
+     * @param word 
+     * @param value 
+     * @param timeoutNanos 眠る時間の上限 (負なら無制限)
+     */
+    static void wait(std::atomic<uint32_t>& word, uint32_t value, long timeoutNanos = -1) {
+#ifdef BPLUSTREE_HAVE_FUTEX
+        struct timespec timeout = {timeoutNanos / 1000000000, timeoutNanos % 1000000000};
+        ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT_PRIVATE, value,
+                  timeoutNanos < 0 ? nullptr : &timeout, nullptr, 0);
+#else
+        (void)word;
+        (void)value;
+        (void)timeoutNanos;
+        std::this_thread::yield();
+#endif
+    }
+
+    /**
+     * @brief word で眠っているスレッドを count 個まで起こす
+     * @param word 
+     * @param count 
+     */
+    static void wake(std::atomic<uint32_t>& word, int count = 1) {
+#ifdef BPLUSTREE_HAVE_FUTEX
+        ::syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+#else
+        (void)word;
+        (void)count;
+#endif
+    }
+};
+
+/**
+ * @brief キュー型 (MCS) のラッチ
+ * @details 待つスレッドは自分のキューノードのフラグだけを見て回るので、競合しても
+ *          ラッチのキャッシュラインを奪い合わず、解放は到着順に 1 スレッドずつ渡る。
+ *          spinBudget 回回っても渡されなければ futex で眠り、前のスレッドが
+ *          渡すときに起こす (ハイブリッド)。spinBudget を kSpinForever にすると
+ *          眠らずに回り続ける。取得・競合・眠った回数を数える。
+ *          BPlusTree にはノード単位のラッチがなく、enableWriterQueue() した木では
+ *          このラッチを木全体の更新が latch_ の手前で並ぶ 1 本の待ち行列として使う。
+ *          更新どうしの排他は木全体の単位のままで、統計も木全体で 1 組になる
+ */
+class McsLatch {
+    enum : uint32_t { kWaiting, kGranted, kParked };
+
+    // 待っているスレッドごとのキューの要素
+    struct alignas(64) QueueNode {
+        std::atomic<QueueNode*> next{nullptr};
+        std::atomic<uint32_t> state{kWaiting};
+    };
+
+public:
+    // 眠らずに回り続ける
+    static constexpr uint32_t kSpinForever = UINT32_MAX;
+    // 複数のコアがある場合に回る回数 (1 コアでは回っても解放されないので回らない)
+    static constexpr uint32_t kDefaultSpinBudget = BPLUSTREE_MCS_SPIN_BUDGET;
+
+    /**
+     * @brief ラッチの統計
+     */
+    struct Stats {
+        // 取得した回数
+        uint64_t acquisitions;
+        // 先に待っているスレッドがいた回数
+        uint64_t contended;
+        // 回り切れずに futex で眠った回数
+        uint64_t parked;
+    };
+
+    /**
+     * @brief ラッチを取っている間だけ生きるキューノード (RAII)
+     */
+    class Guard {
+    public:
+        explicit Guard(McsLatch& latch) : latch_(latch) {
+            latch_.lock(node_);
+        }
+        ~Guard() {
+            latch_.unlock(node_);
+        }
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+
+    private:
+        McsLatch& latch_;
+        QueueNode node_;
+    };
+
+    explicit McsLatch(uint32_t spinBudget = defaultSpinBudget()) : spinBudget_(spinBudget) {}
+    McsLatch(const McsLatch&) = delete;
+    McsLatch& operator=(const McsLatch&) = delete;
+
+    static uint32_t defaultSpinBudget() {
+        return std::thread::hardware_concurrency() > 1 ? kDefaultSpinBudget : 0;
+    }
+
+    Stats stats() const {
+        return {acquisitions_.load(std::memory_order_relaxed), contended_.load(std::memory_order_relaxed),
+                parked_.load(std::memory_order_relaxed)};
+    }
+
 private:
-    // ルートノード
-    std::shared_ptr<BPlusNode> root_;
+    void lock(QueueNode& node) {
+        QueueNode* prev = tail_.exchange(&node, std::memory_order_acq_rel);
+        acquisitions_.fetch_add(1, std::memory_order_relaxed);
+        if (!prev) {
+            return;
+        }
+        contended_.fetch_add(1, std::memory_order_relaxed);
+        prev->next.store(&node, std::memory_order_release);
+        for (uint32_t spins = 0; spins < spinBudget_ || spinBudget_ == kSpinForever; spins++) {
+            if (node.state.load(std::memory_order_acquire) == kGranted) {
+                return;
+            }
+            pause();
+        }
+        uint32_t expected = kWaiting;
+        if (!node.state.compare_exchange_strong(expected, kParked, std::memory_order_acq_rel)) {
+            return;
+        }
+        parked_.fetch_add(1, std::memory_order_relaxed);
+        while (node.state.load(std::memory_order_acquire) != kGranted) {
+            Futex::wait(node.state, kParked);
+        }
+    }
+
+    void unlock(QueueNode& node) {
+        QueueNode* next = node.next.load(std::memory_order_acquire);
+        if (!next) {
+            QueueNode* expected = &node;
+            if (tail_.compare_exchange_strong(expected, nullptr, std::memory_order_acq_rel)) {
+                return;
+            }
+            // 後続がキューに入った直後で、まだつながっていない
+            while (!(next = node.next.load(std::memory_order_acquire))) {
+                pause();
+            }
+        }
+        if (next->state.exchange(kGranted, std::memory_order_acq_rel) == kParked) {
+            Futex::wake(next->state);
+        }
+    }
+
+    static void pause() {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#else
+        std::this_thread::yield();
+#endif
+    }
+
+    const uint32_t spinBudget_;
+    alignas(64) std::atomic<QueueNode*> tail_{nullptr};
+    alignas(64) std::atomic<uint64_t> acquisitions_{0};
+    std::atomic<uint64_t> contended_{0};
+    std::atomic<uint64_t> parked_{0};
+};
+
+/**
+ * @brief ワークスティーリングのスレッドプール
+ * @details ワーカーごとに両端キューを持つ。ワーカーが投入したタスクは自分のキューの
+ *          末尾に積んで末尾から取り出し、自分のキューが空になったら他のワーカーの
+ *          キューの先頭から盗む。外部のスレッドが投入したタスクは順番にワーカーへ
+ *          配る。並列操作はすべて 1 つのプールへ投入するので、同時に走る一括処理が
+ *          スレッドを作り過ぎない。cpus を与えるとワーカー i を cpus[i % size] に固定する
+ */
+class WorkStealingPool {
+public:
+    using Task = std::packaged_task<void()>;
 
     /**
-     * @brief 木を辿り、指定された葉ノードを持つ親ノードを探す関数
-     * @param key 
-     * @return std::shared_ptr<BPlusLeafNode> 
+     * @brief プールの統計
+     */
+    struct Stats {
+        // 実行したタスクの数
+        uint64_t executed;
+        // 他のワーカーのキューから盗んだタスクの数
+        uint64_t stolen;
+    };
+
+    /**
+     * @brief ワーカーを起動する
+     * @param threads ワーカーの数
+     * @param cpus ワーカーを固定する CPU の番号 (空なら固定しない)
+     */
+    explicit WorkStealingPool(unsigned threads = std::thread::hardware_concurrency(), std::vector<int> cpus = {})
+        : workers_(std::max(threads, 1u)) {
+        for (size_t i = 0; i < workers_.size(); i++) {
+            workers_[i].thread = std::thread([this, i] { run(i); });
+#ifdef __linux__
+            if (!cpus.empty()) {
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                CPU_SET(cpus[i % cpus.size()], &set);
+                pthread_setaffinity_np(workers_[i].thread.native_handle(), sizeof(set), &set);
+            }
+#endif
+        }
+    }
+
+    /**
+     * @brief 投入済みのタスクをすべて実行してからワーカーを止める
+     */
+    ~WorkStealingPool() {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex_);
+            stopping_ = true;
+        }
+        workReady_.notify_all();
+        for (auto& worker : workers_) {
+            worker.thread.join();
+        }
+    }
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    /**
+     * @brief ライブラリ全体で共有するプール
+     * @return WorkStealingPool& 
+     */
+    static WorkStealingPool& shared() {
+        static WorkStealingPool pool;
+        return pool;
+    }
+
+    /**
+     * @brief タスクの投入
+     * @param fn 
+     * @return std::future<std::invoke_result_t<Fn>> fn の結果
+     */
+    template <typename Fn>
+    std::future<std::invoke_result_t<Fn>> submit(Fn fn) {
+        std::packaged_task<std::invoke_result_t<Fn>()> task(std::move(fn));
+        auto result = task.get_future();
+        size_t index = currentPool_ == this ? currentIndex_
+                                            : next_.fetch_add(1, std::memory_order_relaxed) % workers_.size();
+        {
+            std::lock_guard<std::mutex> lock(workers_[index].mutex);
+            workers_[index].tasks.emplace_back(std::move(task));
+        }
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex_);
+            pending_++;
+        }
+        workReady_.notify_one();
+        return result;
+    }
+
+    /**
+     * @brief future の完了を待つ
+     * @details 待っている間は投入済みの他のタスクを実行する。ワーカーの中で
+     *          入れ子の並列操作を待ってもワーカーが尽きて止まらない
+     * @param future 
+     * @return T future の結果
+     */
+    template <typename T>
+    T wait(std::future<T>& future) {
+        while (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            if (!runOne()) {
+                future.wait_for(std::chrono::microseconds(50));
+            }
+        }
+        return future.get();
+    }
+
+    size_t size() const {
+        return workers_.size();
+    }
+
+    Stats stats() const {
+        return {executed_.load(std::memory_order_relaxed), stolen_.load(std::memory_order_relaxed)};
+    }
+
+private:
+    // ワーカーとそのキュー
+    struct alignas(64) Worker {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+        std::thread thread;
+    };
+
+    void run(size_t index) {
+        currentPool_ = this;
+        currentIndex_ = index;
+        while (true) {
+            if (runOne()) {
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleepMutex_);
+            workReady_.wait(lock, [this] { return stopping_ || pending_ > 0; });
+            if (stopping_ && pending_ == 0) {
+                return;
+            }
+        }
+    }
+
+    /**
+     * @brief タスクを 1 つ取り出して実行する
+     * @details ワーカーは自分のキューの末尾から、それ以外は各キューの先頭から取る
+     * @return bool 実行したか
+     */
+    bool runOne() {
+        std::optional<Task> task;
+        bool own = currentPool_ == this;
+        size_t start = own ? currentIndex_ : next_.load(std::memory_order_relaxed);
+        for (size_t k = 0; k < workers_.size() && !task; k++) {
+            Worker& worker = workers_[(start + k) % workers_.size()];
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            if (worker.tasks.empty()) {
+                continue;
+            }
+            if (own && k == 0) {
+                task.emplace(std::move(worker.tasks.back()));
+                worker.tasks.pop_back();
+            } else {
+                task.emplace(std::move(worker.tasks.front()));
+                worker.tasks.pop_front();
+                stolen_.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        if (!task) {
+            return false;
+        }
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex_);
+            pending_--;
+        }
+        (*task)();
+        executed_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    // 実行中のスレッドがワーカーであるプールとその番号
+    static inline thread_local WorkStealingPool* currentPool_ = nullptr;
+    static inline thread_local size_t currentIndex_ = 0;
+
+    std::vector<Worker> workers_;
+    std::atomic<size_t> next_{0};
+    std::mutex sleepMutex_;
+    std::condition_variable workReady_;
+    // キューに積まれていてまだ取り出されていないタスクの数
+    size_t pending_ = 0;
+    bool stopping_ = false;
+    std::atomic<uint64_t> executed_{0};
+    std::atomic<uint64_t> stolen_{0};
+};
+
+/**
+ * @brief キー範囲の監視の登録と、変更通知のまとめ配送を行うクラス
+ * @details 監視範囲は下限の昇順に並べ、先頭からの上限の最大値を併せて持つ。
+ *          変更されたキーを含む監視は、下限がキー以下の位置から上限の最大値が
+ *          キー以下になるまで遡るだけで見つかる。変更は監視ごとに溜めておき、
+ *          専用の通知スレッドが溜まった分をまとめて callback へ渡す
+ */
+template <typename Key, typename Value, typename Compare>
+class RangeWatchers {
+public:
+    /**
+     * @brief 1 件の変更。value が std::nullopt の場合は削除
+     */
+    struct Change {
+        Key key;
+        std::optional<Value> value;
+    };
+    using Callback = std::function<void(const std::vector<Change>&)>;
+
+    explicit RangeWatchers(const Compare& comp) : comp_(comp), thread_([this] { run(); }) {}
+
+    ~RangeWatchers() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wakeup_.notify_all();
+        thread_.join();
+    }
+
+    /**
+     * @brief 監視の登録
+     * @param range 
+     * @param callback 
+     * @return uint64_t 監視 ID
+     */
+    uint64_t add(const KeyRange<Key>& range, Callback callback) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto watch = std::make_unique<Watch>();
+        watch->id = nextId_++;
+        watch->range = range;
+        watch->callback = std::move(callback);
+        auto position = std::upper_bound(watches_.begin(), watches_.end(), watch,
+            [this](const std::unique_ptr<Watch>& a, const std::unique_ptr<Watch>& b) {
+                // 下限なしは最も小さい
+                return b->range.lo && (!a->range.lo || comp_(*a->range.lo, *b->range.lo));
+            });
+        uint64_t id = watch->id;
+        watches_.insert(position, std::move(watch));
+        rebuildMaxHi();
+        return id;
+    }
+
+    /**
+     * @brief 監視の解除
+     * @details 戻った後に、解除した監視の callback が呼ばれることはない。
+     *          callback の中から呼ぶと待ち合わせが終わらないため呼ばないこと
+     * @param id 
+     * @return bool 解除した場合 true
+     */
+    bool remove(uint64_t id) {
+        std::lock_guard<std::mutex> delivery(deliveryMutex_);
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = std::find_if(watches_.begin(), watches_.end(),
+                               [id](const std::unique_ptr<Watch>& watch) { return watch->id == id; });
+        if (it == watches_.end()) {
+            return false;
+        }
+        dirty_.erase(std::remove(dirty_.begin(), dirty_.end(), it->get()), dirty_.end());
+        watches_.erase(it);
+        rebuildMaxHi();
+        return true;
+    }
+
+    /**
+     * @brief キーの変更を、そのキーを含む監視へ積む
+     * @param key 
+     * @param value 
+     */
+    void publish(const Key& key, const std::optional<Value>& value) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto end = std::partition_point(watches_.begin(), watches_.end(),
+            [&](const std::unique_ptr<Watch>& watch) { return !watch->range.lo || !comp_(key, *watch->range.lo); });
+        bool queued = false;
+        for (size_t j = end - watches_.begin(); j-- > 0;) {
+            if (maxHi_[j] && !comp_(key, *maxHi_[j])) {
+                break;
+            }
+            Watch& watch = *watches_[j];
+            if (!watch.range.hi || comp_(key, *watch.range.hi)) {
+                if (watch.pending.empty()) {
+                    dirty_.push_back(&watch);
+                }
+                watch.pending.push_back(Change{key, value});
+                queued = true;
+            }
+        }
+        if (queued) {
+            wakeup_.notify_one();
+        }
+    }
+
+    /**
+     * @brief ここまでに積まれた変更が全て配送されるまで待つ
+     */
+    void flush() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        idle_.wait(lock, [this] { return dirty_.empty() && !delivering_; });
+    }
+
+private:
+    struct Watch {
+        uint64_t id;
+        KeyRange<Key> range;
+        Callback callback;
+        // 未配送の変更
+        std::vector<Change> pending;
+    };
+
+    Compare comp_;
+    std::mutex mutex_;
+    // 配送中の callback と監視の解除を排他する
+    std::mutex deliveryMutex_;
+    std::condition_variable wakeup_;
+    std::condition_variable idle_;
+    // 下限の昇順 (下限なしが先頭)
+    std::vector<std::unique_ptr<Watch>> watches_;
+    // watches_[0..j] の上限の最大値。std::nullopt は上限なし
+    std::vector<std::optional<Key>> maxHi_;
+    // 未配送の変更を持つ監視
+    std::vector<Watch*> dirty_;
+    uint64_t nextId_ = 1;
+    bool delivering_ = false;
+    bool stop_ = false;
+    std::thread thread_;
+
+    void rebuildMaxHi() {
+        maxHi_.resize(watches_.size());
+        for (size_t j = 0; j < watches_.size(); j++) {
+            const auto& hi = watches_[j]->range.hi;
+            if (j == 0 || !hi || (maxHi_[j - 1] && comp_(*maxHi_[j - 1], *hi))) {
+                maxHi_[j] = hi;
+            } else {
+                maxHi_[j] = maxHi_[j - 1];
+            }
+        }
+    }
+
+    /**
+     * @brief 通知スレッドの本体
+     */
+    void run() {
+        std::vector<std::pair<Watch*, std::vector<Change>>> batches;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                wakeup_.wait(lock, [this] { return stop_ || !dirty_.empty(); });
+                if (dirty_.empty()) {
+                    return;
+                }
+            }
+            std::lock_guard<std::mutex> delivery(deliveryMutex_);
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                for (Watch* watch : dirty_) {
+                    batches.emplace_back(watch, std::move(watch->pending));
+                    watch->pending.clear();
+                }
+                dirty_.clear();
+                delivering_ = true;
+            }
+
+            for (auto& [watch, changes] : batches) {
+                watch->callback(changes);
+            }
+            batches.clear();
+
+            std::lock_guard<std::mutex> lock(mutex_);
+            delivering_ = false;
+            if (dirty_.empty()) {
+                idle_.notify_all();
+            }
+        }
+    }
+};
+
+template <typename Key, typename Value, typename Compare>
+class DelegatedTree;
+
+/**
+ * @brief 木構造を表現するクラス
+ * @details キーは Compare で順序付ける (既定は昇順の std::less<>)。
+ *          Compare が透過的 (is_transparent を持つ) な場合、検索系の関数は
+ *          Key と比較可能な型 (std::string に対する std::string_view など) を
+ *          Key に変換せずにそのまま受け取れる。
+ *          算術型のキーを std::less / std::greater で比較する場合は、
+ *          ノード内探索に分岐のない専用の実装が使われる。
+ *          木全体を 1 つの読み書きラッチで保護し、公開関数はスレッドセーフ
+ */
+template <typename Key = int, typename Value = int, typename Compare = std::less<>>
+class BPlusTree {
+public:
+    using LeafNode = BPlusLeafNode<Key, Value>;
+    using InternalNode = BPlusInternalNode<Key>;
+    using Range = KeyRange<Key>;
+
+private:
+    // ルートノード
+    std::shared_ptr<BPlusNode> root_;
+    // キーの比較関数
+    Compare comp_;
+    // キー範囲の監視 (最初の watch() で作る)
+    std::unique_ptr<RangeWatchers<Key, Value, Compare>> watchers_;
+
+    // 木全体のラッチ。読み取りは共有、更新は排他で取る
+    mutable std::shared_mutex latch_;
+    // 更新が latch_ の前に並ぶ木全体で 1 本のラッチ (ノード単位ではない)。更新どうしは
+    // ここで順番待ちし、latch_ を読み取りと奪い合うのは先頭の 1 スレッドだけになる。
+    // enableWriterQueue() で作る。nullptr なら更新は latch_ だけを取る
+    std::unique_ptr<McsLatch> writerLatch_;
+    // 直前の WriteLock が排他区間に入るまで待ったナノ秒数。区間内で最初に書き換えた葉に
+    // 加えて 0 に戻す。latch_ を排他で持って読み書きする
+    mutable uint64_t writeWaitNanos_ = 0;
+    // 組み合わせ (flat combining) の公開枠と、組み合わせ役のロック。
+    // 公開枠は最初の組み合わせ操作で確保する
+    struct CombiningSlot;
+    std::unique_ptr<CombiningSlot[]> combiningSlots_;
+    std::once_flag combiningSlotsOnce_;
+    // 公開枠に置いた順に振る番号 (同じキーへの操作は後に置いたものを残す)
+    std::atomic<uint64_t> combiningTickets_{0};
+    std::mutex combinerMutex_;
+    std::atomic<uint64_t> combiningPasses_{0};
+    std::atomic<uint64_t> combinedOps_{0};
+    // 並列操作がタスクを投入するプール (nullptr なら WorkStealingPool::shared())。
+    // 共有プールは最初の並列操作で作るので、並列操作を使わない木はスレッドを起こさない
+    WorkStealingPool* executor_ = nullptr;
+
+    // オンラインバックアップの開始ごとに進むエポック
+    uint64_t epoch_ = 0;
+    // 実行中のオンラインバックアップのエポック (実行中でなければ 0)
+    uint64_t backupEpoch_ = 0;
+    // バックアップが読む前に書き換えられた葉の、バックアップ開始時点の内容
+    std::unordered_map<const LeafNode*, std::pair<std::vector<Key>, std::vector<Value>>> backupPreImages_;
+
+    using Search = NodeSearch<Key, Compare>;
+
+    // 葉ノードのキーを辞書符号化できるか (std::string キーを昇順に並べる場合のみ)
+    static constexpr bool kEncodableKeys =
+        std::is_same_v<Key, std::string> && OrderDirection<Key, Compare>::value > 0;
+
+    /**
+     * @brief 木を辿り、指定された葉ノードを持つ親ノードを探す関数
+     * @param key 
+     * @return std::shared_ptr<LeafNode> 
+     */
+    template <typename K>
+    std::shared_ptr<LeafNode> findLeaf(const K& key) {
+        std::shared_ptr<BPlusNode> current = root_;
+        
+        while (current && !current->isLeaf_) {
+            auto internalNode = std::static_pointer_cast<InternalNode>(current);
+            current = internalNode->childPointers_[Search::upperIndex(internalNode->keys_, key, comp_)];
+        }
+        
+        return std::static_pointer_cast<LeafNode>(current);
+    }
+
+    /**
+     * @brief 範囲の先頭キーを含む葉ノードを探す関数
+     * @details 下限と等価なキーが複数ありうる検索キー (キーの一部だけを比べるものなど) でも
+     *          最初の 1 つを取りこぼさないよう、下限より小さい区切りキーの数で子を選ぶ。
+     *          下限がない場合は最も左の葉ノードを返す
+     * @param range 
+     * @return std::shared_ptr<LeafNode> 
+     */
+    template <typename K>
+    std::shared_ptr<LeafNode> findStartLeaf(const KeyRange<K>& range) {
+        std::shared_ptr<BPlusNode> current = root_;
+        while (current && !current->isLeaf_) {
+            auto internalNode = std::static_pointer_cast<InternalNode>(current);
+            size_t i = range.lo ? Search::lowerIndex(internalNode->keys_, *range.lo, comp_) : 0;
+            current = internalNode->childPointers_[i];
+        }
+        return std::static_pointer_cast<LeafNode>(current);
+    }
+
+    // オンラインバックアップが共有ラッチを 1 回取る間に読む葉ノードの数
+    static constexpr int kBackupLeavesPerLatch = 64;
+    // bgsave() の子プロセスが書き出しに使うバッファの大きさ
+    static constexpr size_t kForkWriteBufferSize = 1u << 20;
+    // バックアップファイルの先頭
+    static constexpr char kBackupMagic[8] = {'B', 'P', 'T', 'B', 'A', 'C', 'K', '2'};
+    // ブロックがフェンス範囲を持つ (差分バックアップ)
+    static constexpr uint32_t kBlockFenced = 1u << 0;
+    static constexpr uint32_t kBlockHasLo = 1u << 1;
+    static constexpr uint32_t kBlockHasHi = 1u << 2;
+    // 終端のブロック
+    static constexpr uint32_t kBlockEnd = 1u << 31;
+
+    /**
+     * @brief バックアップファイルのヘッダ
+     * @details ファイルはヘッダの後に、葉ごとの
+     *          [フラグ, 要素数, (下限), (上限), キー列, 値列] のブロックが続き、
+     *          終端のブロックと総要素数で終わる。
+     *          差分バックアップのブロックは葉のフェンス範囲 [下限, 上限) を持ち、
+     *          復元時はその範囲を丸ごとブロックの内容で置き換える
+     */
+    struct BackupHeader {
+        char magic[sizeof(kBackupMagic)];
+        uint32_t keySize;
+        uint32_t valueSize;
+        // このバックアップのスナップショット
+        uint64_t snapshot;
+        // 差分の起点のスナップショット (全体バックアップなら 0)
+        uint64_t since;
+    };
+
+    /**
+     * @brief 差分バックアップの対象の葉ノードと、親の区切りキーから決まるその範囲
+     */
+    struct FencedLeaf {
+        std::shared_ptr<LeafNode> leaf;
+        std::optional<Key> lo;
+        std::optional<Key> hi;
+    };
+
+    /**
+     * @brief since 以降に書き換えられた葉ノードを範囲とともにキー順に集める
+     * @details dirtyVersion_ が since より古い部分木は降りずに飛ばす
+     * @param node 
+     * @param lo 
+     * @param hi 
+     * @param since 
+     * @param out 
+     */
+    void collectDirtyLeaves(const std::shared_ptr<BPlusNode>& node,
+                            const std::optional<Key>& lo, const std::optional<Key>& hi,
+                            uint64_t since, std::vector<FencedLeaf>& out) {
+        if (!node || node->dirtyVersion_ < since) {
+            return;
+        }
+        if (node->isLeaf_) {
+            out.push_back({std::static_pointer_cast<LeafNode>(node), lo, hi});
+            return;
+        }
+        auto internalNode = std::static_pointer_cast<InternalNode>(node);
+        for (size_t i = 0; i < internalNode->childPointers_.size(); i++) {
+            collectDirtyLeaves(internalNode->childPointers_[i],
+                               i == 0 ? lo : std::optional<Key>(internalNode->keys_[i - 1]),
+                               i < internalNode->keys_.size() ? std::optional<Key>(internalNode->keys_[i]) : hi,
+                               since, out);
+        }
+    }
+
+    /**
+     * @brief 値をバイト列として buffer の末尾へ追加する
+     * @param buffer 
+     * @param data 
+     * @param size 
+     */
+    static void appendBytes(std::string& buffer, const void* data, size_t size) {
+        buffer.append(static_cast<const char*>(data), size);
+    }
+
+    /**
+     * @brief バックアップの 1 ブロックを buffer へ書き出す
+     * @param buffer 
+     * @param flags 
+     * @param keys 
+     * @param values 
+     * @param lo 
+     * @param hi 
+     */
+    static void appendBackupBlock(std::string& buffer, uint32_t flags,
+                                  const std::vector<Key>& keys, const std::vector<Value>& values,
+                                  const std::optional<Key>& lo, const std::optional<Key>& hi) {
+        flags |= (lo ? kBlockHasLo : 0) | (hi ? kBlockHasHi : 0);
+        uint32_t count = (uint32_t)keys.size();
+        appendBytes(buffer, &flags, sizeof(flags));
+        appendBytes(buffer, &count, sizeof(count));
+        if (lo) {
+            appendBytes(buffer, &*lo, sizeof(Key));
+        }
+        if (hi) {
+            appendBytes(buffer, &*hi, sizeof(Key));
+        }
+        appendBytes(buffer, keys.data(), sizeof(Key) * count);
+        appendBytes(buffer, values.data(), sizeof(Value) * count);
+    }
+
+    /**
+     * @brief バックアップの本体
+     * @details 開始時にエポックを進め、以降に書き換えられる葉のうちまだ読んでいない
+     *          ものは、書き込み側が書き換え前の内容を退避する。バックアップは退避
+     *          された内容を優先して読み、開始後に作られた葉は読み飛ばす。
+     *          全体バックアップは葉の連結リストを辿る。差分バックアップは開始時に
+     *          排他ラッチの中で since 以降に書き換えられた葉とその範囲を集める。
+     *          葉の読み取りは数十葉ごとに共有ラッチを短く取って行い、
+     *          ファイルへの書き出しはラッチの外で行う
+     * @param path 
+     * @param since 差分の起点のスナップショット (全体バックアップなら 0)
+     * @return std::optional<uint64_t> 
+     */
+    std::optional<uint64_t> writeBackup(const std::string& path, uint64_t since) {
+        static_assert(std::is_trivially_copyable_v<Key> && std::is_trivially_copyable_v<Value>,
+                      "バックアップはキーと値がトリビアルにコピーできる型の場合のみ使える");
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            return std::nullopt;
+        }
+        BackupHeader header{{}, sizeof(Key), sizeof(Value), 0, since};
+        std::copy(kBackupMagic, kBackupMagic + sizeof(kBackupMagic), header.magic);
+        std::shared_ptr<LeafNode> leaf;
+        std::vector<FencedLeaf> dirty;
+        {
+            std::unique_lock<std::shared_mutex> lock(latch_);
+            if (backupEpoch_ != 0) {
+                return std::nullopt;
+            }
+            header.snapshot = backupEpoch_ = ++epoch_;
+            if (since == 0) {
+                leaf = findStartLeaf(Range{});
+            } else {
+                collectDirtyLeaves(root_, std::nullopt, std::nullopt, since, dirty);
+            }
+        }
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+        uint64_t total = 0;
+        size_t next = 0;
+        std::string buffer;
+        while (leaf || next < dirty.size()) {
+            buffer.clear();
+            {
+                std::shared_lock<std::shared_mutex> lock(latch_);
+                for (int n = 0; n < kBackupLeavesPerLatch && (leaf || next < dirty.size()); n++) {
+                    const FencedLeaf* fenced = since == 0 ? nullptr : &dirty[next++];
+                    auto current = fenced ? fenced->leaf : std::exchange(leaf, leaf->next_);
+                    if (current->birthEpoch_ >= header.snapshot) {
+                        continue;
+                    }
+                    // 退避された内容は、この時点で書き込み側からは触られない
+                    auto preImage = backupPreImages_.find(current.get());
+                    const auto& keys = preImage != backupPreImages_.end() ? preImage->second.first : current->keys_;
+                    const auto& values = preImage != backupPreImages_.end() ? preImage->second.second : current->values_;
+                    current->backupEpoch_ = header.snapshot;
+                    if (fenced) {
+                        appendBackupBlock(buffer, kBlockFenced, keys, values, fenced->lo, fenced->hi);
+                    } else if (!keys.empty()) {
+                        appendBackupBlock(buffer, 0, keys, values, std::nullopt, std::nullopt);
+                    }
+                    total += keys.size();
+                }
+            }
+            out.write(buffer.data(), buffer.size());
+        }
+        uint32_t end[2] = {kBlockEnd, 0};
+        out.write(reinterpret_cast<const char*>(end), sizeof(end));
+        out.write(reinterpret_cast<const char*>(&total), sizeof(total));
+
+        {
+            std::unique_lock<std::shared_mutex> lock(latch_);
+            backupEpoch_ = 0;
+            backupPreImages_.clear();
+        }
+        out.flush();
+        return out ? std::optional<uint64_t>(header.snapshot) : std::nullopt;
+    }
+
+    /**
+     * @brief bgsave() の子プロセスで木全体を書き出す
+     * @details 子プロセスには fork したスレッドしかなく、木を書き換える者がいないので
+     *          ラッチを取らずに葉の連結リストを辿る (ラッチは fork した時点の状態で
+     *          写っているため取れない)。他のスレッドが fork の瞬間に持っていた
+     *          ロック (メモリ確保や iostream の内部のものを含む) も取られたまま写るので、
+     *          ヒープの確保もストリームも使わず、親が fork の前に確保した buffer に
+     *          詰めて open / write で書き出す
+     * @param path 
+     * @param snapshot 
+     * @param buffer 書き出し用のバッファ
+     * @param capacity buffer の大きさ
+     * @return bool 
+     */
+    bool writeForkedSnapshot(const char* path, uint64_t snapshot, char* buffer, size_t capacity) {
+        static_assert(std::is_trivially_copyable_v<Key> && std::is_trivially_copyable_v<Value>,
+                      "バックアップはキーと値がトリビアルにコピーできる型の場合のみ使える");
+        int fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            return false;
+        }
+        bool ok = true;
+        size_t used = 0;
+        auto flush = [&] {
+            for (size_t done = 0; done < used;) {
+                ssize_t n = ::write(fd, buffer + done, used - done);
+                if (n < 0) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    ok = false;
+                    break;
+                }
+                done += (size_t)n;
+            }
+            used = 0;
+        };
+        auto put = [&](const void* data, size_t size) {
+            const char* bytes = static_cast<const char*>(data);
+            while (size > 0) {
+                if (used == capacity) {
+                    flush();
+                }
+                size_t n = std::min(size, capacity - used);
+                std::memcpy(buffer + used, bytes, n);
+                used += n;
+                bytes += n;
+                size -= n;
+            }
+        };
+        BackupHeader header{{}, sizeof(Key), sizeof(Value), snapshot, 0};
+        std::copy(kBackupMagic, kBackupMagic + sizeof(kBackupMagic), header.magic);
+        put(&header, sizeof(header));
+        uint64_t total = 0;
+        for (auto leaf = findStartLeaf(Range{}); leaf; leaf = leaf->next_) {
+            uint32_t count = (uint32_t)leaf->keys_.size();
+            if (count == 0) {
+                continue;
+            }
+            // appendBackupBlock() と同じ配置 (範囲を持たないブロック)
+            uint32_t flags = 0;
+            put(&flags, sizeof(flags));
+            put(&count, sizeof(count));
+            put(leaf->keys_.data(), sizeof(Key) * count);
+            put(leaf->values_.data(), sizeof(Value) * count);
+            total += count;
+        }
+        uint32_t end[2] = {kBlockEnd, 0};
+        put(end, sizeof(end));
+        put(&total, sizeof(total));
+        flush();
+        return ::close(fd) == 0 && ok;
+    }
+
+    /**
+     * @brief バックアップファイルのヘッダを読み、この木の型と合うか確かめる
+     * @param in 
+     * @return std::optional<BackupHeader> 
+     */
+    static std::optional<BackupHeader> readBackupHeader(std::istream& in) {
+        BackupHeader header;
+        in.read(reinterpret_cast<char*>(&header), sizeof(header));
+        if (!in || !std::equal(kBackupMagic, kBackupMagic + sizeof(kBackupMagic), header.magic)
+            || header.keySize != sizeof(Key) || header.valueSize != sizeof(Value)) {
+            return std::nullopt;
+        }
+        return header;
+    }
+
+    /**
+     * @brief ヘッダを読んだ後のバックアップファイルの内容を木へ適用する
+     * @details フェンス範囲を持つブロックは、範囲内の既存のキーを消してから挿入する
+     * @param in 
+     * @return bool 
+     */
+    bool applyBackup(std::istream& in) {
+        std::vector<Key> keys;
+        std::vector<Value> values;
+        uint64_t total = 0;
+        while (true) {
+            uint32_t block[2];
+            if (!in.read(reinterpret_cast<char*>(block), sizeof(block))) {
+                return false;
+            }
+            uint32_t flags = block[0], count = block[1];
+            if (flags & kBlockEnd) {
+                break;
+            }
+            Range fence;
+            Key bound;
+            if (flags & kBlockHasLo) {
+                in.read(reinterpret_cast<char*>(&bound), sizeof(Key));
+                fence.lo = bound;
+            }
+            if (flags & kBlockHasHi) {
+                in.read(reinterpret_cast<char*>(&bound), sizeof(Key));
+                fence.hi = bound;
+            }
+            keys.resize(count);
+            values.resize(count);
+            in.read(reinterpret_cast<char*>(keys.data()), sizeof(Key) * count);
+            in.read(reinterpret_cast<char*>(values.data()), sizeof(Value) * count);
+            if (!in) {
+                return false;
+            }
+            if (flags & kBlockFenced) {
+                std::vector<Key> stale;
+                forEachInRange(fence, [&stale](const Key& key, const Value&) { stale.push_back(key); });
+                for (const auto& key : stale) {
+                    erase(key);
+                }
+            }
+            for (uint32_t i = 0; i < count; i++) {
+                insert(keys[i], values[i]);
+            }
+            total += count;
+        }
+        uint64_t expected = 0;
+        in.read(reinterpret_cast<char*>(&expected), sizeof(expected));
+        return in && expected == total;
+    }
+
+    /**
+     * @brief 葉ノードを作る
+     * @return std::shared_ptr<LeafNode> 
+     */
+    std::shared_ptr<LeafNode> makeLeaf() {
+        auto leaf = std::make_shared<LeafNode>();
+        leaf->birthEpoch_ = leaf->dirtyVersion_ = epoch_;
+        return leaf;
+    }
+
+    /**
+     * @brief 内部ノードを作る
+     * @return std::shared_ptr<InternalNode> 
+     */
+    std::shared_ptr<InternalNode> makeInternal() {
+        auto node = std::make_shared<InternalNode>();
+        node->dirtyVersion_ = epoch_;
+        return node;
+    }
+
+    // 根から葉までの経路 (ノード数は 64 を超えない)
+    struct LeafPath {
+        std::array<BPlusNode*, 64> nodes;
+        size_t depth = 0;
+    };
+
+    /**
+     * @brief 葉ノードを探し、根からの経路を記録する関数
+     * @details 経路には印を付けない。書き換えると決まってから markDirty() を呼ぶ
+     * @param key 
+     * @param path 
+     * @return std::shared_ptr<LeafNode> 
+     */
+    template <typename K>
+    std::shared_ptr<LeafNode> findLeaf(const K& key, LeafPath& path) {
+        path.depth = 0;
+        std::shared_ptr<BPlusNode> current = root_;
+        while (current) {
+            path.nodes[path.depth++] = current.get();
+            if (current->isLeaf_) {
+                break;
+            }
+            auto internalNode = std::static_pointer_cast<InternalNode>(current);
+            current = internalNode->childPointers_[Search::upperIndex(internalNode->keys_, key, comp_)];
+        }
+        return std::static_pointer_cast<LeafNode>(current);
+    }
+
+    /**
+     * @brief 経路上のノードに書き換えのエポックを記録する
+     * @details 分割で書き換わる兄弟ノードは、この経路上のノードの子になる
+     * @param path 
+     */
+    void markDirty(const LeafPath& path) {
+        for (size_t i = 0; i < path.depth; i++) {
+            path.nodes[i]->dirtyVersion_ = epoch_;
+        }
+    }
+
+    /**
+     * @brief 書き換える葉ノードを探し、その範囲の上限も返す関数
+     * @param key 
+     * @param hi 葉ノードの範囲の上限 (祖先の区切りキーを指す。内部ノードが書き換わるまで有効)。
+     *           右端の葉なら nullptr
+     * @return std::shared_ptr<LeafNode> 
+     */
+    std::shared_ptr<LeafNode> findLeafForWrite(const Key& key, const Key*& hi) {
+        hi = nullptr;
+        std::shared_ptr<BPlusNode> current = root_;
+        while (current) {
+            current->dirtyVersion_ = epoch_;
+            if (current->isLeaf_) {
+                break;
+            }
+            auto internalNode = std::static_pointer_cast<InternalNode>(current);
+            size_t i = Search::upperIndex(internalNode->keys_, key, comp_);
+            if (i < internalNode->keys_.size()) {
+                hi = &internalNode->keys_[i];
+            }
+            current = internalNode->childPointers_[i];
+        }
+        return std::static_pointer_cast<LeafNode>(current);
+    }
+
+    /**
+     * @brief 更新のための排他区間 (writerLatch_ があれば並んでから latch_ を排他で取る)
+     * @details すぐに取れなかった場合だけ時計を読み、待った時間を writeWaitNanos_ に残す
+     */
+    class WriteLock {
+    public:
+        explicit WriteLock(const BPlusTree& tree) : lock_(tree.latch_, std::defer_lock) {
+            if (!tree.writerLatch_ && lock_.try_lock()) {
+                tree.writeWaitNanos_ = 0;
+                return;
+            }
+            auto start = std::chrono::steady_clock::now();
+            if (tree.writerLatch_) {
+                queue_.emplace(*tree.writerLatch_);
+            }
+            lock_.lock();
+            tree.writeWaitNanos_ = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count();
+        }
+
+    private:
+        std::optional<McsLatch::Guard> queue_;
+        std::unique_lock<std::shared_mutex> lock_;
+    };
+
+    /**
+     * @brief 葉ノードを書き換える前に呼ぶ
+     * @details 葉の版を進め、書き込みの集中度を数え、実行中のバックアップのために
+     *          内容を退避する
+     * @param leaf 
+     */
+    void touchLeaf(LeafNode& leaf) {
+        leaf.version_++;
+        leaf.writes_++;
+        leaf.waitNanos_ += writeWaitNanos_;
+        writeWaitNanos_ = 0;
+        preserveForBackup(leaf);
+    }
+
+    /**
+     * @brief 葉ノードを書き換える前に、実行中のバックアップのために内容を退避する
+     * @details バックアップ開始前からあり、バックアップがまだ読んでいない葉だけを
+     *          退避する。書き込み側の負担は、バックアップ中でなければ分岐 1 つで済む。
+     *          排他ラッチを持って呼ぶこと
+     * @param leaf 
+     */
+    void preserveForBackup(LeafNode& leaf) {
+        if (backupEpoch_ == 0 || leaf.birthEpoch_ >= backupEpoch_ || leaf.backupEpoch_ == backupEpoch_) {
+            return;
+        }
+        std::vector<Key> scratch;
+        backupPreImages_.emplace(&leaf, std::make_pair(leafKeys(leaf, scratch), leaf.values_));
+        leaf.backupEpoch_ = backupEpoch_;
+    }
+
+    /**
+     * @brief 昇順に並んだ keys の中で key 以上となる最初の位置を返す
+     * @param keys 
+     * @param key 
+     * @return size_t 
+     */
+    template <typename K>
+    size_t lowerIndex(const std::vector<Key>& keys, const K& key) const {
+        return Search::lowerIndex(keys, key, comp_);
+    }
+
+    /**
+     * @brief 辞書符号化された葉ノードを通常の表現へ戻す
+     * @details 葉ノードのキーを足したり消したりする処理は、先にこの関数を呼ぶこと
+     *          (値だけの書き換えは符号化されたまま行える)
+     * @param leaf 
+     */
+    static void decodeLeaf(LeafNode& leaf) {
+        if constexpr (kEncodableKeys) {
+            if (!leaf.encodedKeys_.empty()) {
+                leaf.keys_ = KeyDictionary(leaf.encodedKeys_).decodeAll();
+                leaf.encodedKeys_.clear();
+                leaf.encodedKeys_.shrink_to_fit();
+            }
+        }
+    }
+
+    /**
+     * @brief 葉ノードのキー列を返す
+     * @details 辞書符号化された葉ノードは scratch へ復号して返す
+     * @param leaf 
+     * @param scratch 
+     * @return const std::vector<Key>& 
+     */
+    static const std::vector<Key>& leafKeys(const LeafNode& leaf, std::vector<Key>& scratch) {
+        if constexpr (kEncodableKeys) {
+            if (!leaf.encodedKeys_.empty()) {
+                scratch = KeyDictionary(leaf.encodedKeys_).decodeAll();
+                return scratch;
+            }
+        }
+        return leaf.keys_;
+    }
+
+    /**
+     * @brief 葉ノード内で key と等価なキーの位置を探す
+     * @details 辞書符号化された葉ノードでは、コード同士の比較で探す
+     * @param leaf 
+     * @param key 
+     * @return std::optional<size_t> 
+     */
+    template <typename K>
+    std::optional<size_t> findInLeaf(const LeafNode& leaf, const K& key) const {
+        if constexpr (kEncodableKeys) {
+            if (!leaf.encodedKeys_.empty()) {
+                KeyDictionary dict(leaf.encodedKeys_);
+                if constexpr (std::is_convertible_v<const K&, std::string_view>) {
+                    return dict.find(std::string_view(key));
+                } else {
+                    // 文字列として扱えないキーは、二分探索で比べるキーだけを使い回しの
+                    // 領域へ復元して比べる
+                    std::string& scratch = decodeScratch();
+                    size_t lo = 0;
+                    size_t hi = dict.size();
+                    while (lo < hi) {
+                        size_t mid = (lo + hi) / 2;
+                        dict.decodeInto(mid, scratch);
+                        if (comp_(scratch, key)) {
+                            lo = mid + 1;
+                        } else {
+                            hi = mid;
+                        }
+                    }
+                    if (lo < dict.size()) {
+                        dict.decodeInto(lo, scratch);
+                        if (equivalent(scratch, key)) {
+                            return lo;
+                        }
+                    }
+                    return std::nullopt;
+                }
+            }
+        }
+        return findInLeaf(leaf.keys_, key);
+    }
+
+    /**
+     * @brief key が葉ノードの最後のキーより後ろにあるか (空の葉なら true)
+     * @details 辞書符号化された葉ノードでは、最後のキーを復元せずに比べる
+     * @param leaf 
+     * @param key 
+     * @return bool 
+     */
+    template <typename K>
+    bool pastLeafEnd(const LeafNode& leaf, const K& key) const {
+        if constexpr (kEncodableKeys) {
+            if (!leaf.encodedKeys_.empty()) {
+                KeyDictionary dict(leaf.encodedKeys_);
+                if constexpr (std::is_convertible_v<const K&, std::string_view>) {
+                    return dict.compare(dict.size() - 1, std::string_view(key)) < 0;
+                } else {
+                    std::string& scratch = decodeScratch();
+                    dict.decodeInto(dict.size() - 1, scratch);
+                    return comp_(scratch, key);
+                }
+            }
+        }
+        return leaf.keys_.empty() || comp_(leaf.keys_.back(), key);
+    }
+
+    /**
+     * @brief 符号化されたキーを 1 つずつ復元するスレッドごとの領域
+     * @return std::string& 
+     */
+    static std::string& decodeScratch() {
+        static thread_local std::string scratch;
+        return scratch;
+    }
+
+    /**
+     * @brief 昇順に並んだ keys の中で key と等価なキーの位置を探す
+     * @param keys 
+     * @param key 
+     * @return std::optional<size_t> 
+     */
+    template <typename K>
+    std::optional<size_t> findInLeaf(const std::vector<Key>& keys, const K& key) const {
+        size_t i = lowerIndex(keys, key);
+        if (i < keys.size() && equivalent(keys[i], key)) {
+            return i;
+        }
+        return std::nullopt;
+    }
+
+    /**
+     * @brief 2 つのキーが等価かどうかを判定する
+     * @param a 
+     * @param b 
+     * @return bool 
+     */
+    template <typename K>
+    bool equivalent(const Key& a, const K& b) const {
+        return !comp_(a, b) && !comp_(b, a);
+    }
+
+    /**
+     * @brief visitor を呼び出し、続行するかどうかを返す
+     * @details 戻り値が void の visitor は常に続行とみなす
+     * @return bool 
+     */
+    template <typename Visitor, typename... Args>
+    static bool invokeVisitor(Visitor& visitor, Args&&... args) {
+        if constexpr (std::is_void_v<std::invoke_result_t<Visitor&, Args...>>) {
+            visitor(std::forward<Args>(args)...);
+            return true;
+        } else {
+            return static_cast<bool>(visitor(std::forward<Args>(args)...));
+        }
+    }
+
+    /**
+     * @brief 分割の単位とする部分木
+     * @details lo/hi は部分木が担当するキー範囲を、指定範囲で切り詰めたもの
+     */
+    struct Subtree {
+        std::shared_ptr<BPlusNode> node;
+        Range range;
+    };
+
+    /**
+     * @brief 2 つの範囲が重なるかを判定する
+     * @param a 
+     * @param b 
+     * @return bool
+     */
+    bool overlaps(const Range& a, const Range& b) const {
+        if (a.lo && b.hi && !comp_(*a.lo, *b.hi)) {
+            return false;
+        }
+        if (b.lo && a.hi && !comp_(*b.lo, *a.hi)) {
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief 葉ノードを分割し、親ノードに新たなキーを挿入する
+     * @param leaf 
+     */
+    void splitLeafNode(std::shared_ptr<LeafNode> leaf) {
+        auto newLeaf = makeLeaf();
+
+        int mid = (int)leaf->keys_.size() / 2;
+
+        newLeaf->keys_.insert(newLeaf->keys_.end(),
+                             leaf->keys_.begin() + mid, leaf->keys_.end());
+        newLeaf->values_.insert(newLeaf->values_.end(),
+                               leaf->values_.begin() + mid, leaf->values_.end());
+        
+        leaf->keys_.erase(leaf->keys_.begin() + mid, leaf->keys_.end());
+        leaf->values_.erase(leaf->values_.begin() + mid, leaf->values_.end());
+
+        // 書き込みの集中度はどちらの半分のものか分からないので折半する
+        newLeaf->writes_ = leaf->writes_ / 2;
+        leaf->writes_ -= newLeaf->writes_;
+        newLeaf->waitNanos_ = leaf->waitNanos_ / 2;
+        leaf->waitNanos_ -= newLeaf->waitNanos_;
+
+        newLeaf->next_ = leaf->next_;
+        leaf->next_ = newLeaf;
+
+        Key newKey = newLeaf->keys_.front();
+
+        if (leaf == root_) {
+            auto newRoot_ = makeInternal();
+            newRoot_->keys_.push_back(newKey);
+            newRoot_->childPointers_.push_back(leaf);
+            newRoot_->childPointers_.push_back(newLeaf);
+            root_ = newRoot_;
+        } else {
+            insertInternalNode(newKey, leaf, newLeaf);
+        }
+    }
+
+    /**
+     * @brief 内部ノードへの挿入処理
+     * @param key 
+     * @param leftChild 
+     * @param rightChild 
+     */
+    void insertInternalNode(const Key& key,
+                            std::shared_ptr<LeafNode> leftChild,
+                            std::shared_ptr<LeafNode> rightChild) {
+        auto parent = findParent(root_, leftChild);
+        if (!parent) {
+            return;
+        }
+        auto internalParent = std::static_pointer_cast<InternalNode>(parent);
+        int idx = 0;
+        while (idx < (int)internalParent->childPointers_.size() 
+               && internalParent->childPointers_[idx] != leftChild) {
+            idx++;
+        }
+        internalParent->keys_.insert(internalParent->keys_.begin() + idx, key);
+        internalParent->childPointers_.insert(internalParent->childPointers_.begin() + idx + 1, rightChild);
+
+        if ((int)internalParent->keys_.size() >= kOrder) {
+            splitInternalNode(internalParent);
+        }
+    }
+
+    /**
+     * @brief 内部ノードを分割し、親へ再帰的に昇格させる
+     * @param internalNode 
+     */
+    void splitInternalNode(std::shared_ptr<InternalNode> internalNode) {
+        auto newInternal = makeInternal();
+    
+        int midIndex = (int)internalNode->keys_.size() / 2;
+        Key upKey = internalNode->keys_[midIndex];
+
+        newInternal->keys_.insert(newInternal->keys_.end(),
+                                 internalNode->keys_.begin() + midIndex + 1, 
+                                 internalNode->keys_.end());
+        internalNode->keys_.erase(internalNode->keys_.begin() + midIndex, 
+                                 internalNode->keys_.end());
+
+        newInternal->childPointers_.insert(newInternal->childPointers_.end(),
+                                          internalNode->childPointers_.begin() + midIndex + 1,
+                                          internalNode->childPointers_.end());
+        internalNode->childPointers_.erase(internalNode->childPointers_.begin() + midIndex + 1,
+                                          internalNode->childPointers_.end());
+
+        if (internalNode == root_) {
+            auto newRoot_ = makeInternal();
+            newRoot_->keys_.push_back(upKey);
+            newRoot_->childPointers_.push_back(internalNode);
+            newRoot_->childPointers_.push_back(newInternal);
+            root_ = newRoot_;
+        } else {
+            insertInternalUpKey(upKey, internalNode, newInternal);
+        }
+    }
+
+    /**
+     * @brief 分割による昇格キーを親ノードに挿入
+     * @param key 
+     * @param leftChild 
+     * @param rightChild 
+     */
+    void insertInternalUpKey(const Key& key,
+                             std::shared_ptr<InternalNode> leftChild,
+                             std::shared_ptr<InternalNode> rightChild) {
+        auto parent = findParent(root_, leftChild);
+        if (!parent) return;
+
+        auto internalParent = std::static_pointer_cast<InternalNode>(parent);
+
+        int idx = 0;
+        while (idx < (int)internalParent->childPointers_.size()
+               && internalParent->childPointers_[idx] != leftChild) {
+            idx++;
+        }
+
+        internalParent->keys_.insert(internalParent->keys_.begin() + idx, key);
+        internalParent->childPointers_.insert(internalParent->childPointers_.begin() + idx + 1, rightChild);
+        if ((int)internalParent->keys_.size() >= kOrder) {
+            splitInternalNode(internalParent);
+        }
+    }
+
+    /**
+     * @brief 親ノードを探す関数
+     * @param current 
+     * @param child 
+     * @return std::shared_ptr<BPlusNode> 
+     */
+    std::shared_ptr<BPlusNode> findParent(std::shared_ptr<BPlusNode> current,
+                                                    std::shared_ptr<BPlusNode> child)
+    {
+        if (!current || current->isLeaf_) {
+            return nullptr;
+        }
+        auto internalNode = std::static_pointer_cast<InternalNode>(current);
+
+        for (auto ptr : internalNode->childPointers_) {
+            if (ptr == child) {
+                return current;
+            }
+            if (!ptr->isLeaf_) {
+                auto candidate = findParent(ptr, child);
+                if (candidate) {
+                    return candidate;
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    /**
+     * @brief キーの挿入の本体
+     * @param key 
+     * @param value 
+     * @return std::optional<Value> 上書きされた値
+     */
+    std::optional<Value> upsert(const Key& key, const Value& value) {
+        if (!root_) {
+            auto leaf = makeLeaf();
+            leaf->keys_.push_back(key);
+            leaf->values_.push_back(value);
+            root_ = leaf;
+            return std::nullopt;
+        }
+
+        // 既にあるキーの値の書き換えはキーの並びを変えないので、辞書符号化された葉も
+        // 復号しない。同じ値の書き込みは何も変えないので、経路にも葉にも印を付けない
+        LeafPath path;
+        auto leaf = findLeaf(key, path);
+        if (auto found = findInLeaf(*leaf, key)) {
+            if constexpr (IsEqualityComparable<Value>::value) {
+                if (leaf->values_[*found] == value) {
+                    return leaf->values_[*found];
+                }
+            }
+            markDirty(path);
+            touchLeaf(*leaf);
+            return std::exchange(leaf->values_[*found], value);
+        }
+
+        markDirty(path);
+        decodeLeaf(*leaf);
+        touchLeaf(*leaf);
+        size_t i = lowerIndex(leaf->keys_, key);
+        leaf->keys_.insert(leaf->keys_.begin() + i, key);
+        leaf->values_.insert(leaf->values_.begin() + i, value);
+
+        if ((int)leaf->keys_.size() >= kOrder) {
+            splitLeafNode(leaf);
+        }
+        return std::nullopt;
+    }
+
+    /**
+     * @brief ラッチを取らない exchange() の本体
+     * @details 排他ラッチを持って呼ぶか、木を 1 スレッドだけが触る場合に使う
+     * @param key 
+     * @param value 
+     * @return std::optional<Value> 上書きされた値
+     */
+    std::optional<Value> exchangeUnlocked(const Key& key, const Value& value) {
+        auto old = upsert(key, value);
+        if (watchers_) {
+            watchers_->publish(key, value);
+        }
+        return old;
+    }
+
+    /**
+     * @brief ラッチを取らない search() の本体
+     * @param key 
+     * @return std::optional<Value> 
+     */
+    template <typename K>
+    std::optional<Value> searchUnlocked(const K& key) {
+        if (!root_) {
+            return std::nullopt;
+        }
+        auto leaf = findLeaf(key);
+        if (!leaf) {
+            return std::nullopt;
+        }
+        if (auto i = findInLeaf(*leaf, key)) {
+            return leaf->values_[*i];
+        }
+        return std::nullopt;
+    }
+
+    /**
+     * @brief ラッチを取らない erase() の本体
+     * @param key 
+     * @return std::optional<Value> 削除したキーの値
+     */
+    template <typename K>
+    std::optional<Value> eraseUnlocked(const K& key) {
+        if (!root_) {
+            return std::nullopt;
+        }
+        // 無いキーの削除では、葉を復号せず経路にも印を付けない
+        LeafPath path;
+        auto leaf = findLeaf(key, path);
+        auto i = findInLeaf(*leaf, key);
+        if (!i) {
+            return std::nullopt;
+        }
+        markDirty(path);
+        decodeLeaf(*leaf);
+        touchLeaf(*leaf);
+        Key removedKey = std::move(leaf->keys_[*i]);
+        Value removed = std::move(leaf->values_[*i]);
+        leaf->keys_.erase(leaf->keys_.begin() + *i);
+        leaf->values_.erase(leaf->values_.begin() + *i);
+        if (watchers_) {
+            watchers_->publish(removedKey, std::nullopt);
+        }
+        return removed;
+    }
+
+    // シャードの木を持ち主のスレッドからラッチなしで操作する
+    template <typename, typename, typename>
+    friend class DelegatedTree;
+
+public:
+    explicit BPlusTree(const Compare& comp = Compare())
+        : root_(nullptr), comp_(comp) {}
+
+    /**
+     * @brief まとめて適用する挿入と削除 (write() に渡す)
+     * @details 同じキーへの操作は、後に追加したものが優先される
+     */
+    class WriteBatch {
+    public:
+        /**
+         * @brief 挿入 (キーが既にある場合は上書き)
+         * @param key 
+         * @param value 
+         */
+        void insert(const Key& key, const Value& value) {
+            ops_.push_back({key, value});
+        }
+
+        /**
+         * @brief 削除
+         * @param key 
+         */
+        void erase(const Key& key) {
+            ops_.push_back({key, std::nullopt});
+        }
+
+        void clear() {
+            ops_.clear();
+        }
+
+        size_t size() const {
+            return ops_.size();
+        }
+
+        bool empty() const {
+            return ops_.empty();
+        }
+
+    private:
+        friend class BPlusTree;
+
+        struct Op {
+            Key key;
+            // nullopt は削除
+            std::optional<Value> value;
+        };
+
+        std::vector<Op> ops_;
+    };
+
+private:
+    /**
+     * @brief バッチの操作をキー順に並べ、同じキーへの操作は最後のものだけ残す
+     * @param batch 
+     * @return std::vector<const typename WriteBatch::Op*> 
+     */
+    std::vector<const typename WriteBatch::Op*> sortBatch(const WriteBatch& batch) const {
+        std::vector<const typename WriteBatch::Op*> ops;
+        ops.reserve(batch.ops_.size());
+        for (const auto& op : batch.ops_) {
+            ops.push_back(&op);
+        }
+        sortOps(ops);
+        return ops;
+    }
+
+    /**
+     * @brief 操作をキー順に並べ、同じキーへの操作は最後のものだけ残す
+     * @param ops 
+     */
+    void sortOps(std::vector<const typename WriteBatch::Op*>& ops) const {
+        using Op = typename WriteBatch::Op;
+        std::stable_sort(ops.begin(), ops.end(), [this](const Op* a, const Op* b) {
+            return comp_(a->key, b->key);
+        });
+        size_t kept = 0;
+        for (size_t i = 0; i < ops.size(); i++) {
+            if (i + 1 < ops.size() && !comp_(ops[i]->key, ops[i + 1]->key)) {
+                continue;
+            }
+            ops[kept++] = ops[i];
+        }
+        ops.resize(kept);
+    }
+
+    /**
+     * @brief キー順に並んだ操作を左から順に適用する
+     * @details 続くキーが直前の葉ノードの範囲に入る間は、根から降り直さずに同じ葉ノードへ
+     *          適用する。排他ラッチを持って呼ぶこと
+     * @param ops sortBatch() の結果
+     * @return size_t 木を書き換えた操作の数
+     */
+    size_t applyBatch(const std::vector<const typename WriteBatch::Op*>& ops) {
+        std::shared_ptr<LeafNode> leaf;
+        // 分割で内部ノードが書き換わると無効になるので、分割したら leaf ごと捨てる
+        const Key* hi = nullptr;
+        size_t applied = 0;
+        for (const auto* op : ops) {
+            if (!root_) {
+                if (!op->value) {
+                    continue;
+                }
+                upsert(op->key, *op->value);
+            } else {
+                if (!leaf || (hi && !comp_(op->key, *hi))) {
+                    leaf = findLeafForWrite(op->key, hi);
+                    decodeLeaf(*leaf);
+                }
+                size_t i = lowerIndex(leaf->keys_, op->key);
+                bool found = i < leaf->keys_.size() && equivalent(leaf->keys_[i], op->key);
+                if (!op->value && !found) {
+                    continue;
+                }
+                touchLeaf(*leaf);
+                if (!op->value) {
+                    leaf->keys_.erase(leaf->keys_.begin() + i);
+                    leaf->values_.erase(leaf->values_.begin() + i);
+                } else if (found) {
+                    leaf->values_[i] = *op->value;
+                } else {
+                    leaf->keys_.insert(leaf->keys_.begin() + i, op->key);
+                    leaf->values_.insert(leaf->values_.begin() + i, *op->value);
+                    if ((int)leaf->keys_.size() >= kOrder) {
+                        splitLeafNode(leaf);
+                        leaf.reset();
+                    }
+                }
+            }
+            applied++;
+            if (watchers_) {
+                watchers_->publish(op->key, op->value);
+            }
+        }
+        return applied;
+    }
+
+    // 組み合わせ (flat combining) の公開枠の数
+    static constexpr size_t kCombiningSlots = 64;
+    // 公開枠の状態
+    enum : uint32_t { kSlotFree, kSlotClaimed, kSlotPending, kSlotDone };
+
+    /**
+     * @brief 組み合わせの公開枠。書き込むスレッドが操作を置き、組み合わせ役が適用する
+     */
+    struct alignas(64) CombiningSlot {
+        std::atomic<uint32_t> state{kSlotFree};
+        std::optional<typename WriteBatch::Op> op;
+        // 公開した順番
+        uint64_t ticket = 0;
+    };
+
+    /**
+     * @brief 公開枠に置いて組み合わせ役に適用させる
+     * @details 公開枠を取って操作を置き、組み合わせ役のロックを取れたら自分が
+     *          組み合わせ役になる。取れなければ公開枠が適用済みになるのを futex で待つ。
+     *          組み合わせ役が公開枠を見た後に置いた操作は拾われないので、待つ時間に
+     *          上限を設けて組み合わせ役になることを試み直す
+     * @param op 
+     */
+    void combine(typename WriteBatch::Op op) {
+        std::call_once(combiningSlotsOnce_, [this] {
+            combiningSlots_ = std::make_unique<CombiningSlot[]>(kCombiningSlots);
+        });
+        size_t start = std::hash<std::thread::id>()(std::this_thread::get_id()) % kCombiningSlots;
+        CombiningSlot* slot = nullptr;
+        for (size_t probe = 0; !slot; probe++) {
+            auto& candidate = combiningSlots_[(start + probe) % kCombiningSlots];
+            uint32_t expected = kSlotFree;
+            if (candidate.state.compare_exchange_strong(expected, kSlotClaimed, std::memory_order_acquire)) {
+                slot = &candidate;
+            } else if (probe % kCombiningSlots == kCombiningSlots - 1) {
+                // 公開枠が埋まっている
+                std::this_thread::yield();
+            }
+        }
+        slot->op = std::move(op);
+        slot->ticket = combiningTickets_.fetch_add(1, std::memory_order_relaxed);
+        slot->state.store(kSlotPending, std::memory_order_release);
+        while (slot->state.load(std::memory_order_acquire) != kSlotDone) {
+            std::unique_lock<std::mutex> combiner(combinerMutex_, std::try_to_lock);
+            if (combiner.owns_lock()) {
+                combinePending();
+                continue;
+            }
+            Futex::wait(slot->state, kSlotPending, 50000);
+        }
+        slot->op.reset();
+        slot->state.store(kSlotFree, std::memory_order_release);
+    }
+
+    /**
+     * @brief 公開枠に置かれた操作をキー順に並べ、1 回の排他区間でまとめて適用する
+     * @details 操作を公開した順に並べてから安定にキー順へ並べるので、同じキーへの
+     *          操作は最後に公開したものが残る。combinerMutex_ を持って呼ぶこと
+     */
+    void combinePending() {
+        std::vector<CombiningSlot*> taken;
+        for (size_t i = 0; i < kCombiningSlots; i++) {
+            if (combiningSlots_[i].state.load(std::memory_order_acquire) == kSlotPending) {
+                taken.push_back(&combiningSlots_[i]);
+            }
+        }
+        if (taken.empty()) {
+            return;
+        }
+        std::sort(taken.begin(), taken.end(), [](const CombiningSlot* a, const CombiningSlot* b) {
+            return a->ticket < b->ticket;
+        });
+        std::vector<const typename WriteBatch::Op*> ops;
+        for (auto* slot : taken) {
+            ops.push_back(&*slot->op);
+        }
+        sortOps(ops);
+        {
+            WriteLock lock(*this);
+            applyBatch(ops);
+        }
+        combiningPasses_.fetch_add(1, std::memory_order_relaxed);
+        combinedOps_.fetch_add(taken.size(), std::memory_order_relaxed);
+        for (auto* slot : taken) {
+            slot->state.store(kSlotDone, std::memory_order_release);
+            Futex::wake(slot->state);
+        }
+    }
+
+public:
+
+    /**
+     * @brief 範囲内の要素を昇順に visitor へ渡す (内部イテレーション)
+     * @details visitor は次のどちらかの形で呼び出せること。
+     *          - visitor(const Key* keys, const Value* values, size_t count)
+     *            葉ノード 1 つ分の連続領域をまとめて受け取る
+     *          - visitor(const Key& key, const Value& value)
+     *            1 要素ずつ受け取る
+     *          戻り値が bool の場合、false を返すとそこで走査を打ち切る。
+     *          visitor はテンプレート引数なので、葉ごとのループへインライン展開される。
+     *          走査中は共有ラッチを持つため、visitor から木を更新しないこと
+     * @param range 
+     * @param visitor 
+     * @return bool 最後まで走査した場合 true、打ち切った場合 false
+     */
+    template <typename K = Key, typename Visitor>
+    bool forEachInRange(const KeyRange<K>& range, Visitor&& visitor) {
+        std::shared_lock<std::shared_mutex> lock(latch_);
+        auto leaf = findStartLeaf(range);
+        std::vector<Key> scratch;
+        for (bool first = true; leaf; leaf = leaf->next_, first = false) {
+            const auto& keys = leafKeys(*leaf, scratch);
+            size_t begin = 0;
+            if (first && range.lo) {
+                begin = lowerIndex(keys, *range.lo);
+            }
+            size_t end = keys.size();
+            bool last = false;
+            if (range.hi && end > 0 && !comp_(keys.back(), *range.hi)) {
+                end = std::max(begin, lowerIndex(keys, *range.hi));
+                last = true;
+            }
+            if constexpr (std::is_invocable_v<Visitor&, const Key*, const Value*, size_t>) {
+                if (begin < end && !invokeVisitor(visitor, keys.data() + begin,
+                                                  leaf->values_.data() + begin, end - begin)) {
+                    return false;
+                }
+            } else {
+                for (size_t i = begin; i < end; i++) {
+                    if (!invokeVisitor(visitor, keys[i], leaf->values_[i])) {
+                        return false;
+                    }
+                }
+            }
+            if (last) {
+                break;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @brief [lo, hi) 内の要素を昇順に visitor へ渡す
+     * @param lo 
+     * @param hi 
+     * @param visitor 
+     * @return bool 最後まで走査した場合 true、打ち切った場合 false
+     */
+    template <typename K, typename Visitor>
+    bool forEachInRange(const K& lo, const K& hi, Visitor&& visitor) {
+        return forEachInRange(KeyRange<std::decay_t<const K&>>{lo, hi}, std::forward<Visitor>(visitor));
+    }
+
+    /**
+     * @brief キー範囲をおおよそ同じ大きさの部分範囲に分割する
+     * @details 内部ノードの構造を根から 1 段ずつ展開し、範囲に掛かる部分木が
+     *          parts の数倍になった段 (または葉の段) で境界を決める。
+     *          部分木の要素数は保持していないため、内部ノードの段では
+     *          部分木を同じ重みとみなし、葉の段ではキー数で重み付けする。
+     * @param range 分割する範囲
+     * @param parts 分割数
+     * @return std::vector<Range> 昇順に並んだ重ならない部分範囲 (parts 個以下)
+     */
+    std::vector<Range> partition(const Range& range, int parts) {
+        std::shared_lock<std::shared_mutex> lock(latch_);
+        if (!root_ || parts <= 1) {
+            return {range};
+        }
+        std::vector<Subtree> frontier{{root_, range}};
+        while (!frontier.front().node->isLeaf_ && (int)frontier.size() < parts * 4) {
+            std::vector<Subtree> next;
+            for (auto& subtree : frontier) {
+                auto internalNode = std::static_pointer_cast<InternalNode>(subtree.node);
+                for (size_t i = 0; i < internalNode->childPointers_.size(); i++) {
+                    Range childRange = subtree.range;
+                    if (i > 0 && (!childRange.lo || comp_(*childRange.lo, internalNode->keys_[i - 1]))) {
+                        childRange.lo = internalNode->keys_[i - 1];
+                    }
+                    if (i < internalNode->keys_.size()
+                        && (!childRange.hi || comp_(internalNode->keys_[i], *childRange.hi))) {
+                        childRange.hi = internalNode->keys_[i];
+                    }
+                    if (overlaps(childRange, range)) {
+                        next.push_back({internalNode->childPointers_[i], childRange});
+                    }
+                }
+            }
+            if (next.empty()) {
+                break;
+            }
+            frontier = std::move(next);
+        }
+
+        std::vector<size_t> weights;
+        size_t total = 0;
+        for (auto& subtree : frontier) {
+            size_t weight = 1;
+            if (subtree.node->isLeaf_) {
+                weight = std::max<size_t>(1, std::static_pointer_cast<LeafNode>(subtree.node)->values_.size());
+            }
+            weights.push_back(weight);
+            total += weight;
+        }
+
+        std::vector<Range> result;
+        Range current{range.lo, std::nullopt};
+        size_t accumulated = 0;
+        int made = 0;
+        for (size_t j = 0; j < frontier.size(); j++) {
+            // j 番目の部分木の手前で切るかどうか
+            if (j > 0 && made < parts - 1 && accumulated * parts >= total * (made + 1)) {
+                current.hi = frontier[j].range.lo;
+                result.push_back(current);
+                current.lo = frontier[j].range.lo;
+                made++;
+            }
+            accumulated += weights[j];
+        }
+        current.hi = range.hi;
+        result.push_back(current);
+        return result;
+    }
+
+    /**
+     * @brief 範囲内の各要素に fn(key, value) を並列に適用する
+     * @details partition() で分割した部分範囲ごとにタスクを executor へ投入する。
+     *          fn は複数スレッドから同時に呼ばれる
+     * @param range 
+     * @param fn 
+     * @param parts 並列度
+     */
+    template <typename Fn>
+    void parallelForEach(const Range& range, Fn fn,
+                         int parts = (int)std::thread::hardware_concurrency()) {
+        auto ranges = partition(range, parts);
+        if (ranges.size() == 1) {
+            forEachInRange(ranges.front(), fn);
+            return;
+        }
+        WorkStealingPool& pool = executor();
+        std::vector<std::future<void>> tasks;
+        for (size_t i = 1; i < ranges.size(); i++) {
+            tasks.push_back(pool.submit([this, &fn, r = ranges[i]] {
+                forEachInRange(r, fn);
+            }));
+        }
+        forEachInRange(ranges.front(), fn);
+        for (auto& task : tasks) {
+            pool.wait(task);
+        }
+    }
+
+    /**
+     * @brief 範囲内の各要素を transform で変換し、reduce で畳み込む (並列)
+     * @details reduce は結合的である必要がある。部分範囲ごとの結果を
+     *          範囲順に init へ畳み込むため、init は 1 度だけ使われる
+     * @param range 
+     * @param init 
+     * @param reduce (T, T) -> T
+     * @param transform (key, value) -> T
+     * @param parts 並列度
+     * @return T
+     */
+    template <typename T, typename Reduce, typename Transform>
+    T parallelTransformReduce(const Range& range, T init, Reduce reduce, Transform transform,
+                              int parts = (int)std::thread::hardware_concurrency()) {
+        auto ranges = partition(range, parts);
+        auto reduceRange = [this, &reduce, &transform](const Range& r) {
+            std::optional<T> acc;
+            forEachInRange(r, [&](const Key& key, const Value& value) {
+                if (acc) {
+                    acc = reduce(std::move(*acc), transform(key, value));
+                } else {
+                    acc = transform(key, value);
+                }
+            });
+            return acc;
+        };
+        WorkStealingPool* pool = ranges.size() > 1 ? &executor() : nullptr;
+        std::vector<std::future<std::optional<T>>> tasks;
+        for (size_t i = 1; i < ranges.size(); i++) {
+            tasks.push_back(pool->submit([&reduceRange, r = ranges[i]] { return reduceRange(r); }));
+        }
+        T result = std::move(init);
+        if (auto acc = reduceRange(ranges.front())) {
+            result = reduce(std::move(result), std::move(*acc));
+        }
+        for (auto& task : tasks) {
+            if (auto acc = pool->wait(task)) {
+                result = reduce(std::move(result), std::move(*acc));
+            }
+        }
+        return result;
+    }
+
+    /**
+     * @brief 範囲内で pred(key, value) を満たす要素数を並列に数える
+     * @param range 
+     * @param pred 
+     * @param parts 並列度
+     * @return size_t
+     */
+    template <typename Pred>
+    size_t parallelCountIf(const Range& range, Pred pred,
+                           int parts = (int)std::thread::hardware_concurrency()) {
+        return parallelTransformReduce(range, size_t{0}, std::plus<size_t>(),
+            [&pred](const Key& key, const Value& value) -> size_t { return pred(key, value) ? 1 : 0; }, parts);
+    }
+
+    /**
+     * @brief キーの検索
+     * @param key Key または Key と比較可能な型のキー
+     * @return std::optional<Value> 
+     * @retval キーに対応する値
+     * @retval キーが見つからない場合は std::nullopt
+     */
+    template <typename K>
+    std::optional<Value> search(const K& key) {
+        std::shared_lock<std::shared_mutex> lock(latch_);
+        return searchUnlocked(key);
+    }
+
+    /**
+     * @brief key 以上となる最小のキーとその値を返す
+     * @param key Key または Key と比較可能な型のキー
+     * @return std::optional<std::pair<Key, Value>> 
+     * @retval 見つかったキーと値
+     * @retval key 以上のキーがない場合は std::nullopt
+     */
+    template <typename K>
+    std::optional<std::pair<Key, Value>> lowerBound(const K& key) {
+        std::optional<std::pair<Key, Value>> result;
+        forEachInRange(KeyRange<std::decay_t<const K&>>{key, std::nullopt}, [&result](const Key& k, const Value& v) {
+            result.emplace(k, v);
+            return false;
+        });
+        return result;
+    }
+
+    /**
+     * @brief 複数キーの一括検索
+     * @details 結果は呼び出し側のバッファへ直接書き込み、ヒープ確保を行わない。
+     *          キーが昇順に並んでいる区間では、直前に降りた葉ノードに収まるキーの
+     *          検索で根からの探索を省略する
+     * @param keys 検索するキーの配列
+     * @param count キーの数
+     * @param values 見つかった値の書き込み先 (count 要素以上)。見つからなかった位置は変更しない
+     * @param found 各キーが見つかったかどうか (count 要素以上に確保済みであること)
+     * @return size_t 見つかったキーの数
+     */
+    template <typename K>
+    size_t getMany(const K* keys, size_t count, Value* values, std::vector<bool>& found) {
+        std::shared_lock<std::shared_mutex> lock(latch_);
+        size_t hits = 0;
+        std::shared_ptr<LeafNode> leaf;
+        const K* descentKey = nullptr;
+        for (size_t i = 0; i < count; i++) {
+            const K& key = keys[i];
+            found[i] = false;
+            if (!root_) {
+                continue;
+            }
+            if (!leaf || comp_(key, *descentKey) || pastLeafEnd(*leaf, key)) {
+                leaf = findLeaf(key);
+                descentKey = &key;
+            }
+            if (auto j = findInLeaf(*leaf, key)) {
+                values[i] = leaf->values_[*j];
+                found[i] = true;
+                hits++;
+            }
+        }
+        return hits;
+    }
+
+    /**
+     * @brief 範囲内の要素を呼び出し側のバッファへ昇順に書き出す
+     * @details バッファが一杯になった時点で止め、続きの先頭キーを返す。
+     *          返された resumeKey を下限にして再度呼び出せば続きを読める
+     * @param range 
+     * @param keys キーの書き込み先 (capacity 要素以上)
+     * @param values 値の書き込み先 (capacity 要素以上)
+     * @param capacity バッファの要素数
+     * @return ScanResult<Key> 
+     */
+    template <typename K = Key>
+    ScanResult<Key> scanInto(const KeyRange<K>& range, Key* keys, Value* values, size_t capacity) {
+        ScanResult<Key> result{0, std::nullopt};
+        forEachInRange(range, [&](const Key* leafKeys, const Value* leafValues, size_t n) {
+            size_t room = capacity - result.count;
+            size_t copied = std::min(n, room);
+            std::copy(leafKeys, leafKeys + copied, keys + result.count);
+            std::copy(leafValues, leafValues + copied, values + result.count);
+            result.count += copied;
+            if (copied < n) {
+                result.resumeKey = leafKeys[copied];
+                return false;
+            }
+            return true;
+        });
+        return result;
+    }
+
+    /**
+     * @brief [lo, hi) 内の要素を呼び出し側のバッファへ昇順に書き出す
+     * @param lo 
+     * @param hi 
+     * @param keys 
+     * @param values 
+     * @param capacity 
+     * @return ScanResult<Key> 
+     */
+    template <typename K>
+    ScanResult<Key> scanInto(const K& lo, const K& hi, Key* keys, Value* values, size_t capacity) {
+        return scanInto(KeyRange<std::decay_t<const K&>>{lo, hi}, keys, values, capacity);
+    }
+
+    /**
+     * @brief 葉ノードのキーを辞書符号化する
+     * @details 各葉ノードで、キーを separator で区切った成分の辞書を作り、キーを
+     *          コード列に置き換える。コードは成分の昇順に振るため、search は
+     *          探すキーを一度コード列にした後はコード同士の比較だけで済む。
+     *          separator 以下の文字を成分に含むキーがある葉は符号化しない。
+     *          符号化した葉は、書き換えられた時点で通常の表現に戻る
+     * @param separator 成分の区切り文字
+     * @return size_t 符号化されている葉ノードの数
+     */
+    size_t encodeKeys(char separator = '/') {
+        static_assert(kEncodableKeys, "辞書符号化は std::string のキーを昇順に並べる木でのみ使える");
+        std::unique_lock<std::shared_mutex> lock(latch_);
+        size_t encoded = 0;
+        for (auto leaf = findStartLeaf(Range{}); leaf; leaf = leaf->next_) {
+            if (leaf->encodedKeys_.empty() && !leaf->keys_.empty()) {
+                leaf->encodedKeys_ = KeyDictionary::build(leaf->keys_, separator);
+                if (!leaf->encodedKeys_.empty()) {
+                    leaf->keys_.clear();
+                    leaf->keys_.shrink_to_fit();
+                }
+            }
+            if (!leaf->encodedKeys_.empty()) {
+                encoded++;
+            }
+        }
+        return encoded;
+    }
+
+    /**
+     * @brief 葉ノードのキーが使用しているメモリ量を集計する
+     * @return KeyMemoryUsage 
+     */
+    KeyMemoryUsage keyMemoryUsage() {
+        std::shared_lock<std::shared_mutex> lock(latch_);
+        KeyMemoryUsage usage{0, 0, 0};
+        for (auto leaf = findStartLeaf(Range{}); leaf; leaf = leaf->next_) {
+            usage.leaves++;
+            usage.bytes += leaf->keys_.capacity() * sizeof(Key);
+            if constexpr (std::is_same_v<Key, std::string>) {
+                auto heapBytes = [](const std::string& text) -> size_t {
+                    return text.capacity() > std::string().capacity() ? text.capacity() + 1 : 0;
+                };
+                for (auto& key : leaf->keys_) {
+                    usage.bytes += heapBytes(key);
+                }
+                if (!leaf->encodedKeys_.empty()) {
+                    usage.encodedLeaves++;
+                    usage.bytes += heapBytes(leaf->encodedKeys_);
+                }
+            }
+        }
+        return usage;
+    }
+
+    /**
+     * @brief 葉ノードごとの書き込みの集中度をキー順に返す
+     * @details 葉を書き換えた回数と、その書き換えのために更新が排他区間 (待ち行列が
+     *          あればそれも含む) を待った時間を、木を作ってからの累計で返す。待ち時間は
+     *          1 回の排他区間で最初に書き換えた葉に数える。葉を分割すると両方の半分で
+     *          折半する。木全体で 1 本のラッチなので、待ち時間はその葉への書き込みが
+     *          他の更新や読み取りの後ろで待った時間であり、葉を分けても減らない
+     * @return std::vector<LeafHeat<Key>> 
+     */
+    std::vector<LeafHeat<Key>> leafHeat() {
+        std::shared_lock<std::shared_mutex> lock(latch_);
+        std::vector<LeafHeat<Key>> heat;
+        std::vector<Key> scratch;
+        for (auto leaf = findStartLeaf(Range{}); leaf; leaf = leaf->next_) {
+            const auto& keys = leafKeys(*leaf, scratch);
+            heat.push_back({keys.empty() ? std::nullopt : std::optional<Key>(keys.front()), keys.size(),
+                            leaf->writes_, leaf->waitNanos_});
+        }
+        return heat;
+    }
+
+    /**
+     * @brief オンラインバックアップ
+     * @details 葉ノードを連結リストに沿ってキー順に読み、path へ書き出す。
+     *          開始時点の内容を書き出す (ポイントインタイム) 一方で、書き込みは
+     *          止めない。同時に実行できるバックアップ (差分を含む) は 1 つ
+     * @param path 
+     * @return std::optional<uint64_t> このバックアップのスナップショット。失敗した場合 nullopt
+     */
+    std::optional<uint64_t> backup(const std::string& path) {
+        return writeBackup(path, 0);
+    }
+
+    /**
+     * @brief オンラインバックアップを別スレッドで実行する
+     * @param path 
+     * @return std::future<std::optional<uint64_t>> backup() の結果
+     */
+    std::future<std::optional<uint64_t>> backupAsync(const std::string& path) {
+        return std::async(std::launch::async, [this, path] { return backup(path); });
+    }
+
+    /**
+     * @brief fork した子プロセスで木全体を書き出す (バックグラウンド保存)
+     * @details 排他ラッチを持ったまま fork するので、子プロセスには更新途中でない木が
+     *          そのまま写る。子は葉の連結リストを辿って backup() と同じ形式で path へ
+     *          書き出し、終了する。親は fork の直後にラッチを放して読み書きを続け、
+     *          以降に書き換えたメモリのページだけがカーネルのコピーオンライトで複製される。
+     *          親が止まるのはページテーブルを複製する fork の間だけで、backup() のような
+     *          書き換え前の内容の退避もないが、書き込みが多いと最大で木と同じ量の
+     *          メモリを余分に使う。スナップショットは incrementalBackup() の起点に使える。
+     *          このプロセスには他のスレッド (監視の通知、並列操作のプール、ページの
+     *          読み込みなど) がいることが多く、fork の瞬間に彼らが持っていたロックは
+     *          子プロセスでは解放されない。そのため子は書き出し用のバッファを fork の前に
+     *          受け取り、メモリ確保やストリームを使わずに書き出して _exit する
+     * @param path 
+     * @return std::future<std::optional<uint64_t>> 子プロセスの終了を待ってスナップショットを返す。
+     *         fork か書き出しに失敗した場合 nullopt
+     */
+    std::future<std::optional<uint64_t>> bgsave(const std::string& path) {
+        std::unique_ptr<char[]> buffer(new char[kForkWriteBufferSize]);
+        uint64_t snapshot;
+        pid_t pid;
+        {
+            std::unique_lock<std::shared_mutex> lock(latch_);
+            snapshot = ++epoch_;
+            pid = ::fork();
+            if (pid == 0) {
+                ::_exit(writeForkedSnapshot(path.c_str(), snapshot, buffer.get(), kForkWriteBufferSize) ? 0 : 1);
+            }
+        }
+        if (pid < 0) {
+            std::promise<std::optional<uint64_t>> failed;
+            failed.set_value(std::nullopt);
+            return failed.get_future();
+        }
+        return std::async(std::launch::async, [pid, snapshot]() -> std::optional<uint64_t> {
+            int status;
+            while (::waitpid(pid, &status, 0) < 0) {
+                if (errno != EINTR) {
+                    return std::nullopt;
+                }
+            }
+            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                return std::nullopt;
+            }
+            return snapshot;
+        });
+    }
+
+    /**
+     * @brief 差分バックアップ
+     * @details スナップショット since 以降に書き換えられた葉ノードだけを、親の
+     *          区切りキーから決まる範囲とともに書き出す。書き換えはノードごとの
+     *          dirtyVersion_ で追跡しているため、書き換えのない部分木は読まない。
+     *          backup() と同じく書き込みは止めない
+     * @param since 起点となるバックアップ (全体または差分) のスナップショット
+     * @param path 
+     * @return std::optional<uint64_t> このバックアップのスナップショット。失敗した場合 nullopt
+     */
+    std::optional<uint64_t> incrementalBackup(uint64_t since, const std::string& path) {
+        if (since == 0) {
+            return std::nullopt;
+        }
+        return writeBackup(path, since);
+    }
+
+    /**
+     * @brief バックアップファイルの内容を木へ挿入する
+     * @details 既にあるキーは上書きする
+     * @param path 全体バックアップのファイル
+     * @return bool 成功した場合 true
+     */
+    bool restore(const std::string& path) {
+        return restore(path, {});
+    }
+
+    /**
+     * @brief 全体バックアップに差分バックアップを順に適用して復元する
+     * @details 各差分の起点は、直前に適用したバックアップのスナップショット以前で
+     *          なければならない。満たさない場合は何もせずに false を返す。
+     *          差分が含む範囲は、差分の内容で丸ごと置き換える
+     * @param base 全体バックアップのファイル
+     * @param incrementals 差分バックアップのファイル (古い順)
+     * @return bool 成功した場合 true
+     */
+    bool restore(const std::string& base, const std::vector<std::string>& incrementals) {
+        std::vector<std::ifstream> files;
+        uint64_t snapshot = 0;
+        for (size_t i = 0; i <= incrementals.size(); i++) {
+            files.emplace_back(i == 0 ? base : incrementals[i - 1], std::ios::binary);
+            auto header = readBackupHeader(files.back());
+            if (!header || (i == 0) != (header->since == 0) || header->since > snapshot) {
+                return false;
+            }
+            snapshot = header->snapshot;
+        }
+        for (auto& file : files) {
+            if (!applyBackup(file)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    using Change = typename RangeWatchers<Key, Value, Compare>::Change;
+    using WatchCallback = typename RangeWatchers<Key, Value, Compare>::Callback;
+
+    /**
+     * @brief キー範囲の変更の監視を登録する
+     * @details 範囲内のキーが挿入・上書き・削除されると、変更が監視ごとに溜められ、
+     *          通知スレッドから callback(changes) としてまとめて渡される。
+     *          callback は木を更新したスレッドとは別のスレッドで呼ばれる
+     * @param range 
+     * @param callback 
+     * @return uint64_t 監視 ID
+     */
+    uint64_t watch(const Range& range, WatchCallback callback) {
+        std::unique_lock<std::shared_mutex> lock(latch_);
+        if (!watchers_) {
+            watchers_ = std::make_unique<RangeWatchers<Key, Value, Compare>>(comp_);
+        }
+        return watchers_->add(range, std::move(callback));
+    }
+
+    /**
+     * @brief キー範囲 [lo, hi) の変更の監視を登録する
+     * @param lo 
+     * @param hi 
+     * @param callback 
+     * @return uint64_t 監視 ID
+     */
+    uint64_t watch(const Key& lo, const Key& hi, WatchCallback callback) {
+        return watch(Range{lo, hi}, std::move(callback));
+    }
+
+    /**
+     * @brief 監視の解除
+     * @details 戻った後に callback が呼ばれることはない。callback の中からは呼ばないこと
+     * @param id 
+     * @return bool 解除した場合 true
+     */
+    bool unwatch(uint64_t id) {
+        RangeWatchers<Key, Value, Compare>* watchers;
+        {
+            std::shared_lock<std::shared_mutex> lock(latch_);
+            watchers = watchers_.get();
+        }
+        // remove() は配送中の callback を待つ。callback が木へ書き込む場合に
+        // 備えて、ラッチを放してから待つ
+        return watchers && watchers->remove(id);
+    }
+
+    /**
+     * @brief ここまでの変更の通知が全て配送されるまで待つ
+     */
+    void flushWatches() {
+        RangeWatchers<Key, Value, Compare>* watchers;
+        {
+            std::shared_lock<std::shared_mutex> lock(latch_);
+            watchers = watchers_.get();
+        }
+        if (watchers) {
+            watchers->flush();
+        }
+    }
+
+    /**
+     * @brief キーの挿入
+     * @param key 
+     * @param value 
+     */
+    
+    void insert(const Key& key, const Value& value) {
+        exchange(key, value);
+    }
+
+    /**
+     * @brief キーの挿入 (以前の値を返す)
+     * @details キーが既にある場合は値を上書きする
+     * @param key 
+     * @param value 
+     * @return std::optional<Value> 
+     * @retval 上書きされた値
+     * @retval 新しいキーだった場合は std::nullopt
+     */
+    std::optional<Value> exchange(const Key& key, const Value& value) {
+        WriteLock lock(*this);
+        return exchangeUnlocked(key, value);
+    }
+
+    /**
+     * @brief バッチを不可分に適用する
+     * @details 操作をキー順に並べ (同じキーへの操作は最後のものだけ残す)、1 回の
+     *          排他区間の中で左から順に適用する。続くキーが直前の葉ノードの範囲に
+     *          入る間は、根から降り直さずに同じ葉ノードへ適用する。読み取り側からは
+     *          バッチの前か後の状態だけが見える。並べ替えは排他区間の外で行う
+     * @param batch 
+     * @return size_t 木を書き換えた操作の数 (無いキーの削除と重複は数えない)
+     */
+    size_t write(const WriteBatch& batch) {
+        auto ops = sortBatch(batch);
+        WriteLock lock(*this);
+        return applyBatch(ops);
+    }
+
+    /**
+     * @brief 組み合わせ (flat combining) による挿入
+     * @details 操作を公開枠に置き、その時点で組み合わせ役になったスレッドが、公開枠に
+     *          溜まった他のスレッドの操作とともにキー順に並べて 1 回の排他区間で適用する
+     *          (write() と同じく降下を共有する)。同じ葉に書き込みが集中する場合に、
+     *          操作ごとにラッチを取り合うより速い。操作が適用されてから戻る。
+     *          1 回の適用に同じキーへの操作が複数あれば、公開した順で最後のものだけを
+     *          適用する。途中の値は木に現れず、範囲の監視にも最後の変更だけが届く
+     * @param key 
+     * @param value 
+     */
+    void insertCombining(const Key& key, const Value& value) {
+        combine({key, value});
+    }
+
+    /**
+     * @brief 組み合わせ (flat combining) による削除
+     * @param key 
+     */
+    void eraseCombining(const Key& key) {
+        combine({key, std::nullopt});
+    }
+
+    /**
+     * @brief 組み合わせの統計
+     * @return std::pair<uint64_t, uint64_t> (組み合わせ役が適用した回数, 適用した操作の数)
+     */
+    std::pair<uint64_t, uint64_t> combiningStats() const {
+        return {combiningPasses_.load(std::memory_order_relaxed), combinedOps_.load(std::memory_order_relaxed)};
+    }
+
+    /**
+     * @brief 楽観的トランザクション
+     * @details 書き込みは commit() までトランザクションの中に溜め、読み取りは
+     *          読んだ葉ノードとその版を記録する。commit() は排他ラッチの中で、記録した
+     *          葉の版が変わっていないことを確かめてから溜めた書き込みを write() と
+     *          同じ方法で適用する。読み取りの間は短く共有ラッチを取るだけで、他の
+     *          トランザクションや書き込みを止めない。1 つのトランザクションは
+     *          1 つのスレッドから使うこと
+     */
+    class Transaction {
+    public:
+        explicit Transaction(BPlusTree& tree) : tree_(tree), writes_(tree.comp_) {}
+
+        /**
+         * @brief 読み取り
+         * @details このトランザクションで書いたキーは、その値 (削除なら nullopt) を返す
+         * @param key 
+         * @return std::optional<Value> 
+         */
+        std::optional<Value> get(const Key& key) {
+            auto write = writes_.find(key);
+            if (write != writes_.end()) {
+                return write->second;
+            }
+            std::shared_lock<std::shared_mutex> lock(tree_.latch_);
+            if (!tree_.root_) {
+                // 空の木を読んだことを記録する (根ができたら衝突)
+                reads_.emplace_back(nullptr, 0);
+                return std::nullopt;
+            }
+            auto leaf = tree_.findLeaf(key);
+            reads_.emplace_back(leaf, leaf->version_);
+            if (auto i = tree_.findInLeaf(*leaf, key)) {
+                return leaf->values_[*i];
+            }
+            return std::nullopt;
+        }
+
+        void insert(const Key& key, const Value& value) {
+            writes_.insert_or_assign(key, value);
+        }
+
+        void erase(const Key& key) {
+            writes_.insert_or_assign(key, std::nullopt);
+        }
+
+        /**
+         * @brief コミット
+         * @details 読んだ葉ノードのどれかが読んだ後に書き換えられていれば、何も書かずに
+         *          false を返す。成否にかかわらず、トランザクションは空に戻る
+         *          (失敗した場合は読み直してやり直す)
+         * @return bool コミットできた場合 true
+         */
+        bool commit() {
+            WriteBatch batch;
+            for (auto& write : writes_) {
+                batch.ops_.push_back({write.first, std::move(write.second)});
+            }
+            auto ops = tree_.sortBatch(batch);
+            bool valid = true;
+            {
+                WriteLock lock(tree_);
+                for (const auto& read : reads_) {
+                    if (read.first ? read.first->version_ != read.second : tree_.root_ != nullptr) {
+                        valid = false;
+                        break;
+                    }
+                }
+                if (valid) {
+                    tree_.applyBatch(ops);
+                }
+            }
+            rollback();
+            return valid;
+        }
+
+        /**
+         * @brief 溜めた書き込みと読み取りの記録を捨てる
+         */
+        void rollback() {
+            reads_.clear();
+            writes_.clear();
+        }
+
+    private:
+        BPlusTree& tree_;
+        // 読んだ葉ノードと、読んだ時点の版 (空の木を読んだ場合は nullptr)
+        std::vector<std::pair<std::shared_ptr<LeafNode>, uint64_t>> reads_;
+        std::map<Key, std::optional<Value>, Compare> writes_;
+    };
+
+    /**
+     * @brief 更新を latch_ の手前の待ち行列 (McsLatch) に並ばせる
+     * @details 既定では更新は latch_ だけを取る。待ち行列があると更新は到着順に
+     *          1 つずつ latch_ へ進み、書き込みの待ち時間のばらつきが小さくなる
+     *          (bench/bench_writer_latch.cc)。代わりにロックが 2 つになり、1 コアでは
+     *          眠っている次のスレッドへ順に渡すのを待つ分だけスループットが落ちる。
+     *          トランザクションのコミットも並ぶので、並んでいる間に読んだ葉が書き換えられ、
+     *          競合の多い負荷では中断が増える (bench/bench_transactions.cc)。
+     *          木を複数のスレッドから使い始める前に 1 度だけ呼ぶこと
+     * @param spinBudget 待ち行列で眠る前に回る回数
+     */
+    void enableWriterQueue(uint32_t spinBudget = McsLatch::defaultSpinBudget()) {
+        writerLatch_ = std::make_unique<McsLatch>(spinBudget);
+    }
+
+    /**
+     * @brief 更新が並ぶラッチの統計
+     * @details 木全体の更新の統計。葉ごとの内訳は leafHeat()。contended が acquisitions に
+     *          近いほど、更新どうしが競合している。enableWriterQueue() していなければ
+     *          すべて 0
+     * @return McsLatch::Stats 
+     */
+    McsLatch::Stats writerLatchStats() const {
+        return writerLatch_ ? writerLatch_->stats() : McsLatch::Stats{0, 0, 0};
+    }
+
+    /**
+     * @brief 並列操作がタスクを投入するプールを変える
+     * @details 既定は WorkStealingPool::shared()。pool は木より長く生きること
+     * @param pool 
+     */
+    void setExecutor(WorkStealingPool& pool) {
+        executor_ = &pool;
+    }
+
+    /**
+     * @brief 並列操作がタスクを投入するプール
+     * @details setExecutor() していなければ共有プールを返す (初回はここで作る)
+     * @return WorkStealingPool& 
+     */
+    WorkStealingPool& executor() {
+        return executor_ ? *executor_ : WorkStealingPool::shared();
+    }
+
+    /**
+     * @brief 楽観的トランザクションを始める
+     * @return Transaction 
+     */
+    Transaction begin() {
+        return Transaction(*this);
+    }
+
+    /**
+     * @brief キーの削除
+     * @details 葉ノードからキーを取り除くだけで、ノードの併合は行わない。
+     *          空になった葉ノードもそのまま残る
+     * @param key Key または Key と比較可能な型のキー
+     * @return std::optional<Value> 
+     * @retval 削除したキーの値
+     * @retval キーが見つからない場合は std::nullopt
+     */
+    template <typename K>
+    std::optional<Value> erase(const K& key) {
+        WriteLock lock(*this);
+        return eraseUnlocked(key);
+    }
+
+};
+
+/**
+ * @brief 値を持たない木の値型
+ */
+struct NoValue {};
+
+/**
+ * @brief 値からキーを引く二次索引を自動で保守する木
+ * @details 主の木 (キー → 値) に加え、(値, キー) をキーとする索引の木を持ち、
+ *          insert / 上書き / erase のたびに両方を 1 つの排他区間の中で更新する。
+ *          読み取りは共有ロックの下で行うため、片方だけ更新された状態は見えない
+ */
+template <typename Key, typename Value, typename Compare = std::less<>>
+class ValueIndexedTree {
+public:
+    using IndexKey = std::pair<Value, Key>;
+
+    /**
+     * @brief 値だけで索引を探すための検索キー
+     */
+    struct ValueProbe {
+        const Value& value;
+    };
+
+    /**
+     * @brief 索引の木の比較関数
+     * @details (値, キー) の辞書式順序。ValueProbe との比較では値だけを比べる
+     */
+    struct IndexCompare {
+        using is_transparent = void;
+
+        Compare keyComp;
+
+        bool operator()(const IndexKey& a, const IndexKey& b) const {
+            if (valueComp(a.first, b.first)) {
+                return true;
+            }
+            if (valueComp(b.first, a.first)) {
+                return false;
+            }
+            return keyComp(a.second, b.second);
+        }
+        bool operator()(const IndexKey& a, const ValueProbe& b) const {
+            return valueComp(a.first, b.value);
+        }
+        bool operator()(const ValueProbe& a, const IndexKey& b) const {
+            return valueComp(a.value, b.first);
+        }
+
+        static bool valueComp(const Value& a, const Value& b) {
+            return std::less<>()(a, b);
+        }
+    };
+
+    using IndexTree = BPlusTree<IndexKey, NoValue, IndexCompare>;
+
+    explicit ValueIndexedTree(const Compare& comp = Compare())
+        : primary_(comp), index_(IndexCompare{comp}) {}
+
+    /**
+     * @brief キーの挿入
+     * @details キーが既にある場合は値を上書きし、索引も付け替える
+     * @param key 
+     * @param value 
+     */
+    void insert(const Key& key, const Value& value) {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        auto old = primary_.exchange(key, value);
+        if (old) {
+            index_.erase(IndexKey{*old, key});
+        }
+        index_.insert(IndexKey{value, key}, NoValue{});
+    }
+
+    /**
+     * @brief キーの削除
+     * @param key 
+     * @return std::optional<Value> 削除したキーの値
+     */
+    std::optional<Value> erase(const Key& key) {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        auto old = primary_.erase(key);
+        if (old) {
+            index_.erase(IndexKey{*old, key});
+        }
+        return old;
+    }
+
+    /**
+     * @brief キーの検索
+     * @param key 
+     * @return std::optional<Value> 
+     */
+    std::optional<Value> search(const Key& key) {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        return primary_.search(key);
+    }
+
+    /**
+     * @brief キー範囲内の要素を昇順に visitor(key, value) へ渡す
+     * @param range 
+     * @param visitor 
+     * @return bool 最後まで走査した場合 true、打ち切った場合 false
+     */
+    template <typename Visitor>
+    bool forEachInRange(const KeyRange<Key>& range, Visitor&& visitor) {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        return primary_.forEachInRange(range, std::forward<Visitor>(visitor));
+    }
+
+    /**
+     * @brief 値が value である要素のキーを昇順に visitor(key) へ渡す
+     * @param value 
+     * @param visitor visitor が false を返すとそこで打ち切る
+     * @return bool 最後まで走査した場合 true、打ち切った場合 false
+     */
+    template <typename Visitor>
+    bool forEachKeyWithValue(const Value& value, Visitor&& visitor) {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        bool completed = true;
+        index_.forEachInRange(KeyRange<ValueProbe>{ValueProbe{value}, std::nullopt},
+            [&](const IndexKey& entry, const NoValue&) {
+                if (IndexCompare{}(ValueProbe{value}, entry)) {
+                    return false;
+                }
+                if (!invokeVisitor(visitor, entry.second)) {
+                    completed = false;
+                    return false;
+                }
+                return true;
+            });
+        return completed;
+    }
+
+    /**
+     * @brief 値の範囲 [lo, hi) 内の要素を値の昇順に visitor(value, key) へ渡す
+     * @param lo 
+     * @param hi 
+     * @param visitor visitor が false を返すとそこで打ち切る
+     * @return bool 最後まで走査した場合 true、打ち切った場合 false
+     */
+    template <typename Visitor>
+    bool forEachInValueRange(const Value& lo, const Value& hi, Visitor&& visitor) {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        return index_.forEachInRange(KeyRange<ValueProbe>{ValueProbe{lo}, ValueProbe{hi}},
+            [&](const IndexKey& entry, const NoValue&) {
+                return invokeVisitor(visitor, entry.first, entry.second);
+            });
+    }
+
+    /**
+     * @brief 複数キーの一括検索
+     * @details BPlusTree::getMany() を共有ロックの下で呼ぶ
+     * @param keys 検索するキーの配列
+     * @param count キーの数
+     * @param values 見つかった値の書き込み先 (count 要素以上)。見つからなかった位置は変更しない
+     * @param found 各キーが見つかったかどうか (count 要素以上に確保済みであること)
+     * @return size_t 見つかったキーの数
+     */
+    size_t getMany(const Key* keys, size_t count, Value* values, std::vector<bool>& found) {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        return primary_.getMany(keys, count, values, found);
+    }
+
+    /**
+     * @brief キー範囲内の要素を呼び出し側のバッファへ昇順に書き出す
+     * @details BPlusTree::scanInto() を共有ロックの下で呼ぶ
+     * @param range 
+     * @param keys キーの書き込み先 (capacity 要素以上)
+     * @param values 値の書き込み先 (capacity 要素以上)
+     * @param capacity バッファの要素数
+     * @return ScanResult<Key> 
+     */
+    ScanResult<Key> scanInto(const KeyRange<Key>& range, Key* keys, Value* values, size_t capacity) {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        return primary_.scanInto(range, keys, values, capacity);
+    }
+
+    /**
+     * @brief 値ごとに、その値を持つ最小のキーを一括で引く
+     * @param values 検索する値の配列
+     * @param count 値の数
+     * @param keys 見つかったキーの書き込み先 (count 要素以上)。見つからなかった位置は変更しない
+     * @param found 各値が見つかったかどうか (count 要素以上に確保済みであること)
+     * @return size_t 見つかった値の数
+     */
+    size_t getManyByValue(const Value* values, size_t count, Key* keys, std::vector<bool>& found) {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        size_t hits = 0;
+        for (size_t i = 0; i < count; i++) {
+            found[i] = false;
+            index_.forEachInRange(KeyRange<ValueProbe>{ValueProbe{values[i]}, std::nullopt},
+                [&](const IndexKey& entry, const NoValue&) {
+                    if (!IndexCompare{}(ValueProbe{values[i]}, entry)) {
+                        keys[i] = entry.second;
+                        found[i] = true;
+                        hits++;
+                    }
+                    return false;
+                });
+        }
+        return hits;
+    }
+
+    /**
+     * @brief 索引の範囲内の要素を (値, キー) の昇順に visitor(value, key) へ渡す
+     * @details forEachInValueRange() と違い、境界を (値, キー) で指定できる。
+     *          scanIndexInto() の resumeKey を下限に渡せば続きから読める
+     * @param range 
+     * @param visitor visitor が false を返すとそこで打ち切る
+     * @return bool 最後まで走査した場合 true、打ち切った場合 false
+     */
+    template <typename Visitor>
+    bool forEachInIndexRange(const KeyRange<IndexKey>& range, Visitor&& visitor) {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        return index_.forEachInRange(range, [&](const IndexKey& entry, const NoValue&) {
+            return invokeVisitor(visitor, entry.first, entry.second);
+        });
+    }
+
+    /**
+     * @brief 索引の範囲内の (値, キー) を呼び出し側のバッファへ昇順に書き出す
+     * @details バッファが一杯になった時点で止め、続きの先頭の (値, キー) を返す
+     * @param range 
+     * @param entries 書き込み先 (capacity 要素以上)
+     * @param capacity バッファの要素数
+     * @return ScanResult<IndexKey> 
+     */
+    ScanResult<IndexKey> scanIndexInto(const KeyRange<IndexKey>& range, IndexKey* entries, size_t capacity) {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        ScanResult<IndexKey> result{0, std::nullopt};
+        index_.forEachInRange(range, [&](const IndexKey* leafKeys, const NoValue*, size_t n) {
+            size_t copied = std::min(n, capacity - result.count);
+            std::copy(leafKeys, leafKeys + copied, entries + result.count);
+            result.count += copied;
+            if (copied < n) {
+                result.resumeKey = leafKeys[copied];
+                return false;
+            }
+            return true;
+        });
+        return result;
+    }
+
+private:
+    BPlusTree<Key, Value, Compare> primary_;
+    IndexTree index_;
+    // 主の木と索引の木をまとめて保護する
+    std::shared_mutex mutex_;
+
+    template <typename Visitor, typename... Args>
+    static bool invokeVisitor(Visitor& visitor, Args&&... args) {
+        if constexpr (std::is_void_v<std::invoke_result_t<Visitor&, Args...>>) {
+            visitor(std::forward<Args>(args)...);
+            return true;
+        } else {
+            return static_cast<bool>(visitor(std::forward<Args>(args)...));
+        }
+    }
+};
+
+/**
+ * @brief 複数の生産者と 1 つの消費者のロックフリーなキュー
+ * @details 生産者は末尾のポインタを交換してノードをつなぐだけで、互いを待たない。
+ *          消費者は先頭のダミーノードの次を取り出す。生産者が末尾を交換してから
+ *          つなぐまでの間は、取り出せる要素がないように見える (empty() は false)
+ */
+template <typename T>
+class MpscQueue {
+public:
+    MpscQueue() : head_(new Node), tail_(head_.load()) {}
+    ~MpscQueue() {
+        while (pop()) {
+        }
+        delete tail_;
+    }
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    /**
+     * @brief 要素を追加する (どのスレッドからでも呼べる)
+     * @param value 
+     */
+    void push(T value) {
+        Node* node = new Node;
+        node->value.emplace(std::move(value));
+        Node* prev = head_.exchange(node);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    /**
+     * @brief 要素を取り出す (消費者のスレッドだけが呼べる)
+     * @return std::optional<T> 
+     */
+    std::optional<T> pop() {
+        Node* next = tail_->next.load(std::memory_order_acquire);
+        if (!next) {
+            return std::nullopt;
+        }
+        // ダミーでないノードは必ず値を持つ
+        T value = std::move(*next->value);
+        next->value.reset();
+        delete tail_;
+        tail_ = next;
+        return value;
+    }
+
+    /**
+     * @brief 追加中のものも含めて要素がないか (消費者のスレッドだけが呼べる)
+     * @return bool 
+     */
+    bool empty() const {
+        return head_.load() == tail_;
+    }
+
+private:
+    struct Node {
+        std::atomic<Node*> next{nullptr};
+        std::optional<T> value;
+    };
+
+    // 生産者が追加する側
+    alignas(64) std::atomic<Node*> head_;
+    // 消費者が取り出す側 (ダミーノード)
+    alignas(64) Node* tail_;
+};
+
+/**
+ * @brief キー空間を分割し、分割ごとに専用のスレッドが持つ木
+ * @details 分割 (シャード) ごとの BPlusTree はそのシャードの持ち主のスレッドだけが
+ *          触り、他のスレッドは操作をシャードの MpscQueue へ送って結果を future で
+ *          受け取る。木のノードが複数のコアのキャッシュを行き来しない。
+ *          持ち主のスレッドはキューが空の間 futex で眠り、送る側が起こす。
+ *          シャード i は境界キー [boundaries[i-1], boundaries[i]) を担当する。
+ *          exchange / search / erase は持ち主のスレッドから木のラッチを取らない本体を
+ *          直接呼ぶ。execute() の fn に渡す木の公開関数はラッチを取るが、持ち主しか
+ *          触らないので待つことはない
+ */
+template <typename Key, typename Value, typename Compare = std::less<>>
+class DelegatedTree {
+public:
+    using Tree = BPlusTree<Key, Value, Compare>;
+
+    /**
+     * @brief シャードと持ち主のスレッドを作る
+     * @param boundaries シャードの境界キー (昇順)。シャード数は boundaries.size() + 1
+     * @param pinThreads 持ち主のスレッドをシャードごとに別のコアへ固定するか
+     * @param comp 
+     */
+    explicit DelegatedTree(std::vector<Key> boundaries, bool pinThreads = false, const Compare& comp = Compare())
+        : boundaries_(std::move(boundaries)), comp_(comp) {
+        unsigned cores = std::max(1u, std::thread::hardware_concurrency());
+        for (size_t i = 0; i <= boundaries_.size(); i++) {
+            shards_.push_back(std::make_unique<Shard>(comp));
+        }
+        for (size_t i = 0; i < shards_.size(); i++) {
+            Shard& shard = *shards_[i];
+            shard.owner = std::thread([&shard] { run(shard); });
+#ifdef __linux__
+            if (pinThreads) {
+                cpu_set_t cpus;
+                CPU_ZERO(&cpus);
+                CPU_SET(i % cores, &cpus);
+                pthread_setaffinity_np(shard.owner.native_handle(), sizeof(cpus), &cpus);
+            }
+#else
+            (void)pinThreads;
+            (void)cores;
+#endif
+        }
+    }
+
+    /**
+     * @brief 送られた操作をすべて実行してから持ち主のスレッドを止める
+     */
+    ~DelegatedTree() {
+        for (auto& shard : shards_) {
+            shard->stopping.store(true);
+            wake(*shard);
+        }
+        for (auto& shard : shards_) {
+            shard->owner.join();
+        }
+    }
+    DelegatedTree(const DelegatedTree&) = delete;
+    DelegatedTree& operator=(const DelegatedTree&) = delete;
+
+    /**
+     * @brief key を担当するシャードの持ち主に fn(tree) を実行させる
+     * @param key 
+     * @param fn 
+     * @return std::future<std::invoke_result_t<Fn, Tree&>> fn の結果
+     */
+    template <typename Fn>
+    std::future<std::invoke_result_t<Fn, Tree&>> execute(const Key& key, Fn fn) {
+        return executeOn(shardIndex(key), std::move(fn));
+    }
+
+    /**
+     * @brief シャード index の持ち主に fn(tree) を実行させる
+     * @param index 
+     * @param fn 
+     * @return std::future<std::invoke_result_t<Fn, Tree&>> fn の結果
+     */
+    template <typename Fn>
+    std::future<std::invoke_result_t<Fn, Tree&>> executeOn(size_t index, Fn fn) {
+        using Result = std::invoke_result_t<Fn, Tree&>;
+        Shard& shard = *shards_[index];
+        std::packaged_task<Result()> task([&tree = shard.tree, fn = std::move(fn)]() mutable { return fn(tree); });
+        auto result = task.get_future();
+        shard.queue.push(std::packaged_task<void()>(std::move(task)));
+        wake(shard);
+        return result;
+    }
+
+    std::future<std::optional<Value>> exchange(const Key& key, const Value& value) {
+        return execute(key, [key, value](Tree& tree) { return tree.exchangeUnlocked(key, value); });
+    }
+
+    std::future<std::optional<Value>> search(const Key& key) {
+        return execute(key, [key](Tree& tree) { return tree.searchUnlocked(key); });
+    }
+
+    std::future<std::optional<Value>> erase(const Key& key) {
+        return execute(key, [key](Tree& tree) { return tree.eraseUnlocked(key); });
+    }
+
+    /**
+     * @brief key を担当するシャードの番号
+     * @param key 
+     * @return size_t 
+     */
+    size_t shardIndex(const Key& key) const {
+        return std::upper_bound(boundaries_.begin(), boundaries_.end(), key, comp_) - boundaries_.begin();
+    }
+
+    size_t shardCount() const {
+        return shards_.size();
+    }
+
+private:
+    enum : uint32_t { kAwake, kSleeping };
+
+    /**
+     * @brief シャード
+     */
+    struct Shard {
+        explicit Shard(const Compare& comp) : tree(comp) {}
+
+        Tree tree;
+        MpscQueue<std::packaged_task<void()>> queue;
+        // 持ち主のスレッドが眠っているか (futex で待つ語)
+        alignas(64) std::atomic<uint32_t> state{kAwake};
+        std::atomic<bool> stopping{false};
+        std::thread owner;
+    };
+
+    /**
+     * @brief 持ち主のスレッドの本体
+     * @details 眠る前に kSleeping を立ててからキューを見直すので、送る側が
+     *          キューに入れた後で kSleeping を見れば必ず起こし、見なければ
+     *          持ち主がキューの要素に気づく
+     * @param shard 
+     */
+    static void run(Shard& shard) {
+        while (true) {
+            if (auto task = shard.queue.pop()) {
+                (*task)();
+                continue;
+            }
+            if (!shard.queue.empty()) {
+                // 生産者がつなぎ終えるのを待つ
+                std::this_thread::yield();
+                continue;
+            }
+            if (shard.stopping.load()) {
+                return;
+            }
+            shard.state.store(kSleeping);
+            if (shard.queue.empty() && !shard.stopping.load()) {
+                Futex::wait(shard.state, kSleeping);
+            }
+            shard.state.store(kAwake);
+        }
+    }
+
+    static void wake(Shard& shard) {
+        if (shard.state.load() == kSleeping && shard.state.exchange(kAwake) == kSleeping) {
+            Futex::wake(shard.state);
+        }
+    }
+
+    std::vector<Key> boundaries_;
+    Compare comp_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+};
+
+/**
+ * @brief 2 次元の点を Z 順序 (Morton 符号) のキーで格納する木
+ * @details (x, y) のビットを交互に並べた 64 ビットの Morton 符号を BPlusTree の
+ *          キーにする。Z 順序で近い点は同じ葉ノードに集まるため、矩形の検索は
+ *          Z 順序の区間の走査になる。区間の途中で矩形の外に出た場合は BIGMIN
+ *          (矩形内で次に現れる Morton 符号) へ飛び、矩形外の葉ノードを読み飛ばす
+ */
+template <typename Value>
+class MortonTree {
+public:
+    /**
+     * @brief (x, y) を Morton 符号に変換する
+     * @details x が偶数ビット、y が奇数ビットに入る
+     * @param x 
+     * @param y 
+     * @return uint64_t 
+     */
+    static uint64_t encode(uint32_t x, uint32_t y) {
+        return spread(x) | (spread(y) << 1);
+    }
+
+    /**
+     * @brief Morton 符号を (x, y) に戻す
+     * @param z 
+     * @return std::pair<uint32_t, uint32_t> 
+     */
+    static std::pair<uint32_t, uint32_t> decode(uint64_t z) {
+        return {compact(z), compact(z >> 1)};
+    }
+
+    /**
+     * @brief 点の挿入
+     * @param x 
+     * @param y 
+     * @param value 
+     */
+    void insert(uint32_t x, uint32_t y, const Value& value) {
+        tree_.insert(encode(x, y), value);
+    }
+
+    /**
+     * @brief 点の検索
+     * @param x 
+     * @param y 
+     * @return std::optional<Value> 
+     */
+    std::optional<Value> search(uint32_t x, uint32_t y) {
+        return tree_.search(encode(x, y));
+    }
+
+    /**
+     * @brief 矩形 [xMin, xMax] x [yMin, yMax] 内の点を Z 順序で visitor(x, y, value) へ渡す
+     * @details visitor が false を返すとそこで打ち切る
+     * @param xMin 
+     * @param yMin 
+     * @param xMax 
+     * @param yMax 
+     * @param visitor 
+     * @return bool 最後まで走査した場合 true、打ち切った場合 false
+     */
+    template <typename Visitor>
+    bool boxQuery(uint32_t xMin, uint32_t yMin, uint32_t xMax, uint32_t yMax, Visitor&& visitor) {
+        if (xMin > xMax || yMin > yMax) {
+            return true;
+        }
+        uint64_t zMin = encode(xMin, yMin);
+        uint64_t zMax = encode(xMax, yMax);
+        KeyRange<uint64_t> range{zMin, std::nullopt};
+        if (zMax != UINT64_MAX) {
+            range.hi = zMax + 1;
+        }
+        while (true) {
+            std::optional<uint64_t> outside;
+            bool stopped = false;
+            tree_.forEachInRange(range, [&](uint64_t z, const Value& value) {
+                if (!inBox(z, zMin, zMax)) {
+                    outside = z;
+                    return false;
+                }
+                auto [x, y] = decode(z);
+                if (!invoke(visitor, x, y, value)) {
+                    stopped = true;
+                    return false;
+                }
+                return true;
+            });
+            if (stopped) {
+                return false;
+            }
+            if (!outside) {
+                return true;
+            }
+            range.lo = bigMin(*outside, zMin, zMax);
+        }
+    }
+
+    /**
+     * @brief 内部の木
+     * @return BPlusTree<uint64_t, Value>& 
+     */
+    BPlusTree<uint64_t, Value>& tree() {
+        return tree_;
+    }
+
+private:
+    static constexpr uint64_t kEvenBits = 0x5555555555555555ULL;
+    static constexpr uint64_t kOddBits = 0xAAAAAAAAAAAAAAAAULL;
+
+    BPlusTree<uint64_t, Value> tree_;
+
+    static uint64_t spread(uint32_t v) {
+        uint64_t x = v;
+        x = (x | (x << 16)) & 0x0000FFFF0000FFFFULL;
+        x = (x | (x << 8)) & 0x00FF00FF00FF00FFULL;
+        x = (x | (x << 4)) & 0x0F0F0F0F0F0F0F0FULL;
+        x = (x | (x << 2)) & 0x3333333333333333ULL;
+        x = (x | (x << 1)) & kEvenBits;
+        return x;
+    }
+
+    static uint32_t compact(uint64_t x) {
+        x &= kEvenBits;
+        x = (x | (x >> 1)) & 0x3333333333333333ULL;
+        x = (x | (x >> 2)) & 0x0F0F0F0F0F0F0F0FULL;
+        x = (x | (x >> 4)) & 0x00FF00FF00FF00FFULL;
+        x = (x | (x >> 8)) & 0x0000FFFF0000FFFFULL;
+        x = (x | (x >> 16)) & 0x00000000FFFFFFFFULL;
+        return (uint32_t)x;
+    }
+
+    /**
+     * @brief z が矩形内の点かどうか
+     * @details 各次元のビットだけを取り出した値は、その次元の座標と同じ順序になる
+     */
+    static bool inBox(uint64_t z, uint64_t zMin, uint64_t zMax) {
+        for (uint64_t mask : {kEvenBits, kOddBits}) {
+            if ((z & mask) < (zMin & mask) || (z & mask) > (zMax & mask)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /**
+     * @brief 矩形内にあり z より大きい最小の Morton 符号 (BIGMIN) を求める
+     * @details Tropf と Herzog の方法。上位ビットから z と矩形の角を比べ、
+     *          矩形を z を含まない側へ半分ずつ絞り込む
+     * @param z 矩形外の Morton 符号 (zMin < z < zMax)
+     * @param zMin 
+     * @param zMax 
+     * @return uint64_t 
+     */
+    static uint64_t bigMin(uint64_t z, uint64_t zMin, uint64_t zMax) {
+        uint64_t result = zMax;
+        for (int bit = 63; bit >= 0; bit--) {
+            uint64_t mask = 1ULL << bit;
+            // 同じ次元で bit より下位のビット
+            uint64_t lower = (mask - 1) & ((bit % 2 == 0) ? kEvenBits : kOddBits);
+            bool zBit = z & mask;
+            bool minBit = zMin & mask;
+            bool maxBit = zMax & mask;
+            if (!zBit && !minBit && maxBit) {
+                result = (zMin | mask) & ~lower;
+                zMax = (zMax & ~mask) | lower;
+            } else if (!zBit && minBit && maxBit) {
+                return zMin;
+            } else if (zBit && !minBit && !maxBit) {
+                return result;
+            } else if (zBit && !minBit && maxBit) {
+                zMin = (zMin | mask) & ~lower;
+            }
+        }
+        return result;
+    }
+
+    template <typename Visitor>
+    static bool invoke(Visitor& visitor, uint32_t x, uint32_t y, const Value& value) {
+        if constexpr (std::is_void_v<std::invoke_result_t<Visitor&, uint32_t, uint32_t, const Value&>>) {
+            visitor(x, y, value);
+            return true;
+        } else {
+            return static_cast<bool>(visitor(x, y, value));
+        }
+    }
+};
+
+// ディスク上のページの大きさ。O_DIRECT のバッファとオフセットもこの境界に揃える
+static constexpr size_t kPageSize = 4096;
+
+/**
+ * @brief ページ境界に揃えて確保したメモリの解放
+ */
+struct AlignedDeleter {
+    void operator()(char* p) const {
+        std::free(p);
+    }
+};
+
+using AlignedBuffer = std::unique_ptr<char[], AlignedDeleter>;
+
+/**
+ * @brief ページ境界に揃えたメモリを確保する
+ * @param size kPageSize の倍数
+ * @return AlignedBuffer 確保できなかった場合 nullptr
+ */
+inline AlignedBuffer allocateAligned(size_t size) {
+    void* p = nullptr;
+    if (posix_memalign(&p, kPageSize, size) != 0) {
+        return nullptr;
+    }
+    return AlignedBuffer(static_cast<char*>(p));
+}
+
+/**
+ * @brief ページ単位で読み書きするファイル
+ * @details O_DIRECT で開いた場合、読み書きはページキャッシュを通らず、
+ *          キャッシュは BufferPool だけが持つ (二重バッファリングを避ける)。
+ *          その場合、読み書きのバッファは kPageSize の境界に揃っていること
+ */
+class PageFile {
+public:
+    PageFile() = default;
+    ~PageFile() {
+        close();
+    }
+    PageFile(const PageFile&) = delete;
+    PageFile& operator=(const PageFile&) = delete;
+
+    /**
+     * @brief ファイルを開く
+     * @details direct が true の場合は O_DIRECT で開く。ファイルシステムが
+     *          O_DIRECT に対応しない場合 (tmpfs など) は通常の I/O で開き直す
+     * @param path 
+     * @param create true の場合、空のファイルを作り直す
+     * @param direct 
+     * @return bool 
+     */
+    bool open(const std::string& path, bool create, bool direct) {
+        close();
+        int flags = O_RDWR | O_CLOEXEC | (create ? O_CREAT | O_TRUNC : 0);
+        direct_ = false;
+#ifdef O_DIRECT
+        if (direct) {
+            fd_ = ::open(path.c_str(), flags | O_DIRECT, 0644);
+            direct_ = fd_ >= 0;
+        }
+#endif
+        if (fd_ < 0) {
+            fd_ = ::open(path.c_str(), flags, 0644);
+        }
+        return fd_ >= 0;
+    }
+
+    void close() {
+        if (fd_ >= 0) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+    }
+
+    /**
+     * @brief ページを読む
+     * @param pageNo 
+     * @param buffer kPageSize バイト
+     * @return bool ページ全体を読めた場合 true
+     */
+    bool readPage(uint32_t pageNo, void* buffer) const {
+        return transfer(pageNo, buffer, false);
+    }
+
+    /**
+     * @brief ページを書く
+     * @param pageNo 
+     * @param buffer kPageSize バイト
+     * @return bool 
+     */
+    bool writePage(uint32_t pageNo, const void* buffer) {
+        return transfer(pageNo, const_cast<void*>(buffer), true);
+    }
+
+    /**
+     * @brief 書き込んだ内容を永続化する
+     * @return bool 
+     */
+    bool sync() {
+        return fd_ >= 0 && ::fdatasync(fd_) == 0;
+    }
+
+    /**
+     * @brief ファイルを pages ページに切り詰める
+     * @param pages 
+     * @return bool 
+     */
+    bool truncate(uint32_t pages) {
+        return fd_ >= 0 && ::ftruncate(fd_, (off_t)pages * kPageSize) == 0;
+    }
+
+    /**
+     * @brief ファイル中のページ数
+     * @return uint32_t 
+     */
+    uint32_t pageCount() const {
+        struct stat st;
+        if (fd_ < 0 || ::fstat(fd_, &st) != 0) {
+            return 0;
+        }
+        return (uint32_t)(st.st_size / kPageSize);
+    }
+
+    bool isOpen() const {
+        return fd_ >= 0;
+    }
+
+    /**
+     * @brief O_DIRECT で開けたか
+     * @return bool 
+     */
+    bool direct() const {
+        return direct_;
+    }
+
+    int fd() const {
+        return fd_;
+    }
+
+private:
+    bool transfer(uint32_t pageNo, void* buffer, bool write) const {
+        if (fd_ < 0 || (direct_ && reinterpret_cast<uintptr_t>(buffer) % kPageSize != 0)) {
+            return false;
+        }
+        char* p = static_cast<char*>(buffer);
+        size_t done = 0;
+        off_t offset = (off_t)pageNo * kPageSize;
+        while (done < kPageSize) {
+            ssize_t n = write ? ::pwrite(fd_, p + done, kPageSize - done, offset + done)
+                              : ::pread(fd_, p + done, kPageSize - done, offset + done);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return false;
+            }
+            done += n;
+        }
+        return true;
+    }
+
+    int fd_ = -1;
+    bool direct_ = false;
+};
+
+/**
+ * @brief ページの非同期読み込み
+ * @details 読み込み要求をまとめて投入し、完了をまとめて回収する。
+ *          io_uring が使える場合は io_uring で、使えない場合は pread を行う
+ *          スレッドプールで処理する。1 つのインスタンスを複数のスレッドから
+ *          同時に使わないこと
+ */
+class AsyncPageReader {
+public:
+    /**
+     * @brief 1 ページの読み込み要求
+     */
+    struct Request {
+        uint32_t pageNo;
+        // kPageSize バイト (O_DIRECT の場合はページ境界に揃っていること)
+        char* buffer;
+        // 完了時にそのまま返す識別子
+        uint64_t tag;
+    };
+
+    /**
+     * @brief 読み込みの完了
+     */
+    struct Completion {
+        uint64_t tag;
+        // ページ全体を読めた場合 true
+        bool ok;
+    };
+
+    virtual ~AsyncPageReader() = default;
+
+    /**
+     * @brief 要求をまとめて投入する
+     * @param requests 
+     * @return bool 
+     */
+    virtual bool submit(const std::vector<Request>& requests) = 0;
+
+    /**
+     * @brief 完了を回収する
+     * @details 少なくとも minComplete 件が完了するまで待つ
+     * @param done 完了の追加先
+     * @param minComplete 
+     * @return size_t 回収した件数
+     */
+    virtual size_t reap(std::vector<Completion>& done, size_t minComplete) = 0;
+
+    /**
+     * @brief io_uring で処理しているか
+     * @return bool 
+     */
+    virtual bool usesIoUring() const = 0;
+
+    /**
+     * @brief fd を読む AsyncPageReader を作る
+     * @details io_uring を優先し、使えない場合は pread のスレッドプールを使う
+     * @param fd 
+     * @param depth 同時に処理中にできる要求の数の目安
+     * @return std::unique_ptr<AsyncPageReader> 
+     */
+    static std::unique_ptr<AsyncPageReader> create(int fd, unsigned depth);
+};
+
+#ifdef BPLUSTREE_HAVE_IO_URING
+/**
+ * @brief io_uring によるページの非同期読み込み
+ * @details liburing を使わず、io_uring_setup / io_uring_enter を直接呼ぶ。
+ *          投入と回収はどちらもまとめて 1 回のシステムコールで行う
+ */
+class UringPageReader : public AsyncPageReader {
+public:
+    UringPageReader(int fd) : fd_(fd) {}
+
+    ~UringPageReader() override {
+        if (sqes_) {
+            ::munmap(sqes_, sqesSize_);
+        }
+        if (cqRing_ && cqRing_ != sqRing_) {
+            ::munmap(cqRing_, cqRingSize_);
+        }
+        if (sqRing_) {
+            ::munmap(sqRing_, sqRingSize_);
+        }
+        if (ringFd_ >= 0) {
+            ::close(ringFd_);
+        }
+    }
+
+    /**
+     * @brief リングを作る
+     * @param entries 
+     * @return bool io_uring が使えない場合 false
+     */
+    bool init(unsigned entries) {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        ringFd_ = (int)::syscall(__NR_io_uring_setup, entries, &params);
+        if (ringFd_ < 0) {
+            return false;
+        }
+        sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+        cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single) {
+            sqRingSize_ = cqRingSize_ = std::max(sqRingSize_, cqRingSize_);
+        }
+        sqRing_ = mapRing(sqRingSize_, IORING_OFF_SQ_RING);
+        cqRing_ = single ? sqRing_ : mapRing(cqRingSize_, IORING_OFF_CQ_RING);
+        sqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+        sqes_ = static_cast<io_uring_sqe*>(mapRing(sqesSize_, IORING_OFF_SQES));
+        if (!sqRing_ || !cqRing_ || !sqes_) {
+            return false;
+        }
+        char* sq = static_cast<char*>(sqRing_);
+        char* cq = static_cast<char*>(cqRing_);
+        sqHead_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        sqTail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sqMask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sqArray_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        sqEntries_ = params.sq_entries;
+        cqHead_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cqTail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cqMask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        return true;
+    }
+
+    bool submit(const std::vector<Request>& requests) override {
+        size_t next = 0;
+        while (next < requests.size()) {
+            unsigned tail = *sqTail_;
+            unsigned head = __atomic_load_n(sqHead_, __ATOMIC_ACQUIRE);
+            unsigned queued = 0;
+            while (next < requests.size() && tail - head < sqEntries_) {
+                const Request& request = requests[next++];
+                unsigned index = tail & sqMask_;
+                io_uring_sqe& sqe = sqes_[index];
+                std::memset(&sqe, 0, sizeof(sqe));
+                sqe.opcode = IORING_OP_READ;
+                sqe.fd = fd_;
+                sqe.off = (uint64_t)request.pageNo * kPageSize;
+                sqe.addr = reinterpret_cast<uint64_t>(request.buffer);
+                sqe.len = kPageSize;
+                sqe.user_data = request.tag;
+                sqArray_[index] = index;
+                tail++;
+                queued++;
+            }
+            __atomic_store_n(sqTail_, tail, __ATOMIC_RELEASE);
+            // 投入キューが埋まっている間は、完了を 1 件待って空きを作る
+            unsigned flags = queued == 0 ? IORING_ENTER_GETEVENTS : 0;
+            if (enter(queued, queued == 0 ? 1 : 0, flags) < 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    size_t reap(std::vector<Completion>& done, size_t minComplete) override {
+        size_t reaped = 0;
+        while (true) {
+            unsigned head = *cqHead_;
+            unsigned tail = __atomic_load_n(cqTail_, __ATOMIC_ACQUIRE);
+            for (; head != tail; head++, reaped++) {
+                const io_uring_cqe& cqe = cqes_[head & cqMask_];
+                done.push_back({cqe.user_data, cqe.res == (int)kPageSize});
+            }
+            __atomic_store_n(cqHead_, head, __ATOMIC_RELEASE);
+            if (reaped >= minComplete) {
+                return reaped;
+            }
+            if (enter(0, (unsigned)(minComplete - reaped), IORING_ENTER_GETEVENTS) < 0) {
+                return reaped;
+            }
+        }
+    }
+
+    bool usesIoUring() const override {
+        return true;
+    }
+
+private:
+    void* mapRing(size_t size, off_t offset) {
+        void* p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd_, offset);
+        return p == MAP_FAILED ? nullptr : p;
+    }
+
+    int enter(unsigned toSubmit, unsigned minComplete, unsigned flags) {
+        while (true) {
+            int n = (int)::syscall(__NR_io_uring_enter, ringFd_, toSubmit, minComplete, flags, nullptr, 0);
+            if (n >= 0 || errno != EINTR) {
+                return n;
+            }
+        }
+    }
+
+    int fd_;
+    int ringFd_ = -1;
+    void* sqRing_ = nullptr;
+    void* cqRing_ = nullptr;
+    io_uring_sqe* sqes_ = nullptr;
+    size_t sqRingSize_ = 0;
+    size_t cqRingSize_ = 0;
+    size_t sqesSize_ = 0;
+    unsigned* sqHead_ = nullptr;
+    unsigned* sqTail_ = nullptr;
+    unsigned* sqArray_ = nullptr;
+    unsigned sqMask_ = 0;
+    unsigned sqEntries_ = 0;
+    unsigned* cqHead_ = nullptr;
+    unsigned* cqTail_ = nullptr;
+    unsigned cqMask_ = 0;
+    io_uring_cqe* cqes_ = nullptr;
+};
+#endif
+
+/**
+ * @brief pread を行うスレッドプールによるページの非同期読み込み
+ * @details io_uring が使えない環境での代替
+ */
+class ThreadPoolPageReader : public AsyncPageReader {
+public:
+    ThreadPoolPageReader(int fd, unsigned threads) : fd_(fd) {
+        for (unsigned i = 0; i < std::max(threads, 1u); i++) {
+            workers_.emplace_back([this] { run(); });
+        }
+    }
+
+    ~ThreadPoolPageReader() override {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        requestReady_.notify_all();
+        for (auto& worker : workers_) {
+            worker.join();
+        }
+    }
+
+    bool submit(const std::vector<Request>& requests) override {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queue_.insert(queue_.end(), requests.begin(), requests.end());
+        }
+        requestReady_.notify_all();
+        return true;
+    }
+
+    size_t reap(std::vector<Completion>& done, size_t minComplete) override {
+        std::unique_lock<std::mutex> lock(mutex_);
+        completionReady_.wait(lock, [&] { return completed_.size() >= minComplete; });
+        size_t reaped = completed_.size();
+        done.insert(done.end(), completed_.begin(), completed_.end());
+        completed_.clear();
+        return reaped;
+    }
+
+    bool usesIoUring() const override {
+        return false;
+    }
+
+private:
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            requestReady_.wait(lock, [this] { return stopping_ || !queue_.empty(); });
+            if (queue_.empty()) {
+                return;
+            }
+            Request request = queue_.front();
+            queue_.erase(queue_.begin());
+            lock.unlock();
+            bool ok = ::pread(fd_, request.buffer, kPageSize, (off_t)request.pageNo * kPageSize) == (ssize_t)kPageSize;
+            lock.lock();
+            completed_.push_back({request.tag, ok});
+            completionReady_.notify_one();
+        }
+    }
+
+    int fd_;
+    std::vector<std::thread> workers_;
+    std::vector<Request> queue_;
+    std::vector<Completion> completed_;
+    bool stopping_ = false;
+    std::mutex mutex_;
+    std::condition_variable requestReady_;
+    std::condition_variable completionReady_;
+};
+
+inline std::unique_ptr<AsyncPageReader> AsyncPageReader::create(int fd, unsigned depth) {
+#ifdef BPLUSTREE_HAVE_IO_URING
+    auto uring = std::make_unique<UringPageReader>(fd);
+    if (uring->init(depth)) {
+        return uring;
+    }
+#endif
+    return std::make_unique<ThreadPoolPageReader>(fd, std::min(depth, 16u));
+}
+
+/**
+ * @brief ページのキャッシュ
+ * @details 固定数のフレームを 1 つのページ境界に揃えた領域から切り出し、
+ *          PageFile から直接読み込む。追い出しはクロック方式で、ピン留めされた
+ *          フレームは追い出さない。読み込み中のフレームは表に載せたまま
+ *          ロックの外で読むので、ミスしたページの読み込みは並行して進む。
+ *          汚れた追い出し対象の書き戻しもロックの外で行う。
+ *          pinAsync() / finishLoad() で読み込みを呼び出し側 (AsyncPageReader) に
+ *          任せることもできる。スレッドセーフ
+ */
+class BufferPool {
+public:
+    /**
+     * @brief ピン留めしたページへの参照
+     * @details 破棄されるとピン留めを外す
+     */
+    class PageRef {
+    public:
+        PageRef() = default;
+        PageRef(BufferPool* pool, size_t frame) : pool_(pool), frame_(frame) {}
+        PageRef(PageRef&& other) noexcept : pool_(std::exchange(other.pool_, nullptr)), frame_(other.frame_) {}
+        PageRef& operator=(PageRef&& other) noexcept {
+            if (this != &other) {
+                release();
+                pool_ = std::exchange(other.pool_, nullptr);
+                frame_ = other.frame_;
+            }
+            return *this;
+        }
+        PageRef(const PageRef&) = delete;
+        PageRef& operator=(const PageRef&) = delete;
+        ~PageRef() {
+            release();
+        }
+
+        explicit operator bool() const {
+            return pool_ != nullptr;
+        }
+
+        char* data() const {
+            return pool_->frameData(frame_);
+        }
+
+        uint32_t pageNo() const {
+            return pool_->frames_[frame_].pageNo;
+        }
+
+        /**
+         * @brief 書き換えたことを記録する。追い出しか flush() で書き戻される
+         */
+        void markDirty() {
+            std::lock_guard<std::mutex> lock(pool_->mutex_);
+            pool_->frames_[frame_].dirty = true;
+        }
+
+    private:
+        friend class BufferPool;
+
+        void release() {
+            if (pool_) {
+                pool_->unpin(frame_);
+                pool_ = nullptr;
+            }
+        }
+
+        BufferPool* pool_ = nullptr;
+        size_t frame_ = 0;
+    };
+
+    /**
+     * @brief コンストラクタ
+     * @param file 
+     * @param frames キャッシュするページ数
+     */
+    BufferPool(PageFile& file, size_t frames)
+        : file_(file), memory_(allocateAligned(kPageSize * std::max<size_t>(frames, 1))),
+          frames_(std::max<size_t>(frames, 1)) {}
+
+    /**
+     * @brief ページをピン留めして返す
+     * @details 他のスレッドが読み込み中のページは、読み込みの完了を待つ
+     * @param pageNo 
+     * @return PageRef 読めなかった場合、または全フレームがピン留め中の場合は空
+     */
+    PageRef pin(uint32_t pageNo) {
+        bool mustRead = false;
+        PageRef page = pinAsync(pageNo, mustRead);
+        if (page && mustRead) {
+            finishLoad(page, file_.readPage(pageNo, page.data()));
+        }
+        if (page && !waitLoaded(page)) {
+            return PageRef();
+        }
+        return page;
+    }
+
+    /**
+     * @brief 新しいページ用のフレームを、ファイルから読まずにゼロで埋めて返す
+     * @param pageNo 
+     * @return PageRef 
+     */
+    PageRef allocate(uint32_t pageNo) {
+        return pin(pageNo, false);
+    }
+
+    /**
+     * @brief ページをピン留めし、キャッシュになければ読み込みを呼び出し側に任せる
+     * @details mustRead が true で返った場合、呼び出し側が data() へページを読み、
+     *          finishLoad() を呼ぶこと。false の場合でも、他のスレッドが読み込み中の
+     *          ことがあるため、内容を使う前に waitLoaded() を呼ぶこと
+     * @param pageNo 
+     * @param mustRead 
+     * @return PageRef 全フレームがピン留め中の場合は空
+     */
+    PageRef pinAsync(uint32_t pageNo, bool& mustRead) {
+        return pin(pageNo, true, &mustRead);
+    }
+
+    /**
+     * @brief pinAsync() で任された読み込みの完了を記録する
+     * @details 失敗した場合、フレームを表から外す (同じページを待っている参照は
+     *          waitLoaded() が false を返す)
+     * @param page 
+     * @param ok 
+     */
+    void finishLoad(PageRef& page, bool ok) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            Frame& frame = frames_[page.frame_];
+            frame.loading = false;
+            if (!ok) {
+                table_.erase(frame.pageNo);
+                frame.valid = false;
+                frame.failed = true;
+            }
+        }
+        loaded_.notify_all();
+    }
+
+    /**
+     * @brief ページの読み込みの完了を待つ
+     * @param page 
+     * @return bool 読み込みに成功した場合 true
+     */
+    bool waitLoaded(const PageRef& page) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        const Frame& frame = frames_[page.frame_];
+        loaded_.wait(lock, [&] { return !frame.loading; });
+        return !frame.failed;
+    }
+
+    /**
+     * @brief ページの読み込みの結果を待たずに調べる
+     * @param page 
+     * @return std::optional<bool> 読み込み中なら nullopt、終わっていれば成功したか
+     */
+    std::optional<bool> loadResult(const PageRef& page) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const Frame& frame = frames_[page.frame_];
+        if (frame.loading) {
+            return std::nullopt;
+        }
+        return !frame.failed;
+    }
+
+    /**
+     * @brief 書き換えられたページをすべて書き戻す
+     * @return bool 
+     */
+    bool flush() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        bool ok = true;
+        for (size_t i = 0; i < frames_.size(); i++) {
+            if (frames_[i].valid && frames_[i].dirty) {
+                ok = file_.writePage(frames_[i].pageNo, frameData(i)) && ok;
+                frames_[i].dirty = false;
+            }
+        }
+        return ok;
+    }
+
+    /**
+     * @brief ページをキャッシュから書き戻さずに捨てる
+     * @details 切り詰めたファイルの外にあるページなど、内容が不要になったページに使う。
+     *          ピン留め中のページは捨てない
+     * @param pageNo 
+     */
+    void discard(uint32_t pageNo) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        auto found = table_.find(pageNo);
+        while (found != table_.end() && frames_[found->second].writing) {
+            // 書き戻しが切り詰めた後のファイルへ届かないよう、終わるのを待つ
+            loaded_.wait(lock);
+            found = table_.find(pageNo);
+        }
+        if (found != table_.end() && frames_[found->second].pins == 0 && !frames_[found->second].loading) {
+            frames_[found->second].valid = false;
+            frames_[found->second].dirty = false;
+            table_.erase(found);
+        }
+    }
+
+    /**
+     * @brief キャッシュにないページの読み込み回数
+     * @return uint64_t 
+     */
+    uint64_t misses() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return misses_;
+    }
+
+    /**
+     * @brief キャッシュできるページ数
+     * @return size_t 
+     */
+    size_t capacity() const {
+        return frames_.size();
+    }
+
+    PageFile& file() {
+        return file_;
+    }
+
+private:
+    struct Frame {
+        uint32_t pageNo = 0;
+        int pins = 0;
+        bool valid = false;
+        bool dirty = false;
+        bool referenced = false;
+        // 読み込み中
+        bool loading = false;
+        // 最後の読み込みに失敗した
+        bool failed = false;
+        // 追い出しのための書き戻し中 (mutex_ の外で書いている)
+        bool writing = false;
+    };
+
+    char* frameData(size_t frame) const {
+        return memory_.get() + frame * kPageSize;
+    }
+
+    /**
+     * @brief フレームを割り当ててピン留めする
+     * @param pageNo 
+     * @param read false の場合はゼロで埋めた新しいページにする
+     * @param mustRead read が true でキャッシュになかった場合に true を入れる。
+     *                 nullptr の場合はこの関数の中で読む
+     * @return PageRef 
+     */
+    PageRef pin(uint32_t pageNo, bool read, bool* mustRead = nullptr) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (mustRead) {
+            *mustRead = false;
+        }
+        if (!memory_) {
+            return PageRef();
+        }
+        std::optional<size_t> victim;
+        while (true) {
+            auto found = table_.find(pageNo);
+            if (found != table_.end()) {
+                Frame& frame = frames_[found->second];
+                if (frame.writing) {
+                    // 追い出すために書き戻している最中なので、終わってから探し直す
+                    loaded_.wait(lock);
+                    continue;
+                }
+                frame.pins++;
+                frame.referenced = true;
+                if (!read) {
+                    std::memset(frameData(found->second), 0, kPageSize);
+                    frame.dirty = true;
+                }
+                return PageRef(this, found->second);
+            }
+            victim = findVictim();
+            if (!victim) {
+                bool writing = std::any_of(frames_.begin(), frames_.end(),
+                                           [](const Frame& f) { return f.writing; });
+                if (!writing) {
+                    return PageRef();
+                }
+                // 書き戻しが終われば空くフレームがある
+                loaded_.wait(lock);
+                continue;
+            }
+            Frame& frame = frames_[*victim];
+            if (!frame.valid || !frame.dirty) {
+                break;
+            }
+            // 書き戻しはロックの外で行い、他のスレッドのヒットや読み込みを止めない。
+            // その間フレームは writing にして、ピン留めも追い出しもさせない
+            frame.writing = true;
+            uint32_t written = frame.pageNo;
+            lock.unlock();
+            bool ok = file_.writePage(written, frameData(*victim));
+            lock.lock();
+            frame.writing = false;
+            if (ok) {
+                frame.dirty = false;
+            }
+            loaded_.notify_all();
+            if (!ok) {
+                return PageRef();
+            }
+            // 書き戻しの間に pageNo が読み込まれたかもしれないので、表から探し直す。
+            // 書いたフレームが誰にも使われていなければ、そのまま追い出す
+            if (table_.count(pageNo) == 0 && frame.valid && frame.pageNo == written &&
+                frame.pins == 0 && !frame.dirty) {
+                break;
+            }
+        }
+        Frame& frame = frames_[*victim];
+        if (frame.valid) {
+            table_.erase(frame.pageNo);
+        }
+        frame = Frame{pageNo, 1, true, !read, true, false, false};
+        table_.emplace(pageNo, *victim);
+        if (!read) {
+            std::memset(frameData(*victim), 0, kPageSize);
+        } else {
+            misses_++;
+            if (mustRead) {
+                frame.loading = true;
+                *mustRead = true;
+            } else if (!file_.readPage(pageNo, frameData(*victim))) {
+                table_.erase(pageNo);
+                frame.valid = false;
+                frame.pins--;
+                return PageRef();
+            }
+        }
+        return PageRef(this, *victim);
+    }
+
+    /**
+     * @brief クロック方式で追い出すフレームを選ぶ
+     * @return std::optional<size_t> 全フレームがピン留め中の場合 nullopt
+     */
+    std::optional<size_t> findVictim() {
+        for (size_t step = 0; step < frames_.size() * 2; step++) {
+            size_t i = hand_;
+            hand_ = (hand_ + 1) % frames_.size();
+            Frame& frame = frames_[i];
+            if (frame.pins > 0 || frame.writing) {
+                continue;
+            }
+            if (frame.valid && frame.referenced) {
+                frame.referenced = false;
+                continue;
+            }
+            return i;
+        }
+        return std::nullopt;
+    }
+
+    void unpin(size_t frame) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        frames_[frame].pins--;
+    }
+
+    PageFile& file_;
+    AlignedBuffer memory_;
+    std::vector<Frame> frames_;
+    std::unordered_map<uint32_t, size_t> table_;
+    size_t hand_ = 0;
+    uint64_t misses_ = 0;
+    mutable std::mutex mutex_;
+    std::condition_variable loaded_;
+};
+
+template <typename Key, typename Value, typename Compare>
+class DiskBPlusTree;
+
+/**
+ * @brief ディスク上のノードページのヘッダ
+ */
+struct NodePageHeader {
+    uint16_t isLeaf;
+    uint16_t count;
+    // ページを持つ木の番号 (DiskCatalog が木ごとに割り当てる)
+    uint32_t owner;
+};
+
+/**
+ * @brief 1 つのページファイルを複数の名前付き DiskBPlusTree で共有するカタログ
+ * @details ファイル、バッファプール (メモリの上限)、空きページ、コミットを木の間で
+ *          共有し、小さな木がそれぞれページやキャッシュを抱え込まないようにする。
+ *          各木の根・高さ・要素数は名前とともにカタログのページへ記録し、コミットの
+ *          たびに空きページ一覧と一緒に新しいページへ書き直す。ノードページの
+ *          ヘッダには持ち主の木の番号を入れておき、コンパクションは移すページの
+ *          子ポインタの付け替えを持ち主の木に任せる。
+ *          木は DiskBPlusTree::open(catalog, name) で開き、カタログより先に閉じること
+ */
+class DiskCatalog {
+public:
+    /**
+     * @brief 更新の永続化の方式
+     */
+    enum class Durability {
+        // ページをその場で書き換える。flush() の途中でクラッシュすると壊れうる
+        InPlace,
+        // コミット済みのページを書き換えず、新しいページへ写す
+        ShadowPaging,
+    };
+
+    /**
+     * @brief スーパーブロック
+     * @details ページ 0 の前半と後半の 2 つの枠へ、世代ごとに交互に書く
+     */
+    struct Superblock {
+        char magic[8];
+        uint32_t pageCount;
+        // 空きページ一覧の先頭ページ (空きがなければ 0)
+        uint32_t freeHead;
+        uint32_t freeCount;
+        // 木の一覧の先頭ページ (木がなければ 0)
+        uint32_t catalogHead;
+        uint32_t treeCount;
+        // 次に作る木の番号
+        uint32_t nextTreeId;
+        // checksum 以外のフィールドのチェックサム
+        uint32_t checksum;
+        uint32_t reserved;
+        // コミットのたびに増える世代
+        uint64_t generation;
+    };
+
+    // 木の名前の最大長 (終端を含む)
+    static constexpr size_t kNameSize = 48;
+
+    /**
+     * @brief 木の記録
+     */
+    struct TreeRecord {
+        char name[kNameSize];
+        uint32_t id;
+        uint32_t keySize;
+        uint32_t valueSize;
+        // 根のページ番号 (空の木は 0)
+        uint32_t root;
+        uint32_t height;
+        uint32_t reserved;
+        uint64_t count;
+    };
+
+    /**
+     * @brief 空きページ一覧のページ
+     */
+    struct FreeListPage {
+        uint32_t next;
+        uint32_t count;
+        uint32_t pages[(kPageSize - 2 * sizeof(uint32_t)) / sizeof(uint32_t)];
+    };
+
+    /**
+     * @brief 木の一覧のページ
+     */
+    struct CatalogPage {
+        uint32_t next;
+        uint32_t count;
+        TreeRecord records[(kPageSize - 2 * sizeof(uint32_t)) / sizeof(TreeRecord)];
+    };
+
+    static constexpr char kMagic[8] = {'B', 'P', 'T', 'D', 'I', 'S', 'K', '4'};
+    // スーパーブロックの枠の大きさ
+    static constexpr size_t kSuperSlot = kPageSize / 2;
+
+    DiskCatalog() = default;
+    ~DiskCatalog() {
+        flush();
+    }
+    DiskCatalog(const DiskCatalog&) = delete;
+    DiskCatalog& operator=(const DiskCatalog&) = delete;
+
+    /**
+     * @brief 木を持たない新しいカタログのファイルを作る
+     * @param path 
+     * @param poolPages 木の間で共有するバッファプールのページ数
+     * @param direct O_DIRECT で読み書きするか
+     * @param durability 更新の永続化の方式
+     * @return bool 
+     */
+    bool create(const std::string& path, size_t poolPages = 1024, bool direct = true,
+                Durability durability = Durability::InPlace) {
+        std::lock_guard<std::mutex> members(membersMutex_);
+        if (!reset(durability) || !file_.open(path, true, direct)) {
+            return false;
+        }
+        std::copy(kMagic, kMagic + sizeof(kMagic), super_.magic);
+        super_.pageCount = 1;
+        super_.nextTreeId = 1;
+        pool_ = std::make_unique<BufferPool>(file_, std::max<size_t>(poolPages, 4));
+        if (!commit()) {
+            pool_.reset();
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief カタログのファイルを開く
+     * @details スーパーブロックの 2 つの枠のうち、チェックサムが合う新しい世代の方を読み、
+     *          空きページ一覧と木の一覧を読み込む
+     * @param path 
+     * @param poolPages 木の間で共有するバッファプールのページ数
+     * @param direct O_DIRECT で読み書きするか
+     * @param durability 更新の永続化の方式
+     * @return bool 
+     */
+    bool open(const std::string& path, size_t poolPages = 1024, bool direct = true,
+              Durability durability = Durability::InPlace) {
+        std::lock_guard<std::mutex> members(membersMutex_);
+        if (!reset(durability) || !file_.open(path, false, direct) || !file_.readPage(0, superPage_.get())) {
+            return false;
+        }
+        std::optional<Superblock> latest;
+        for (size_t slot = 0; slot < 2; slot++) {
+            Superblock super;
+            std::memcpy(&super, superPage_.get() + kSuperSlot * slot, sizeof(super));
+            if (std::equal(kMagic, kMagic + sizeof(kMagic), super.magic) && super.checksum == checksum(super)
+                && (!latest || super.generation > latest->generation)) {
+                latest = super;
+            }
+        }
+        if (!latest) {
+            return false;
+        }
+        super_ = *latest;
+        pool_ = std::make_unique<BufferPool>(file_, std::max<size_t>(poolPages, 4));
+        for (uint32_t next = super_.freeHead; next != 0;) {
+            auto page = pool_->pin(next);
+            if (!page) {
+                pool_.reset();
+                return false;
+            }
+            auto* list = reinterpret_cast<FreeListPage*>(page.data());
+            freePages_.insert(list->pages, list->pages + std::min<size_t>(list->count, std::size(list->pages)));
+            metaPages_.push_back(next);
+            next = list->next;
+        }
+        for (uint32_t next = super_.catalogHead; next != 0;) {
+            auto page = pool_->pin(next);
+            if (!page) {
+                pool_.reset();
+                return false;
+            }
+            auto* catalog = reinterpret_cast<CatalogPage*>(page.data());
+            for (size_t i = 0; i < std::min<size_t>(catalog->count, std::size(catalog->records)); i++) {
+                const TreeRecord& record = catalog->records[i];
+                trees_.emplace(std::string(record.name, strnlen(record.name, kNameSize)), record);
+            }
+            metaPages_.push_back(next);
+            next = catalog->next;
+        }
+        return true;
+    }
+
+    /**
+     * @brief カタログにある木の名前
+     * @return std::vector<std::string> 
+     */
+    std::vector<std::string> names() {
+        std::lock_guard<std::mutex> members(membersMutex_);
+        std::vector<std::string> result;
+        for (const auto& tree : trees_) {
+            result.push_back(tree.first);
+        }
+        return result;
+    }
+
+    /**
+     * @brief すべての木の更新をまとめて永続化する
+     * @details 開いている木の更新を止めてから、書き換えたページ、空きページ一覧と
+     *          木の一覧を書き戻して fsync し、その後でスーパーブロックを次の世代の
+     *          枠へ書いて fsync する。シャドウページングでは、これがすべての木の
+     *          前回の flush() 以降の更新のコミットになる
+     * @return bool 
+     */
+    bool flush() {
+        std::lock_guard<std::mutex> members(membersMutex_);
+        auto latches = lockMembers();
+        return pool_ && commit();
+    }
+
+    /**
+     * @brief コンパクションを 1 段進める
+     * @details ファイル末尾側の使用中ページを、先頭に最も近い空きページへ最大 maxMoves 個
+     *          移し、移したページを指していた親の子ポインタを持ち主の木に付け替えさせて
+     *          コミットする。その後、末尾に並んだ空きページを切り詰める。
+     *          開いていない木のページは移せないので、その手前までしか切り詰められない。
+     *          1 段の間だけ開いている木の更新を止めるので、段の合間には他の読み書きが進む
+     * @param maxMoves 1 段で移すページ数の上限 (1 段の I/O 量の上限になる)
+     * @return uint32_t 切り詰めたページ数
+     */
+    uint32_t compactStep(size_t maxMoves) {
+        std::lock_guard<std::mutex> members(membersMutex_);
+        auto latches = lockMembers();
+        if (!pool_) {
+            return 0;
+        }
+        size_t moves = 0;
+        for (uint32_t pageNo = super_.pageCount; pageNo-- > 1 && moves < maxMoves;) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (freePages_.empty() || *freePages_.begin() > pageNo) {
+                    break;
+                }
+                if (freePages_.count(pageNo) || pendingFree_.count(pageNo)
+                    || std::find(metaPages_.begin(), metaPages_.end(), pageNo) != metaPages_.end()) {
+                    continue;
+                }
+            }
+            NodePageHeader header;
+            {
+                auto page = pool_->pin(pageNo);
+                if (!page) {
+                    return 0;
+                }
+                std::memcpy(&header, page.data(), sizeof(header));
+            }
+            auto owner = members_.find(header.owner);
+            if (owner == members_.end()) {
+                continue;
+            }
+            if (!owner->second->relocate(pageNo, allocatePage())) {
+                return 0;
+            }
+            releasePage(pageNo);
+            moves++;
+        }
+        if (!commit()) {
+            return 0;
+        }
+        uint32_t before = super_.pageCount;
+        while (super_.pageCount > 1 && freePages_.count(super_.pageCount - 1)) {
+            freePages_.erase(--super_.pageCount);
+            pool_->discard(super_.pageCount);
+        }
+        if (super_.pageCount == before) {
+            return 0;
+        }
+        // 切り詰めるページを含まないスーパーブロックをコミットしてから切り詰める
+        if (!commit() || !file_.truncate(super_.pageCount)) {
+            return 0;
+        }
+        return before - super_.pageCount;
+    }
+
+    /**
+     * @brief 末尾を切り詰められなくなるまでコンパクションを進める
+     * @param maxMovesPerStep 
+     * @return uint32_t 切り詰めたページ数
+     */
+    uint32_t compact(size_t maxMovesPerStep = 64) {
+        uint32_t total = 0;
+        while (true) {
+            uint32_t truncated = compactStep(maxMovesPerStep);
+            if (truncated == 0) {
+                return total;
+            }
+            total += truncated;
+            std::this_thread::yield();
+        }
+    }
+
+    /**
+     * @brief 空きページの数
+     * @return size_t 
+     */
+    size_t freePageCount() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return freePages_.size();
+    }
+
+    /**
+     * @brief ファイル中のページ数 (スーパーブロックを含む)
+     * @return uint32_t 
+     */
+    uint32_t pageCount() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return super_.pageCount;
+    }
+
+    /**
+     * @brief O_DIRECT で読み書きしているか
+     * @return bool 
+     */
+    bool direct() const {
+        return file_.direct();
+    }
+
+    Durability durability() const {
+        return durability_;
+    }
+
+    BufferPool& pool() {
+        return *pool_;
+    }
+
+private:
+    template <typename Key, typename Value, typename Compare>
+    friend class DiskBPlusTree;
+
+    /**
+     * @brief カタログで開いている木
+     */
+    class Member {
+    public:
+        virtual ~Member() = default;
+
+        /**
+         * @brief 木全体のラッチ。コミットとコンパクションの間は排他で取る
+         * @return std::shared_mutex& 
+         */
+        virtual std::shared_mutex& memberLatch() = 0;
+
+        /**
+         * @brief 木のページ from を to へ写し、指している子ポインタを付け替える
+         * @param from 
+         * @param to 
+         * @return bool 
+         */
+        virtual bool relocate(uint32_t from, uint32_t to) = 0;
+    };
+
+    /**
+     * @brief 木を 1 つだけ持つカタログを書き出す (DiskBPlusTree::build() が使う)
+     * @details 木の一覧をページ pageCount に置き、木のページとともに永続化してから
+     *          スーパーブロックを書く
+     * @param file 
+     * @param pageCount 木が使っているページ数 (スーパーブロックを含む)
+     * @param record 
+     * @return bool 
+     */
+    static bool writeNew(PageFile& file, uint32_t pageCount, const TreeRecord& record) {
+        AlignedBuffer page = allocateAligned(kPageSize);
+        if (!page) {
+            return false;
+        }
+        std::memset(page.get(), 0, kPageSize);
+        auto* catalog = reinterpret_cast<CatalogPage*>(page.get());
+        catalog->count = 1;
+        catalog->records[0] = record;
+        if (!file.writePage(pageCount, page.get())) {
+            return false;
+        }
+        std::memset(page.get(), 0, kPageSize);
+        Superblock super{};
+        std::copy(kMagic, kMagic + sizeof(kMagic), super.magic);
+        super.pageCount = pageCount + 1;
+        super.catalogHead = pageCount;
+        super.treeCount = 1;
+        super.nextTreeId = record.id + 1;
+        super.generation = 1;
+        super.checksum = checksum(super);
+        std::memcpy(page.get() + kSuperSlot * (super.generation % 2), &super, sizeof(super));
+        return file.sync() && file.writePage(0, page.get()) && file.sync();
+    }
+
+    /**
+     * @brief 木をカタログにつなぐ
+     * @details name の木がなければ空の木として作る。同じ木を 2 か所から開くことはできない
+     * @param name 
+     * @param keySize 
+     * @param valueSize 
+     * @param member 
+     * @return TreeRecord* 木の記録。開けない場合 nullptr
+     */
+    TreeRecord* attach(const std::string& name, uint32_t keySize, uint32_t valueSize, Member* member) {
+        std::lock_guard<std::mutex> members(membersMutex_);
+        if (!pool_ || name.size() >= kNameSize) {
+            return nullptr;
+        }
+        auto tree = trees_.find(name);
+        if (tree == trees_.end()) {
+            TreeRecord record{};
+            std::copy(name.begin(), name.end(), record.name);
+            record.id = super_.nextTreeId++;
+            record.keySize = keySize;
+            record.valueSize = valueSize;
+            tree = trees_.emplace(name, record).first;
+        }
+        TreeRecord& record = tree->second;
+        if (record.keySize != keySize || record.valueSize != valueSize || members_.count(record.id)) {
+            return nullptr;
+        }
+        members_[record.id] = member;
+        return &record;
+    }
+
+    void detach(uint32_t id) {
+        std::lock_guard<std::mutex> members(membersMutex_);
+        members_.erase(id);
+    }
+
+    /**
+     * @brief 新しいページの番号を決める
+     * @details 空きページのうちファイルの先頭に最も近いものを使い、なければ末尾に足す。
+     *          次のコミットまでは未コミットのページとして扱う
+     * @return uint32_t 
+     */
+    uint32_t allocatePage() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return allocateLocked();
+    }
+
+    /**
+     * @brief 使わなくなったページを空きに戻す
+     * @details シャドウページングでは、コミット済みのページは次のコミットまで
+     *          直前のコミットの状態から参照されうるので、コミットの後で空きに戻す
+     * @param pageNo 
+     */
+    void releasePage(uint32_t pageNo) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        releaseLocked(pageNo);
+    }
+
+    /**
+     * @brief 前回のコミットの後に割り当てたページか (その場で書き換えてよいか)
+     * @param pageNo 
+     * @return bool 
+     */
+    bool isFresh(uint32_t pageNo) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return fresh_.count(pageNo) > 0;
+    }
+
+    uint32_t allocateLocked() {
+        uint32_t pageNo;
+        if (!freePages_.empty()) {
+            pageNo = *freePages_.begin();
+            freePages_.erase(freePages_.begin());
+        } else {
+            pageNo = super_.pageCount++;
+        }
+        fresh_.insert(pageNo);
+        return pageNo;
+    }
+
+    void releaseLocked(uint32_t pageNo) {
+        if (fresh_.erase(pageNo) || durability_ != Durability::ShadowPaging) {
+            freePages_.insert(pageNo);
+        } else {
+            pendingFree_.insert(pageNo);
+        }
+    }
+
+    /**
+     * @brief 開き直す前に状態を捨てる
+     * @param durability 
+     * @return bool 開いている木がある場合 false
+     */
+    bool reset(Durability durability) {
+        if (!members_.empty()) {
+            return false;
+        }
+        pool_.reset();
+        super_ = Superblock{};
+        trees_.clear();
+        freePages_.clear();
+        pendingFree_.clear();
+        fresh_.clear();
+        metaPages_.clear();
+        durability_ = durability;
+        superPage_ = allocateAligned(kPageSize);
+        if (!superPage_) {
+            return false;
+        }
+        std::memset(superPage_.get(), 0, kPageSize);
+        return true;
+    }
+
+    /**
+     * @brief 開いているすべての木のラッチを木の番号の順に排他で取る
+     * @return std::vector<std::unique_lock<std::shared_mutex>> 
+     */
+    std::vector<std::unique_lock<std::shared_mutex>> lockMembers() {
+        std::vector<std::unique_lock<std::shared_mutex>> latches;
+        for (auto& member : members_) {
+            latches.emplace_back(member.second->memberLatch());
+        }
+        return latches;
+    }
+
+    /**
+     * @brief スーパーブロックのチェックサム (FNV-1a)
+     * @param super 
+     * @return uint32_t 
+     */
+    static uint32_t checksum(Superblock super) {
+        super.checksum = 0;
+        const auto* bytes = reinterpret_cast<const unsigned char*>(&super);
+        uint32_t hash = 2166136261u;
+        for (size_t i = 0; i < sizeof(super); i++) {
+            hash = (hash ^ bytes[i]) * 16777619u;
+        }
+        return hash;
+    }
+
+    /**
+     * @brief コミットする
+     * @details 前回の空きページ一覧と木の一覧のページを手放し、コミット後の空きページの
+     *          一覧と木の一覧を新しいページへ書く。書き換えたページをすべて書き戻して
+     *          fsync した後、スーパーブロックを次の世代の枠へ書いて fsync する。
+     *          membersMutex_ と開いているすべての木のラッチを持って呼ぶこと
+     * @return bool 
+     */
+    bool commit() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (uint32_t pageNo : metaPages_) {
+            releaseLocked(pageNo);
+        }
+        std::set<uint32_t> free = freePages_;
+        free.insert(pendingFree_.begin(), pendingFree_.end());
+        constexpr size_t kEntries = std::size(FreeListPage{}.pages);
+        constexpr size_t kRecords = std::size(CatalogPage{}.records);
+        std::vector<uint32_t> catalogPages;
+        while (catalogPages.size() * kRecords < trees_.size()) {
+            uint32_t pageNo = allocateLocked();
+            free.erase(pageNo);
+            catalogPages.push_back(pageNo);
+        }
+        std::vector<uint32_t> listPages;
+        while (listPages.size() * kEntries < free.size()) {
+            uint32_t pageNo = allocateLocked();
+            free.erase(pageNo);
+            listPages.push_back(pageNo);
+        }
+        auto entry = free.begin();
+        for (size_t i = 0; i < listPages.size(); i++) {
+            auto page = pool_->allocate(listPages[i]);
+            if (!page) {
+                return false;
+            }
+            auto* list = reinterpret_cast<FreeListPage*>(page.data());
+            list->next = i + 1 < listPages.size() ? listPages[i + 1] : 0;
+            for (; entry != free.end() && list->count < kEntries; ++entry) {
+                list->pages[list->count++] = *entry;
+            }
+        }
+        auto tree = trees_.begin();
+        for (size_t i = 0; i < catalogPages.size(); i++) {
+            auto page = pool_->allocate(catalogPages[i]);
+            if (!page) {
+                return false;
+            }
+            auto* catalog = reinterpret_cast<CatalogPage*>(page.data());
+            catalog->next = i + 1 < catalogPages.size() ? catalogPages[i + 1] : 0;
+            for (; tree != trees_.end() && catalog->count < kRecords; ++tree) {
+                catalog->records[catalog->count++] = tree->second;
+            }
+        }
+        if (!pool_->flush() || !file_.sync()) {
+            return false;
+        }
+        super_.freeHead = listPages.empty() ? 0 : listPages[0];
+        super_.freeCount = (uint32_t)free.size();
+        super_.catalogHead = catalogPages.empty() ? 0 : catalogPages[0];
+        super_.treeCount = (uint32_t)trees_.size();
+        super_.generation++;
+        super_.checksum = checksum(super_);
+        std::memcpy(superPage_.get() + kSuperSlot * (super_.generation % 2), &super_, sizeof(super_));
+        if (!file_.writePage(0, superPage_.get()) || !file_.sync()) {
+            return false;
+        }
+        freePages_ = std::move(free);
+        pendingFree_.clear();
+        fresh_.clear();
+        metaPages_ = std::move(listPages);
+        metaPages_.insert(metaPages_.end(), catalogPages.begin(), catalogPages.end());
+        return true;
+    }
+
+    PageFile file_;
+    std::unique_ptr<BufferPool> pool_;
+    Superblock super_{};
+    Durability durability_ = Durability::InPlace;
+    // スーパーブロックのページ (2 つの枠)
+    AlignedBuffer superPage_;
+    // 木の記録 (名前順)
+    std::map<std::string, TreeRecord> trees_;
+    // 開いている木 (木の番号順)
+    std::map<uint32_t, Member*> members_;
+    // 空きページ (番号の昇順)
+    std::set<uint32_t> freePages_;
+    // 次のコミットの後で空きに戻るページ
+    std::set<uint32_t> pendingFree_;
+    // 前回のコミットの後に割り当てたページ (その場で書き換えてよい)
+    std::unordered_set<uint32_t> fresh_;
+    // コミット済みの空きページ一覧と木の一覧を置いているページ
+    std::vector<uint32_t> metaPages_;
+    // ページの割り当ての状態を保護する
+    std::mutex mutex_;
+    // trees_ と members_ を保護する。コミットとコンパクションの間は持ち続ける
+    std::mutex membersMutex_;
+};
+
+/**
+ * @brief ディスク上のノードページの読み書き
+ * @details ページは [ヘッダ, キー列, 値列 (葉) または子のページ番号列 (内部)]。
+ *          葉どうしの連結は持たない (写してから書き換えるシャドウページングでは
+ *          隣の葉を指すポインタを保てないため)。走査は親の子の並びを辿る
+ */
+template <typename Key, typename Value>
+struct NodePage {
+    static_assert(std::is_trivially_copyable_v<Key> && std::is_trivially_copyable_v<Value>,
+                  "ディスク上の木はキーと値がトリビアルにコピーできる型の場合のみ使える");
+
+    using Header = NodePageHeader;
+
+    static constexpr size_t alignUp(size_t n, size_t a) {
+        return (n + a - 1) / a * a;
+    }
+
+    static constexpr size_t kKeysOffset = alignUp(sizeof(Header), alignof(Key));
+    // 葉に入る要素数
+    static constexpr size_t kLeafCapacity =
+        (kPageSize - kKeysOffset - alignof(Value)) / (sizeof(Key) + sizeof(Value));
+    // 内部ノードに入る区切りキーの数 (子は 1 つ多い)
+    static constexpr size_t kInternalCapacity =
+        (kPageSize - kKeysOffset - alignof(uint32_t) - sizeof(uint32_t)) / (sizeof(Key) + sizeof(uint32_t));
+    static constexpr size_t kValuesOffset = alignUp(kKeysOffset + sizeof(Key) * kLeafCapacity, alignof(Value));
+    static constexpr size_t kChildrenOffset = alignUp(kKeysOffset + sizeof(Key) * kInternalCapacity, alignof(uint32_t));
+    static_assert(kLeafCapacity >= 2 && kInternalCapacity >= 2, "キーと値が 1 ページに収まらない");
+
+    static Header* header(char* page) {
+        return reinterpret_cast<Header*>(page);
+    }
+    static Key* keys(char* page) {
+        return reinterpret_cast<Key*>(page + kKeysOffset);
+    }
+    static Value* values(char* page) {
+        return reinterpret_cast<Value*>(page + kValuesOffset);
+    }
+    static uint32_t* children(char* page) {
+        return reinterpret_cast<uint32_t*>(page + kChildrenOffset);
+    }
+};
+
+/**
+ * @brief ディスク上の B+ 木
+ * @details BPlusTree の内容を build() でページファイルへ書き出し、open() で開いて
+ *          BufferPool 経由で検索・更新する。build() は葉を左から順に連続したページへ
+ *          詰めて置くので、範囲走査の先読みはファイル上の順次読み込みになる。
+ *          空になった葉や内部ノードのページは空きページとして再利用し、
+ *          compact() でファイルの前方へ詰めて末尾を切り詰める。
+ *          更新の永続化は flush() で行う。Durability::ShadowPaging で開いた場合、
+ *          コミット済みのページは上書きせず新しいページへ写してから書き換え、
+ *          flush() がスーパーブロックの書き込み 1 回で一連の更新をまとめてコミットする。
+ *          スーパーブロックはページ 0 の 2 つの枠へ交互に書くので、クラッシュ後も
+ *          open() が新しい方の有効な枠を読むだけで直前のコミットの状態に戻る。
+ *          既定では O_DIRECT でページキャッシュを通さずに読み書きする。
+ *          ファイル、バッファプールとコミットは DiskCatalog が持ち、open(catalog, name) で
+ *          1 つのファイルに複数の木を置ける。open(path) はこの木だけのカタログを開く。
+ *          木全体を 1 つの読み書きラッチで保護し、公開関数はスレッドセーフ
+ */
+template <typename Key, typename Value, typename Compare = std::less<>>
+class DiskBPlusTree : private DiskCatalog::Member {
+public:
+    using Page = NodePage<Key, Value>;
+    using Range = KeyRange<Key>;
+    using Durability = DiskCatalog::Durability;
+
+    explicit DiskBPlusTree(const Compare& comp = Compare()) : comp_(comp) {}
+
+    ~DiskBPlusTree() {
+        flush();
+        close();
+    }
+
+    /**
+     * @brief 木の内容をページファイルへ書き出す
+     * @details 葉を左からページ 1 以降へ詰めて書き、その上に内部ノードの段を
+     *          下から順に積む。ファイルは名前が空の木を 1 つだけ持つカタログになる。
+     *          tree は kBuildEntriesPerLatch 件ずつ共有ラッチを短く取って読み、
+     *          ページの書き出しはラッチの外で行うので、書き出し中も tree への
+     *          書き込みは止まらない。その代わり時点を揃えた複製ではなく、書き出し中に
+     *          書き込まれたキーは、まだ読んでいない範囲にあれば含まれる
+     * @param tree 
+     * @param path 
+     * @param direct O_DIRECT で書くか
+     * @return bool 
+     */
+    static bool build(BPlusTree<Key, Value, Compare>& tree, const std::string& path, bool direct = true) {
+        PageFile file;
+        AlignedBuffer page = allocateAligned(kPageSize);
+        if (!page || !file.open(path, true, direct)) {
+            return false;
+        }
+        // 各段のノードの (先頭キー, ページ番号)
+        std::vector<std::pair<Key, uint32_t>> level;
+        uint32_t nextPage = 1;
+        uint64_t count = 0;
+        bool ok = true;
+        std::memset(page.get(), 0, kPageSize);
+        auto flushLeaf = [&] {
+            Page::header(page.get())->isLeaf = 1;
+            Page::header(page.get())->owner = kBuildTreeId;
+            level.emplace_back(Page::keys(page.get())[0], nextPage);
+            ok = file.writePage(nextPage++, page.get()) && ok;
+            std::memset(page.get(), 0, kPageSize);
+        };
+        std::vector<std::pair<Key, Value>> chunk;
+        // 次のチャンクの先頭のキー (読み切ったら std::nullopt)
+        std::optional<Key> resume;
+        bool more = true;
+        while (more) {
+            chunk.clear();
+            more = !tree.forEachInRange(Range{resume, std::nullopt}, [&](const Key& key, const Value& value) {
+                if (chunk.size() == kBuildEntriesPerLatch) {
+                    resume = key;
+                    return false;
+                }
+                chunk.emplace_back(key, value);
+                return true;
+            });
+            for (const auto& [key, value] : chunk) {
+                auto* header = Page::header(page.get());
+                if (header->count == Page::kLeafCapacity) {
+                    flushLeaf();
+                    header = Page::header(page.get());
+                }
+                Page::keys(page.get())[header->count] = key;
+                Page::values(page.get())[header->count] = value;
+                header->count++;
+                count++;
+            }
+        }
+        if (count > 0) {
+            flushLeaf();
+        }
+
+        uint32_t height = level.empty() ? 0 : 1;
+        while (level.size() > 1) {
+            std::vector<std::pair<Key, uint32_t>> upper;
+            for (size_t begin = 0; begin < level.size();) {
+                size_t remaining = level.size() - begin;
+                size_t n = std::min(remaining, Page::kInternalCapacity + 1);
+                // 最後のノードが子 1 つだけにならないよう均す
+                if (remaining > n && remaining - n < 2) {
+                    n--;
+                }
+                std::memset(page.get(), 0, kPageSize);
+                auto* header = Page::header(page.get());
+                header->count = (uint16_t)(n - 1);
+                header->owner = kBuildTreeId;
+                for (size_t i = 0; i < n; i++) {
+                    Page::children(page.get())[i] = level[begin + i].second;
+                    if (i > 0) {
+                        Page::keys(page.get())[i - 1] = level[begin + i].first;
+                    }
+                }
+                upper.emplace_back(level[begin].first, nextPage);
+                ok = file.writePage(nextPage++, page.get()) && ok;
+                begin += n;
+            }
+            level = std::move(upper);
+            height++;
+        }
+
+        DiskCatalog::TreeRecord record{};
+        record.id = kBuildTreeId;
+        record.keySize = sizeof(Key);
+        record.valueSize = sizeof(Value);
+        record.root = level.empty() ? 0 : level[0].second;
+        record.height = height;
+        record.count = count;
+        return ok && DiskCatalog::writeNew(file, nextPage, record);
+    }
+
+    /**
+     * @brief build() で書き出したファイルを開く
+     * @details この木だけが使うカタログとして開き、名前が空の木を読み書きする
+     * @param path 
+     * @param poolPages バッファプールにキャッシュするページ数
+     * @param direct O_DIRECT で読み書きするか
+     * @param durability 更新の永続化の方式
+     * @return bool 
+     */
+    bool open(const std::string& path, size_t poolPages = 1024, bool direct = true,
+              Durability durability = Durability::InPlace) {
+        close();
+        auto catalog = std::make_unique<DiskCatalog>();
+        if (!catalog->open(path, poolPages, direct, durability) || !open(*catalog, "")) {
+            return false;
+        }
+        ownedCatalog_ = std::move(catalog);
+        return true;
+    }
+
+    /**
+     * @brief カタログの中の name の木を開く
+     * @details name の木がなければ空の木を作る (次のコミットで記録される)。
+     *          ファイルとバッファプールはカタログの他の木と共有する
+     * @param catalog 
+     * @param name 
+     * @return bool キーか値の大きさが記録と異なる場合や、既に開かれている場合 false
+     */
+    bool open(DiskCatalog& catalog, const std::string& name) {
+        close();
+        record_ = catalog.attach(name, sizeof(Key), sizeof(Value), this);
+        if (!record_) {
+            return false;
+        }
+        catalog_ = &catalog;
+        pool_ = &catalog.pool();
+        return true;
+    }
+
+    /**
+     * @brief 挿入
+     * @details 既にあるキーは値を上書きする。葉が満杯の場合は分割し、
+     *          新しいページは空きページから優先して割り当てる
+     * @param key 
+     * @param value 
+     * @return bool 
+     */
+    bool insert(const Key& key, const Value& value) {
+        std::unique_lock<std::shared_mutex> lock(latch_);
+        if (!pool_) {
+            return false;
+        }
+        if (record_->root == 0) {
+            uint32_t pageNo = catalog_->allocatePage();
+            auto page = pool_->allocate(pageNo);
+            if (!page) {
+                return false;
+            }
+            Page::header(page.data())->isLeaf = 1;
+            Page::header(page.data())->count = 1;
+            Page::header(page.data())->owner = record_->id;
+            Page::keys(page.data())[0] = key;
+            Page::values(page.data())[0] = value;
+            record_->root = pageNo;
+            record_->height = 1;
+            record_->count = 1;
+            return true;
+        }
+        std::vector<PathEntry> path;
+        auto page = findWritableLeaf(key, path);
+        if (!page) {
+            return false;
+        }
+        auto* header = Page::header(page.data());
+        Key* keys = Page::keys(page.data());
+        Value* values = Page::values(page.data());
+        size_t i = std::lower_bound(keys, keys + header->count, key, comp_) - keys;
+        if (i < header->count && !comp_(key, keys[i])) {
+            values[i] = value;
+            page.markDirty();
+            return true;
+        }
+        if (header->count == Page::kLeafCapacity) {
+            // 右半分を新しいページへ移し、挿入先の葉を選び直す
+            uint32_t rightNo = catalog_->allocatePage();
+            auto right = pool_->allocate(rightNo);
+            if (!right) {
+                return false;
+            }
+            size_t mid = header->count / 2;
+            auto* rightHeader = Page::header(right.data());
+            rightHeader->isLeaf = 1;
+            rightHeader->owner = record_->id;
+            rightHeader->count = (uint16_t)(header->count - mid);
+            std::copy(keys + mid, keys + header->count, Page::keys(right.data()));
+            std::copy(values + mid, values + header->count, Page::values(right.data()));
+            header->count = (uint16_t)mid;
+            page.markDirty();
+            Key separator = Page::keys(right.data())[0];
+            // 区切りキーより小さいキーは左に残す
+            if (i > mid) {
+                i -= mid;
+                page = std::move(right);
+                header = Page::header(page.data());
+                keys = Page::keys(page.data());
+                values = Page::values(page.data());
+            }
+            if (!insertSeparator(path, separator, rightNo)) {
+                return false;
+            }
+        }
+        std::copy_backward(keys + i, keys + header->count, keys + header->count + 1);
+        std::copy_backward(values + i, values + header->count, values + header->count + 1);
+        keys[i] = key;
+        values[i] = value;
+        header->count++;
+        page.markDirty();
+        record_->count++;
+        return true;
+    }
+
+    /**
+     * @brief 削除
+     * @details 空になった葉は親から外してページを空きに戻す。子がなくなった
+     *          内部ノードも同様に外し、子が 1 つになった根は取り除く
+     * @param key 
+     * @return bool 削除した場合 true
+     */
+    bool erase(const Key& key) {
+        std::unique_lock<std::shared_mutex> lock(latch_);
+        if (!pool_ || !searchUnlocked(key)) {
+            return false;
+        }
+        std::vector<PathEntry> path;
+        auto page = findWritableLeaf(key, path);
+        if (!page) {
+            return false;
+        }
+        auto* header = Page::header(page.data());
+        Key* keys = Page::keys(page.data());
+        Value* values = Page::values(page.data());
+        size_t i = std::lower_bound(keys, keys + header->count, key, comp_) - keys;
+        std::copy(keys + i + 1, keys + header->count, keys + i);
+        std::copy(values + i + 1, values + header->count, values + i);
+        header->count--;
+        page.markDirty();
+        record_->count--;
+        if (header->count == 0) {
+            uint32_t pageNo = page.pageNo();
+            page = BufferPool::PageRef();
+            return removeLeaf(path, pageNo);
+        }
+        return true;
+    }
+
+    /**
+     * @brief 更新を永続化する
+     * @details カタログの flush() を呼ぶので、同じカタログの他の木の更新も
+     *          まとめて永続化される。シャドウページングでは、これがコミットになる
+     * @return bool 
+     */
+    bool flush() {
+        return catalog_ && catalog_->flush();
+    }
+
+    /**
+     * @brief カタログのコンパクションを 1 段進める (DiskCatalog::compactStep())
+     * @param maxMoves 1 段で移すページ数の上限
+     * @return uint32_t 切り詰めたページ数
+     */
+    uint32_t compactStep(size_t maxMoves) {
+        return catalog_ ? catalog_->compactStep(maxMoves) : 0;
+    }
+
+    /**
+     * @brief 末尾を切り詰められなくなるまでカタログのコンパクションを進める
+     * @param maxMovesPerStep 
+     * @return uint32_t 切り詰めたページ数
+     */
+    uint32_t compact(size_t maxMovesPerStep = 64) {
+        return catalog_ ? catalog_->compact(maxMovesPerStep) : 0;
+    }
+
+    /**
+     * @brief 空きページの数
+     * @return size_t 
+     */
+    size_t freePageCount() {
+        return catalog_ ? catalog_->freePageCount() : 0;
+    }
+
+    /**
+     * @brief ファイル中のページ数 (スーパーブロックを含む)
+     * @return uint32_t 
+     */
+    uint32_t pageCount() {
+        return catalog_ ? catalog_->pageCount() : 0;
+    }
+
+    /**
+     * @brief 検索
+     * @param key 
+     * @return std::optional<Value> 
+     */
+    template <typename K>
+    std::optional<Value> search(const K& key) {
+        std::shared_lock<std::shared_mutex> lock(latch_);
+        return searchUnlocked(key);
+    }
+
+    /**
+     * @brief 範囲内の要素を昇順に visitor(key, value) へ渡す
+     * @details visitor が bool を返す場合、false を返すとそこで走査を打ち切る。
+     *          葉を kReadAheadTrigger 個続けて辿ると順次アクセスとみなし、
+     *          以降の葉のページを先読みする (ReadAhead)。葉から次の葉へは、根からの
+     *          経路上の親の子の並びを辿って移る。先読みの完了は走査するスレッドが
+     *          回収するため、visitor からこの木を読まないこと
+     * @param range 
+     * @param visitor 
+     * @return bool 最後まで走査した場合 true
+     */
+    template <typename Visitor>
+    bool forEachInRange(const Range& range, Visitor&& visitor) {
+        std::shared_lock<std::shared_mutex> lock(latch_);
+        std::vector<PathEntry> path;
+        auto page = findScanLeaf(range, path);
+        ReadAhead readAhead(*this, range, std::move(path));
+        while (page) {
+            auto* header = Page::header(page.data());
+            const Key* keys = Page::keys(page.data());
+            const Value* values = Page::values(page.data());
+            size_t i = range.lo ? std::lower_bound(keys, keys + header->count, *range.lo, comp_) - keys : 0;
+            for (; i < header->count; i++) {
+                if (range.hi && !comp_(keys[i], *range.hi)) {
+                    return true;
+                }
+                if (!invokeVisitor(visitor, keys[i], values[i])) {
+                    return false;
+                }
+            }
+            uint32_t next = readAhead.nextLeaf();
+            page = next ? readAhead.pin(next) : BufferPool::PageRef();
+        }
+        return true;
+    }
+
+    /**
+     * @brief 複数キーの一括検索
+     * @details 最大 kBatchLookups 件の検索を並行して進める。各検索はキャッシュに
+     *          あるページを辿れるところまで進み、ミスしたページの読み込みを
+     *          AsyncPageReader へまとめて投入する。完了を回収するごとに、読み込みを
+     *          待っていた検索を続きから進める。同じページを待つ検索は 1 回の読み込みを
+     *          共有する (他の検索やスレッドが読み込み中のページに当たった検索は、
+     *          待たずに脇へ置いて後で調べ直す)。複数のスレッドから同時に呼んでよい
+     * @param keys 
+     * @param count 
+     * @param values 結果の書き込み先 (count 要素以上)。見つからなかった位置は nullopt
+     * @return size_t 見つかったキーの数
      */
-    std::shared_ptr<BPlusLeafNode> findLeaf(int key) {
-        std::shared_ptr<BPlusNode> current = root_;
-        
-        while (current && !current->isLeaf_) {
-            auto internalNode = std::static_pointer_cast<BPlusInternalNode>(current);
-            int i = 0;
-            while (i < (int)internalNode->keys_.size() && key >= internalNode->keys_[i]) {
-                i++;
+    template <typename K>
+    size_t searchMany(const K* keys, size_t count, std::optional<Value>* values) {
+        std::shared_lock<std::shared_mutex> lock(latch_);
+        auto reader = acquireReader();
+        if (!reader) {
+            size_t found = 0;
+            for (size_t i = 0; i < count; i++) {
+                values[i] = searchUnlocked(keys[i]);
+                found += values[i].has_value();
             }
-            current = internalNode->childPointers_[i];
+            return found;
         }
-        
-        return std::static_pointer_cast<BPlusLeafNode>(current);
+        size_t found = 0;
+        std::vector<Lookup> lookups;
+        std::vector<AsyncPageReader::Request> requests;
+        std::vector<AsyncPageReader::Completion> done;
+        size_t window = std::min<size_t>(kBatchLookups, std::max<size_t>(pool_->capacity() / 2, 1));
+        for (size_t begin = 0; begin < count; begin += window) {
+            size_t n = std::min(window, count - begin);
+            lookups.clear();
+            lookups.resize(n);
+            size_t inflight = 0;
+            std::vector<size_t> parked;
+            auto step = [&](size_t i) {
+                Step result = advance(lookups[i], i, keys[begin + i], values[begin + i], found, requests);
+                if (result == Step::Reading) {
+                    inflight++;
+                } else if (result == Step::Parked) {
+                    parked.push_back(i);
+                }
+            };
+            for (size_t i = 0; i < n; i++) {
+                values[begin + i].reset();
+                lookups[i].page = record_->root;
+                step(i);
+            }
+            while (inflight > 0 || !parked.empty()) {
+                if (!requests.empty()) {
+                    if (!reader->submit(requests)) {
+                        for (const auto& request : requests) {
+                            done.push_back({request.tag, false});
+                        }
+                    }
+                    requests.clear();
+                }
+                if (done.empty() && inflight > 0) {
+                    reader->reap(done, 1);
+                }
+                for (const auto& completion : done) {
+                    pool_->finishLoad(lookups[completion.tag].ref, completion.ok);
+                    inflight--;
+                    step(completion.tag);
+                }
+                done.clear();
+                if (!parked.empty()) {
+                    auto waiting = std::move(parked);
+                    parked.clear();
+                    // 自分の読み込みがすべて終わってからは、他のスレッドの読み込みを待ってよい
+                    if (inflight == 0 && requests.empty()) {
+                        if (lookups[waiting.front()].ref) {
+                            pool_->waitLoaded(lookups[waiting.front()].ref);
+                        } else {
+                            std::this_thread::yield();
+                        }
+                    }
+                    for (size_t i : waiting) {
+                        step(i);
+                    }
+                }
+            }
+        }
+        releaseReader(std::move(reader));
+        return found;
     }
 
     /**
-     * @brief 葉ノードを分割し、親ノードに新たなキーを挿入する
-     * @param leaf 
+     * @brief ミスしたページの読み込みに io_uring を使っているか
+     * @return bool 
      */
-    void splitLeafNode(std::shared_ptr<BPlusLeafNode> leaf) {
-        auto newLeaf = std::make_shared<BPlusLeafNode>();
+    bool usesIoUring() {
+        auto reader = acquireReader();
+        bool uring = reader && reader->usesIoUring();
+        releaseReader(std::move(reader));
+        return uring;
+    }
 
-        int mid = (int)leaf->keys_.size() / 2;
+    uint64_t size() const {
+        return record_ ? record_->count : 0;
+    }
 
-        newLeaf->keys_.insert(newLeaf->keys_.end(),
-                             leaf->keys_.begin() + mid, leaf->keys_.end());
-        newLeaf->values_.insert(newLeaf->values_.end(),
-                               leaf->values_.begin() + mid, leaf->values_.end());
-        
-        leaf->keys_.erase(leaf->keys_.begin() + mid, leaf->keys_.end());
-        leaf->values_.erase(leaf->values_.begin() + mid, leaf->values_.end());
+    /**
+     * @brief O_DIRECT で読んでいるか
+     * @return bool 
+     */
+    bool direct() const {
+        return catalog_ && catalog_->direct();
+    }
 
-        newLeaf->next_ = leaf->next_;
-        leaf->next_ = newLeaf;
+    BufferPool& pool() {
+        return *pool_;
+    }
 
-        int newKey = newLeaf->keys_.front();
+private:
+    // build() が書き出す木の番号
+    static constexpr uint32_t kBuildTreeId = 1;
+    // build() が 1 回の共有ラッチの中で読む要素の数
+    static constexpr size_t kBuildEntriesPerLatch = 4096;
 
-        if (leaf == root_) {
-            auto newRoot_ = std::make_shared<BPlusInternalNode>();
-            newRoot_->keys_.push_back(newKey);
-            newRoot_->childPointers_.push_back(leaf);
-            newRoot_->childPointers_.push_back(newLeaf);
-            root_ = newRoot_;
+    // searchMany() が並行して進める検索の数
+    static constexpr size_t kBatchLookups = 64;
+
+    /**
+     * @brief searchMany() の検索を進めた結果
+     */
+    enum class Step {
+        // 検索が終わった
+        Done,
+        // 読み込み要求を追加した
+        Reading,
+        // 他の検索またはスレッドが読み込み中のページか、フレームの空きを待っている
+        Parked,
+    };
+
+    /**
+     * @brief searchMany() の 1 件分の途中状態
+     */
+    struct Lookup {
+        // 次に読むページ
+        uint32_t page = 0;
+        // 読み込みを待っているページ
+        BufferPool::PageRef ref;
+    };
+
+    template <typename Visitor, typename... Args>
+    static bool invokeVisitor(Visitor& visitor, Args&&... args) {
+        if constexpr (std::is_void_v<std::invoke_result_t<Visitor&, Args...>>) {
+            visitor(std::forward<Args>(args)...);
+            return true;
         } else {
-            insertInternalNode(newKey, leaf, newLeaf);
+            return static_cast<bool>(visitor(std::forward<Args>(args)...));
         }
     }
 
     /**
-     * @brief 内部ノードへの挿入処理
+     * @brief 検索をキャッシュにあるページを辿れるところまで進める
+     * @details キャッシュにないページに当たった場合は読み込み要求を requests へ
+     *          追加して戻る。読み込み中のページに当たった場合は待たずに戻る
+     * @param lookup 
+     * @param tag 
      * @param key 
-     * @param leftChild 
-     * @param rightChild 
+     * @param value 
+     * @param found 
+     * @param requests 
+     * @return Step 
      */
-    void insertInternalNode(int key, 
-                            std::shared_ptr<BPlusLeafNode> leftChild,
-                            std::shared_ptr<BPlusLeafNode> rightChild) {
-        auto parent = findParent(root_, leftChild);
-        if (!parent) {
-            return;
+    template <typename K>
+    Step advance(Lookup& lookup, uint64_t tag, const K& key, std::optional<Value>& value,
+                   size_t& found, std::vector<AsyncPageReader::Request>& requests) {
+        while (lookup.page != 0) {
+            if (!lookup.ref) {
+                bool mustRead = false;
+                lookup.ref = pool_->pinAsync(lookup.page, mustRead);
+                if (!lookup.ref) {
+                    // 全フレームがピン留め中。フレームが空くのを待つ
+                    return Step::Parked;
+                }
+                if (mustRead) {
+                    requests.push_back({lookup.page, lookup.ref.data(), tag});
+                    return Step::Reading;
+                }
+            }
+            auto loaded = pool_->loadResult(lookup.ref);
+            if (!loaded) {
+                return Step::Parked;
+            }
+            if (!*loaded) {
+                lookup.ref = BufferPool::PageRef();
+                return Step::Done;
+            }
+            char* page = lookup.ref.data();
+            auto* header = Page::header(page);
+            const Key* keys = Page::keys(page);
+            if (header->isLeaf) {
+                const Key* it = std::lower_bound(keys, keys + header->count, key, comp_);
+                if (it != keys + header->count && !comp_(key, *it)) {
+                    value = Page::values(page)[it - keys];
+                    found++;
+                }
+                lookup.page = 0;
+            } else {
+                lookup.page = Page::children(page)[std::upper_bound(keys, keys + header->count, key, comp_) - keys];
+            }
+            lookup.ref = BufferPool::PageRef();
         }
-        auto internalParent = std::static_pointer_cast<BPlusInternalNode>(parent);
-        int idx = 0;
-        while (idx < (int)internalParent->childPointers_.size() 
-               && internalParent->childPointers_[idx] != leftChild) {
-            idx++;
+        return Step::Done;
+    }
+
+    /**
+     * @brief 使われていない AsyncPageReader を取り出す (なければ作る)
+     * @return std::unique_ptr<AsyncPageReader> 
+     */
+    std::unique_ptr<AsyncPageReader> acquireReader() {
+        std::lock_guard<std::mutex> lock(readersMutex_);
+        if (!catalog_ || !catalog_->file_.isOpen()) {
+            return nullptr;
         }
-        internalParent->keys_.insert(internalParent->keys_.begin() + idx, key);
-        internalParent->childPointers_.insert(internalParent->childPointers_.begin() + idx + 1, rightChild);
+        if (idleReaders_.empty()) {
+            return AsyncPageReader::create(catalog_->file_.fd(), (unsigned)kBatchLookups);
+        }
+        auto reader = std::move(idleReaders_.back());
+        idleReaders_.pop_back();
+        return reader;
+    }
 
-        if ((int)internalParent->keys_.size() >= kOrder) {
-            splitInternalNode(internalParent);
+    void releaseReader(std::unique_ptr<AsyncPageReader> reader) {
+        if (reader) {
+            std::lock_guard<std::mutex> lock(readersMutex_);
+            idleReaders_.push_back(std::move(reader));
         }
     }
 
+    // 範囲走査が先読みを始めるまでに辿る葉の数
+    static constexpr size_t kReadAheadTrigger = 2;
+    // 先読みの最初の葉の数 (以降、倍々に増やす)
+    static constexpr size_t kReadAheadInitial = 4;
+    // 先読みする葉の数の上限
+    static constexpr size_t kReadAheadMax = 32;
+
     /**
-     * @brief 内部ノードを分割し、親へ再帰的に昇格させる
-     * @param internalNode 
+     * @brief 根から葉の親までの経路の 1 段
      */
-    void splitInternalNode(std::shared_ptr<BPlusInternalNode> internalNode) {
-        auto newInternal = std::make_shared<BPlusInternalNode>();
-    
-        int midIndex = (int)internalNode->keys_.size() / 2;
-        int upKey = internalNode->keys_[midIndex];
+    struct PathEntry {
+        uint32_t page;
+        // 辿った子の位置
+        uint32_t child;
+    };
 
-        newInternal->keys_.insert(newInternal->keys_.end(),
-                                 internalNode->keys_.begin() + midIndex + 1, 
-                                 internalNode->keys_.end());
-        internalNode->keys_.erase(internalNode->keys_.begin() + midIndex, 
-                                 internalNode->keys_.end());
+    /**
+     * @brief 範囲走査の先読み
+     * @details 走査した葉が kReadAheadTrigger 個に達すると、経路上の親ノードの子の
+     *          並びから次の葉のページ番号を求め、AsyncPageReader でまとめて読み込みを
+     *          投入する。親の子を使い切ったら経路を 1 段上がって隣の親へ移る。
+     *          区切りキーが範囲の上限以上になる葉は読まない。先読みする葉の数は
+     *          kReadAheadInitial から kReadAheadMax まで倍々に増やし、走査が先読み
+     *          済みの半分を過ぎるたびに次を投入する。走査の位置も同じ方法で経路を
+     *          進めて求め、先読み中のページに当たった場合はその完了を回収してから使う
+     */
+    class ReadAhead {
+    public:
+        ReadAhead(DiskBPlusTree& tree, const Range& range, std::vector<PathEntry> path)
+            : tree_(tree), range_(range), cursor_(path), path_(std::move(path)), window_(kReadAheadInitial) {}
 
-        newInternal->childPointers_.insert(newInternal->childPointers_.end(),
-                                          internalNode->childPointers_.begin() + midIndex + 1,
-                                          internalNode->childPointers_.end());
-        internalNode->childPointers_.erase(internalNode->childPointers_.begin() + midIndex + 1,
-                                          internalNode->childPointers_.end());
+        ~ReadAhead() {
+            while (!pending_.empty()) {
+                reapOne();
+            }
+            tree_.releaseReader(std::move(reader_));
+        }
 
-        if (internalNode == root_) {
-            auto newRoot_ = std::make_shared<BPlusInternalNode>();
-            newRoot_->keys_.push_back(upKey);
-            newRoot_->childPointers_.push_back(internalNode);
-            newRoot_->childPointers_.push_back(newInternal);
-            root_ = newRoot_;
-        } else {
-            insertInternalUpKey(upKey, internalNode, newInternal);
+        /**
+         * @brief 走査の位置を次の葉へ進める
+         * @return uint32_t 次の葉のページ番号。範囲の終わりか木の終わりに達した場合 0
+         */
+        uint32_t nextLeaf() {
+            return advance(cursor_);
+        }
+
+        /**
+         * @brief 走査が次に使う葉のページをピン留めする
+         * @param pageNo 
+         * @return BufferPool::PageRef 
+         */
+        BufferPool::PageRef pin(uint32_t pageNo) {
+            visited_++;
+            while (!issued_.empty() && issued_.front() != pageNo) {
+                issued_.erase(issued_.begin());
+            }
+            if (!issued_.empty()) {
+                issued_.erase(issued_.begin());
+            }
+            if (visited_ >= kReadAheadTrigger && issued_.size() <= window_ / 2 && !exhausted_) {
+                issue();
+            }
+            return pinPage(pageNo);
+        }
+
+    private:
+        /**
+         * @brief 次の葉の読み込みを投入する
+         */
+        void issue() {
+            if (!reader_) {
+                reader_ = tree_.acquireReader();
+                if (!reader_) {
+                    exhausted_ = true;
+                    return;
+                }
+            }
+            size_t limit = std::min(window_, std::max<size_t>(tree_.pool_->capacity() / 4, 1));
+            std::vector<AsyncPageReader::Request> requests;
+            while (issued_.size() < limit) {
+                uint32_t pageNo = advance(path_);
+                if (pageNo == 0) {
+                    exhausted_ = true;
+                    break;
+                }
+                issued_.push_back(pageNo);
+                bool mustRead = false;
+                auto page = tree_.pool_->pinAsync(pageNo, mustRead);
+                if (!page) {
+                    break;
+                }
+                if (mustRead) {
+                    requests.push_back({pageNo, page.data(), nextTag_});
+                    pendingPages_.emplace(pageNo, nextTag_);
+                    pending_.emplace(nextTag_++, std::move(page));
+                }
+            }
+            if (!requests.empty() && !reader_->submit(requests)) {
+                for (const auto& request : requests) {
+                    finish(request.tag, false);
+                }
+            }
+            window_ = std::min(window_ * 2, kReadAheadMax);
+        }
+
+        /**
+         * @brief 経路を次の葉へ進め、そのページ番号を返す
+         * @param path 根から葉の親までの経路
+         * @return uint32_t 範囲の終わりか木の終わりに達した場合 0
+         */
+        uint32_t advance(std::vector<PathEntry>& path) {
+            size_t level = path.size();
+            uint32_t child = 0;
+            while (level > 0) {
+                PathEntry& entry = path[level - 1];
+                auto page = pinPage(entry.page);
+                if (!page) {
+                    return 0;
+                }
+                auto* header = Page::header(page.data());
+                if (entry.child < header->count) {
+                    const Key& fence = Page::keys(page.data())[entry.child];
+                    if (range_.hi && !tree_.comp_(fence, *range_.hi)) {
+                        return 0;
+                    }
+                    entry.child++;
+                    child = Page::children(page.data())[entry.child];
+                    break;
+                }
+                level--;
+            }
+            if (level == 0) {
+                return 0;
+            }
+            path.resize(level);
+            // 葉の親の段まで左端を降りる
+            while (path.size() + 1 < tree_.record_->height) {
+                auto page = pinPage(child);
+                if (!page) {
+                    return 0;
+                }
+                path.push_back({child, 0});
+                child = Page::children(page.data())[0];
+            }
+            return child;
+        }
+
+        /**
+         * @brief ページをピン留めする
+         * @details 読み込み中のページは、自分の先読みが残っている間はその完了を
+         *          回収しながら待つ。自分の先読みを残したまま他のスレッドの読み込みを
+         *          待つと、互いの先読みを待ち合うことがあるため
+         * @param pageNo 
+         * @return BufferPool::PageRef 
+         */
+        BufferPool::PageRef pinPage(uint32_t pageNo) {
+            bool mustRead = false;
+            auto page = tree_.pool_->pinAsync(pageNo, mustRead);
+            while (!page) {
+                // 全フレームがピン留め中
+                if (pending_.empty()) {
+                    return BufferPool::PageRef();
+                }
+                reapOne();
+                page = tree_.pool_->pinAsync(pageNo, mustRead);
+            }
+            if (mustRead) {
+                tree_.pool_->finishLoad(page, tree_.catalog_->file_.readPage(pageNo, page.data()));
+            }
+            while (true) {
+                auto loaded = tree_.pool_->loadResult(page);
+                if (loaded) {
+                    return *loaded ? std::move(page) : BufferPool::PageRef();
+                }
+                if (pending_.empty()) {
+                    tree_.pool_->waitLoaded(page);
+                } else {
+                    reapOne();
+                }
+            }
+        }
+
+        void reapOne() {
+            std::vector<AsyncPageReader::Completion> done;
+            reader_->reap(done, 1);
+            for (const auto& completion : done) {
+                finish(completion.tag, completion.ok);
+            }
+        }
+
+        void finish(uint64_t tag, bool ok) {
+            auto found = pending_.find(tag);
+            tree_.pool_->finishLoad(found->second, ok);
+            pendingPages_.erase(found->second.pageNo());
+            pending_.erase(found);
+        }
+
+        DiskBPlusTree& tree_;
+        const Range& range_;
+        // 走査している葉までの経路
+        std::vector<PathEntry> cursor_;
+        // 最後に先読みした葉までの経路
+        std::vector<PathEntry> path_;
+        std::unique_ptr<AsyncPageReader> reader_;
+        // 先読みを投入したがまだ走査が使っていない葉
+        std::vector<uint32_t> issued_;
+        // 読み込み中の先読み (タグ→ページ)
+        std::unordered_map<uint64_t, BufferPool::PageRef> pending_;
+        std::unordered_map<uint32_t, uint64_t> pendingPages_;
+        uint64_t nextTag_ = 0;
+        size_t window_;
+        size_t visited_ = 1;
+        bool exhausted_ = false;
+    };
+
+    /**
+     * @brief 範囲走査の最初の葉のページを探し、根から葉の親までの経路を path へ入れる
+     * @param range 
+     * @param path 
+     * @return BufferPool::PageRef 
+     */
+    BufferPool::PageRef findScanLeaf(const Range& range, std::vector<PathEntry>& path) {
+        if (!pool_ || record_->root == 0) {
+            return BufferPool::PageRef();
+        }
+        auto page = pool_->pin(record_->root);
+        uint32_t pageNo = record_->root;
+        while (page && !Page::header(page.data())->isLeaf) {
+            auto* header = Page::header(page.data());
+            const Key* keys = Page::keys(page.data());
+            size_t i = range.lo ? std::upper_bound(keys, keys + header->count, *range.lo, comp_) - keys : 0;
+            path.push_back({pageNo, (uint32_t)i});
+            pageNo = Page::children(page.data())[i];
+            page = pool_->pin(pageNo);
         }
+        return page;
     }
 
     /**
-     * @brief 分割による昇格キーを親ノードに挿入
+     * @brief 検索の本体
      * @param key 
-     * @param leftChild 
-     * @param rightChild 
+     * @return std::optional<Value> 
      */
-    void insertInternalUpKey(int key,
-                             std::shared_ptr<BPlusInternalNode> leftChild,
-                             std::shared_ptr<BPlusInternalNode> rightChild) {
-        auto parent = findParent(root_, leftChild);
-        if (!parent) return;
-
-        auto internalParent = std::static_pointer_cast<BPlusInternalNode>(parent);
-
-        int idx = 0;
-        while (idx < (int)internalParent->childPointers_.size()
-               && internalParent->childPointers_[idx] != leftChild) {
-            idx++;
+    template <typename K>
+    std::optional<Value> searchUnlocked(const K& key) {
+        auto page = findLeaf(key);
+        if (!page) {
+            return std::nullopt;
         }
+        auto* header = Page::header(page.data());
+        const Key* keys = Page::keys(page.data());
+        const Key* it = std::lower_bound(keys, keys + header->count, key, comp_);
+        if (it == keys + header->count || comp_(key, *it)) {
+            return std::nullopt;
+        }
+        return Page::values(page.data())[it - keys];
+    }
 
-        internalParent->keys_.insert(internalParent->keys_.begin() + idx, key);
-        internalParent->childPointers_.insert(internalParent->childPointers_.begin() + idx + 1, rightChild);
-        if ((int)internalParent->keys_.size() >= kOrder) {
-            splitInternalNode(internalParent);
+    /**
+     * @brief 葉のページを探し、根から葉の親までの経路を path へ入れる
+     * @param key 
+     * @param path 
+     * @return BufferPool::PageRef 
+     */
+    BufferPool::PageRef findLeafPath(const Key& key, std::vector<PathEntry>& path) {
+        uint32_t pageNo = record_->root;
+        auto page = pool_->pin(pageNo);
+        while (page && !Page::header(page.data())->isLeaf) {
+            auto* header = Page::header(page.data());
+            const Key* keys = Page::keys(page.data());
+            size_t i = std::upper_bound(keys, keys + header->count, key, comp_) - keys;
+            path.push_back({pageNo, (uint32_t)i});
+            pageNo = Page::children(page.data())[i];
+            page = pool_->pin(pageNo);
         }
+        return page;
     }
 
     /**
-     * @brief 親ノードを探す関数
-     * @param current 
-     * @param child 
-     * @return std::shared_ptr<BPlusNode> 
+     * @brief 書き換える葉のページを探し、根から葉の親までの経路を path へ入れる
+     * @details シャドウページングでは経路上のページを書き換えられるようにしておく
+     * @param key 
+     * @param path 
+     * @return BufferPool::PageRef 
      */
-    std::shared_ptr<BPlusNode> findParent(std::shared_ptr<BPlusNode> current,
-                                                    std::shared_ptr<BPlusNode> child)
-    {
-        if (!current || current->isLeaf_) {
-            return nullptr;
+    BufferPool::PageRef findWritableLeaf(const Key& key, std::vector<PathEntry>& path) {
+        auto page = findLeafPath(key, path);
+        if (!page || catalog_->durability() != Durability::ShadowPaging) {
+            return page;
         }
-        auto internalNode = std::static_pointer_cast<BPlusInternalNode>(current);
+        uint32_t pageNo = page.pageNo();
+        page = BufferPool::PageRef();
+        pageNo = makeWritable(path, pageNo);
+        return pageNo ? pool_->pin(pageNo) : BufferPool::PageRef();
+    }
 
-        for (auto ptr : internalNode->childPointers_) {
-            if (ptr == child) {
-                return current;
+    /**
+     * @brief シャドウページングで、経路上のコミット済みのページを新しいページへ写す
+     * @details 根から順に、コミット済みのページを新しいページへ写して親の子ポインタ
+     *          (根なら record_->root) を付け替える。写し元のページは次のコミットの後で
+     *          空きに戻る。上書き更新では何もしない
+     * @param path 根から node の親までの経路。ページ番号を写し先に置き換える
+     * @param node 
+     * @return uint32_t node の写し先 (失敗した場合 0)
+     */
+    uint32_t makeWritable(std::vector<PathEntry>& path, uint32_t node) {
+        if (catalog_->durability() != Durability::ShadowPaging) {
+            return node;
+        }
+        for (size_t level = 0; level <= path.size(); level++) {
+            uint32_t& pageNo = level < path.size() ? path[level].page : node;
+            if (catalog_->isFresh(pageNo)) {
+                continue;
             }
-            if (!ptr->isLeaf_) {
-                auto candidate = findParent(ptr, child);
-                if (candidate) {
-                    return candidate;
+            uint32_t copyNo = catalog_->allocatePage();
+            auto source = pool_->pin(pageNo);
+            auto copy = pool_->allocate(copyNo);
+            if (!source || !copy) {
+                return 0;
+            }
+            std::memcpy(copy.data(), source.data(), kPageSize);
+            catalog_->releasePage(pageNo);
+            if (level == 0) {
+                record_->root = copyNo;
+            } else {
+                auto parent = pool_->pin(path[level - 1].page);
+                if (!parent) {
+                    return 0;
                 }
+                Page::children(parent.data())[path[level - 1].child] = copyNo;
+                parent.markDirty();
             }
+            pageNo = copyNo;
         }
-        return nullptr;
+        return node;
     }
 
-public:
-    BPlusTree() : root_(nullptr) {}
+    /**
+     * @brief 内部ノードの内容
+     */
+    struct InternalContents {
+        std::vector<Key> keys;
+        std::vector<uint32_t> children;
+    };
+
+    static InternalContents readInternal(char* page) {
+        auto* header = Page::header(page);
+        const Key* keys = Page::keys(page);
+        const uint32_t* children = Page::children(page);
+        return {std::vector<Key>(keys, keys + header->count),
+                std::vector<uint32_t>(children, children + header->count + 1)};
+    }
+
+    void writeInternal(char* page, const Key* keys, const uint32_t* children, size_t count) {
+        std::memset(page, 0, kPageSize);
+        Page::header(page)->count = (uint16_t)count;
+        Page::header(page)->owner = record_->id;
+        std::copy(keys, keys + count, Page::keys(page));
+        std::copy(children, children + count + 1, Page::children(page));
+    }
 
     /**
-     * @brief キーの検索
-     * @param key 
-     * @return std::optional<int> 
-     * @retval キーに対応する値
-     * @retval キーが見つからない場合は std::nullopt
+     * @brief 分割でできた右のノードを、区切りキーとともに親へ挿入する
+     * @details 親が満杯になった場合は親も分割し、中央のキーをさらに上へ送る。
+     *          根が分割された場合は新しい根を作る
+     * @param path 根から分割したノードの親までの経路
+     * @param separator 
+     * @param rightNo 
+     * @return bool 
      */
-    std::optional<int> search(int key) {
-        if (!root_) {
-            return std::nullopt;
+    bool insertSeparator(std::vector<PathEntry> path, Key separator, uint32_t rightNo) {
+        while (!path.empty()) {
+            PathEntry entry = path.back();
+            path.pop_back();
+            auto page = pool_->pin(entry.page);
+            if (!page) {
+                return false;
+            }
+            auto node = readInternal(page.data());
+            node.keys.insert(node.keys.begin() + entry.child, separator);
+            node.children.insert(node.children.begin() + entry.child + 1, rightNo);
+            if (node.keys.size() <= Page::kInternalCapacity) {
+                writeInternal(page.data(), node.keys.data(), node.children.data(), node.keys.size());
+                page.markDirty();
+                return true;
+            }
+            size_t mid = node.keys.size() / 2;
+            rightNo = catalog_->allocatePage();
+            auto right = pool_->allocate(rightNo);
+            if (!right) {
+                return false;
+            }
+            writeInternal(page.data(), node.keys.data(), node.children.data(), mid);
+            writeInternal(right.data(), node.keys.data() + mid + 1, node.children.data() + mid + 1,
+                          node.keys.size() - mid - 1);
+            page.markDirty();
+            separator = node.keys[mid];
         }
-        auto leaf = findLeaf(key);
-        if (!leaf) {
-            return std::nullopt;
+        uint32_t rootNo = catalog_->allocatePage();
+        auto root = pool_->allocate(rootNo);
+        if (!root) {
+            return false;
+        }
+        uint32_t children[2] = {record_->root, rightNo};
+        writeInternal(root.data(), &separator, children, 1);
+        record_->root = rootNo;
+        record_->height++;
+        return true;
+    }
+
+    /**
+     * @brief 空になった葉を木から外し、ページを空きに戻す
+     * @param path 根から葉の親までの経路 (書き換えられるようにしてあること)
+     * @param pageNo 
+     * @return bool 
+     */
+    bool removeLeaf(std::vector<PathEntry> path, uint32_t pageNo) {
+        catalog_->releasePage(pageNo);
+        // 親から子を外す。子がなくなった親はさらに上から外す
+        while (!path.empty()) {
+            PathEntry entry = path.back();
+            path.pop_back();
+            auto page = pool_->pin(entry.page);
+            if (!page) {
+                return false;
+            }
+            auto node = readInternal(page.data());
+            node.children.erase(node.children.begin() + entry.child);
+            if (!node.keys.empty()) {
+                node.keys.erase(node.keys.begin() + (entry.child > 0 ? entry.child - 1 : 0));
+            }
+            if (!node.children.empty()) {
+                writeInternal(page.data(), node.keys.data(), node.children.data(), node.keys.size());
+                page.markDirty();
+                break;
+            }
+            catalog_->releasePage(entry.page);
         }
-        for (size_t i = 0; i < leaf->keys_.size(); i++) {
-            if (leaf->keys_[i] == key) {
-                return leaf->values_[i];
+        if (path.empty() && record_->count == 0) {
+            record_->root = 0;
+            record_->height = 0;
+            return true;
+        }
+        // 子が 1 つだけの根は取り除く
+        while (record_->height > 1) {
+            auto root = pool_->pin(record_->root);
+            if (!root) {
+                return false;
+            }
+            if (Page::header(root.data())->count > 0) {
+                break;
             }
+            catalog_->releasePage(record_->root);
+            record_->root = Page::children(root.data())[0];
+            record_->height--;
         }
-        return std::nullopt;
+        return true;
     }
 
     /**
-     * @brief キーの挿入
-     * @param key 
-     * @param value 
+     * @brief 使用中のページを空きページへ移し、指している子ポインタを付け替える
+     * @details DiskCatalog のコンパクションから、ラッチを排他で取った状態で呼ばれる。
+     *          シャドウページングでは、付け替える親までの経路も写してから書き換える
+     * @param from 
+     * @param to catalog_->allocatePage() で得たページ
+     * @return bool 
      */
-    
-    void insert(int key, int value) {
-        if (!root_) {
-            auto leaf = std::make_shared<BPlusLeafNode>();
-            leaf->keys_.push_back(key);
-            leaf->values_.push_back(value);
-            root_ = leaf;
-            return;
+    bool relocate(uint32_t from, uint32_t to) override {
+        {
+            auto source = pool_->pin(from);
+            auto target = pool_->allocate(to);
+            if (!source || !target) {
+                return false;
+            }
+            std::memcpy(target.data(), source.data(), kPageSize);
         }
+        if (from == record_->root) {
+            record_->root = to;
+            return true;
+        }
+        // ページが担当する範囲の先頭のキーで根から降りると、このページを通る
+        auto page = pool_->pin(to);
+        while (page && !Page::header(page.data())->isLeaf) {
+            page = pool_->pin(Page::children(page.data())[0]);
+        }
+        if (!page) {
+            return false;
+        }
+        Key key = Page::keys(page.data())[0];
 
-        auto leaf = findLeaf(key);
-        for (size_t i = 0; i < leaf->keys_.size(); i++) {
-            if (leaf->keys_[i] == key) {
-                leaf->values_[i] = value;
-                return;
+        std::vector<PathEntry> path;
+        for (uint32_t pageNo = record_->root; pageNo != from;) {
+            page = pool_->pin(pageNo);
+            if (!page || Page::header(page.data())->isLeaf) {
+                return false;
             }
+            auto* header = Page::header(page.data());
+            const Key* keys = Page::keys(page.data());
+            size_t i = std::upper_bound(keys, keys + header->count, key, comp_) - keys;
+            path.push_back({pageNo, (uint32_t)i});
+            pageNo = Page::children(page.data())[i];
         }
+        page = BufferPool::PageRef();
+        PathEntry parent = path.back();
+        path.pop_back();
+        parent.page = makeWritable(path, parent.page);
+        page = pool_->pin(parent.page);
+        if (!parent.page || !page) {
+            return false;
+        }
+        Page::children(page.data())[parent.child] = to;
+        page.markDirty();
+        return true;
+    }
 
-        leaf->keys_.push_back(key);
-        leaf->values_.push_back(value);
-
-        for (int i = (int)leaf->keys_.size() - 1; i > 0; i--) {
-            if (leaf->keys_[i] < leaf->keys_[i - 1]) {
-                std::swap(leaf->keys_[i], leaf->keys_[i - 1]);
-                std::swap(leaf->values_[i], leaf->values_[i - 1]);
-            } else {
-                break;
-            }
+    /**
+     * @brief key を含む葉のページを探す
+     * @param key 
+     * @return BufferPool::PageRef 
+     */
+    template <typename K>
+    BufferPool::PageRef findLeaf(const K& key) {
+        if (!pool_ || record_->root == 0) {
+            return BufferPool::PageRef();
         }
+        auto page = pool_->pin(record_->root);
+        while (page && !Page::header(page.data())->isLeaf) {
+            auto* header = Page::header(page.data());
+            const Key* keys = Page::keys(page.data());
+            size_t i = std::upper_bound(keys, keys + header->count, key, comp_) - keys;
+            page = pool_->pin(Page::children(page.data())[i]);
+        }
+        return page;
+    }
 
-        if ((int)leaf->keys_.size() >= kOrder) {
-            splitLeafNode(leaf);
+    /**
+     * @brief カタログから外す
+     */
+    void close() {
+        if (catalog_) {
+            catalog_->detach(record_->id);
         }
+        {
+            std::lock_guard<std::mutex> lock(readersMutex_);
+            idleReaders_.clear();
+        }
+        catalog_ = nullptr;
+        pool_ = nullptr;
+        record_ = nullptr;
+        ownedCatalog_.reset();
+    }
+
+    std::shared_mutex& memberLatch() override {
+        return latch_;
     }
+
+    Compare comp_;
+    DiskCatalog* catalog_ = nullptr;
+    // open(path) で開いた場合の、この木だけのカタログ
+    std::unique_ptr<DiskCatalog> ownedCatalog_;
+    // カタログにある、この木の根・高さ・要素数
+    DiskCatalog::TreeRecord* record_ = nullptr;
+    BufferPool* pool_ = nullptr;
+    // 木全体のラッチ。読み取りは共有、更新は排他で取る
+    mutable std::shared_mutex latch_;
+    // searchMany() を呼んでいないスレッドの AsyncPageReader
+    std::vector<std::unique_ptr<AsyncPageReader>> idleReaders_;
+    std::mutex readersMutex_;
 };
 } // namespace BPlussTree
 
+// tests/ と bench/ はこのファイルを取り込むので、デモの main() を外せるようにする
+#ifndef BPLUSTREE_NO_MAIN
 int main() {
-    BPlusTree::BPlusTree tree;
+    BPlusTree::BPlusTree<> tree;
 
     // 挿入テスト
     tree.insert(10, 100);
@@ -318,3 +6536,4 @@ int main() {
     
     return 0;
 }
+#endif // BPLUSTREE_NO_MAIN
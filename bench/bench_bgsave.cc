@@ -0,0 +1,49 @@
+/**
+ * @file bench_bgsave.cc
+ * @brief bgsave() が親を止める時間 (fork の時間) と、保存中の書き込みの遅延
+ * @details g++ -std=c++17 -O2 -pthread bench/bench_bgsave.cc && ./a.out [要素数] [ファイル]
+ */
+#define BPLUSTREE_NO_MAIN
+#include "../b_pluss_tree.cc"
+#include "timer.h"
+
+#include <cstdlib>
+#include <thread>
+
+int main(int argc, char** argv) {
+    const int n = argc > 1 ? std::atoi(argv[1]) : 40000;
+    const std::string path = argc > 2 ? argv[2] : "bench_bgsave.bak";
+    BPlusTree::BPlusTree<int, int> tree;
+    for (int i = 0; i < n; i++) {
+        tree.insert(i * 2, i);
+    }
+
+    std::atomic<bool> stop{false};
+    std::atomic<bool> saving{false};
+    double worstBefore = 0;
+    double worstDuring = 0;
+    std::thread writer([&] {
+        for (int k = 0; !stop; k++) {
+            bool during = saving;
+            double seconds = measureSeconds([&] { tree.insert(n * 2 + k, k); });
+            double& worst = during ? worstDuring : worstBefore;
+            worst = std::max(worst, seconds);
+        }
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+    saving = true;
+    std::future<std::optional<uint64_t>> result;
+    double forkSeconds = measureSeconds([&] { result = tree.bgsave(path); });
+    double totalSeconds = forkSeconds + measureSeconds([&] { result.get(); });
+    saving = false;
+    stop = true;
+    writer.join();
+
+    std::printf("%d entries: bgsave() returned in %.2f ms, child finished after %.1f ms\n",
+                n, forkSeconds * 1e3, totalSeconds * 1e3);
+    std::printf("  worst insert latency: %.1f us before, %.1f us during the save\n",
+                worstBefore * 1e6, worstDuring * 1e6);
+    std::remove(path.c_str());
+    return 0;
+}
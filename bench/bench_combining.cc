@@ -0,0 +1,58 @@
+/**
+ * @file bench_combining.cc
+ * @brief ラッチを取り合う更新と、組み合わせ (flat combining) による更新の比較
+ * @details 8 スレッドが 9 割挿入・1 割削除を行う。キーを 16 個の熱いキーから選ぶ場合と
+ *          10000 キーから選ぶ場合を測る。
+ *          g++ -std=c++17 -O2 -pthread bench/bench_combining.cc && ./a.out
+ */
+#define BPLUSTREE_NO_MAIN
+#include "../b_pluss_tree.cc"
+#include "timer.h"
+
+#include <random>
+#include <thread>
+
+using Tree = BPlusTree::BPlusTree<int, int>;
+
+int main() {
+    const int threads = 8;
+    const int perThread = 20000;
+    for (int keys : {16, 10000}) {
+        for (bool combining : {false, true}) {
+            Tree tree;
+            for (int i = 0; i < keys; i++) {
+                tree.insert(i, 0);
+            }
+            double seconds = measureSeconds([&] {
+                std::vector<std::thread> workers;
+                for (int t = 0; t < threads; t++) {
+                    workers.emplace_back([&, t] {
+                        std::mt19937 rng(t);
+                        for (int i = 0; i < perThread; i++) {
+                            int key = rng() % keys;
+                            bool erase = rng() % 10 == 0;
+                            if (combining) {
+                                erase ? tree.eraseCombining(key) : tree.insertCombining(key, i);
+                            } else if (erase) {
+                                tree.erase(key);
+                            } else {
+                                tree.insert(key, i);
+                            }
+                        }
+                    });
+                }
+                for (auto& worker : workers) {
+                    worker.join();
+                }
+            });
+            std::printf("%5d keys, %-9s: %4.0fk ops/s", keys, combining ? "combining" : "latching",
+                        threads * perThread / seconds / 1000);
+            if (combining) {
+                auto [passes, ops] = tree.combiningStats();
+                std::printf(" (%.2f ops per pass)", static_cast<double>(ops) / passes);
+            }
+            std::printf("\n");
+        }
+    }
+    return 0;
+}
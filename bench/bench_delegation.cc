@@ -0,0 +1,47 @@
+/**
+ * @file bench_delegation.cc
+ * @brief 4 シャードの DelegatedTree への挿入と、1 本の木への直接の挿入の比較
+ * @details 0 から 19999 までを昇順とかき混ぜた順で挿入する。DelegatedTree は
+ *          結果の future を最後にまとめて待つ。
+ *          g++ -std=c++17 -O2 -pthread bench/bench_delegation.cc && ./a.out
+ */
+#define BPLUSTREE_NO_MAIN
+#include "../b_pluss_tree.cc"
+#include "timer.h"
+
+#include <algorithm>
+#include <numeric>
+#include <random>
+
+int main() {
+    const int n = 20000;
+    std::vector<int> keys(n);
+    std::iota(keys.begin(), keys.end(), 0);
+    for (bool shuffled : {false, true}) {
+        if (shuffled) {
+            std::shuffle(keys.begin(), keys.end(), std::mt19937(1));
+        }
+        const char* order = shuffled ? "shuffled" : "ascending";
+        double direct = measureSeconds([&] {
+            BPlusTree::BPlusTree<int, int> tree;
+            for (int key : keys) {
+                tree.insert(key, key);
+            }
+        });
+        std::printf("%-9s, direct, 1 tree    : %.2fs\n", order, direct);
+
+        double delegated = measureSeconds([&] {
+            BPlusTree::DelegatedTree<int, int> tree({n / 4, n / 2, n / 4 * 3});
+            std::vector<std::future<std::optional<int>>> results;
+            results.reserve(n);
+            for (int key : keys) {
+                results.push_back(tree.exchange(key, key));
+            }
+            for (auto& result : results) {
+                result.get();
+            }
+        });
+        std::printf("%-9s, delegated, 4 shards: %.2fs\n", order, delegated);
+    }
+    return 0;
+}
@@ -0,0 +1,53 @@
+/**
+ * @file bench_dictionary_encoding.cc
+ * @brief 辞書符号化の前後で、キーのメモリ使用量と search() の速さを比べる
+ * @details キーは tenant/device_N/metric の形で 18000 個。
+ *          g++ -std=c++17 -O2 -pthread bench/bench_dictionary_encoding.cc && ./a.out
+ */
+#define BPLUSTREE_NO_MAIN
+#include "../b_pluss_tree.cc"
+#include "timer.h"
+
+#include <random>
+#include <string>
+#include <string_view>
+
+int main() {
+    BPlusTree::BPlusTree<std::string, int> tree;
+    std::vector<std::string> keys;
+    const char* tenants[] = {"tenant_alpha", "tenant_beta", "tenant_gamma"};
+    const char* metrics[] = {"cpu_utilization", "memory_resident", "network_rx_bytes"};
+    for (int device = 0; device < 2000; device++) {
+        for (auto tenant : tenants) {
+            for (auto metric : metrics) {
+                keys.push_back(std::string(tenant) + "/device_" + std::to_string(device) + "/" + metric);
+            }
+        }
+    }
+    std::mt19937 rng(1);
+    std::shuffle(keys.begin(), keys.end(), rng);
+    for (size_t i = 0; i < keys.size(); i++) {
+        tree.insert(keys[i], (int)i);
+    }
+
+    long sum = 0;
+    auto searchAll = [&] {
+        for (int round = 0; round < 5; round++) {
+            for (auto& key : keys) {
+                sum += *tree.search(std::string_view(key));
+            }
+        }
+    };
+    auto plain = tree.keyMemoryUsage();
+    double plainSeconds = measureSeconds(searchAll);
+    tree.encodeKeys();
+    auto encoded = tree.keyMemoryUsage();
+    double encodedSeconds = measureSeconds(searchAll);
+
+    double lookups = keys.size() * 5.0;
+    std::printf("%zu keys, %zu leaves (%zu encoded)\n", keys.size(), encoded.leaves, encoded.encodedLeaves);
+    std::printf("  key bytes: %.2f MB -> %.2f MB\n", plain.bytes / 1e6, encoded.bytes / 1e6);
+    std::printf("  search:    %.2fM/s -> %.2fM/s\n", lookups / plainSeconds / 1e6, lookups / encodedSeconds / 1e6);
+    std::printf("(checksum %ld)\n", sum);
+    return 0;
+}
@@ -0,0 +1,48 @@
+/**
+ * @file bench_for_each_in_range.cc
+ * @brief 全件走査: 1 要素ずつの visitor、葉ごとの visitor、キーごとの search() の比較
+ * @details g++ -std=c++17 -O2 -pthread bench/bench_for_each_in_range.cc && ./a.out [要素数]
+ */
+#define BPLUSTREE_NO_MAIN
+#include "../b_pluss_tree.cc"
+#include "timer.h"
+
+#include <cstdlib>
+
+int main(int argc, char** argv) {
+    const int n = argc > 1 ? std::atoi(argv[1]) : 20000;
+    BPlusTree::BPlusTree<> tree;
+    for (int i = 0; i < n; i++) {
+        tree.insert(i, i);
+    }
+    const int rounds = 200;
+
+    long sum = 0;
+    double entries = measureSeconds([&] {
+        for (int r = 0; r < rounds; r++) {
+            tree.forEachInRange({}, [&](int, int value) { sum += value; });
+        }
+    });
+    double spans = measureSeconds([&] {
+        for (int r = 0; r < rounds; r++) {
+            tree.forEachInRange({}, [&](const int*, const int* values, size_t count) {
+                for (size_t i = 0; i < count; i++) {
+                    sum += values[i];
+                }
+            });
+        }
+    });
+    double searches = measureSeconds([&] {
+        for (int i = 0; i < n; i++) {
+            sum += *tree.search(i);
+        }
+    });
+
+    double total = (double)n * rounds;
+    std::printf("%d keys\n", n);
+    std::printf("  entry visitor: %.1fM keys/s\n", total / entries / 1e6);
+    std::printf("  span visitor:  %.1fM keys/s\n", total / spans / 1e6);
+    std::printf("  search():      %.1fM keys/s\n", n / searches / 1e6);
+    std::printf("(checksum %ld)\n", sum);
+    return 0;
+}
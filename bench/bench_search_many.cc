@@ -0,0 +1,54 @@
+/**
+ * @file bench_search_many.cc
+ * @brief 冷えたプールでの 20000 件のランダム検索を、searchMany() と search() で比べる
+ * @details O_DIRECT で開くので、ミスはそのままディスクの読み込みになる。
+ *          g++ -std=c++17 -O2 -pthread bench/bench_search_many.cc && ./a.out [ファイル]
+ */
+#define BPLUSTREE_NO_MAIN
+#include "../b_pluss_tree.cc"
+#include "timer.h"
+
+#include <random>
+
+using Disk = BPlusTree::DiskBPlusTree<int64_t, int64_t>;
+
+int main(int argc, char** argv) {
+    const std::string path = argc > 1 ? argv[1] : "bench_search_many.db";
+    const int n = 20000;
+    BPlusTree::BPlusTree<int64_t, int64_t> tree;
+    for (int i = 0; i < n; i++) {
+        tree.insert((int64_t)i * 3, i);
+    }
+    if (!Disk::build(tree, path)) {
+        std::fprintf(stderr, "cannot write %s\n", path.c_str());
+        return 1;
+    }
+    std::mt19937 rng(3);
+    std::vector<int64_t> keys(20000);
+    for (auto& key : keys) {
+        key = (int64_t)(rng() % (n * 3));
+    }
+    std::vector<std::optional<int64_t>> results(keys.size());
+
+    for (size_t frames : {16, 64}) {
+        Disk batched;
+        batched.open(path, frames, true);
+        double batchedSeconds = measureSeconds([&] {
+            batched.searchMany(keys.data(), keys.size(), results.data());
+        });
+        Disk single;
+        single.open(path, frames, true);
+        double singleSeconds = measureSeconds([&] {
+            for (size_t i = 0; i < keys.size(); i++) {
+                results[i] = single.search(keys[i]);
+            }
+        });
+        std::printf("pool %zu (%s, %s): searchMany %.0fk/s (misses %lu), search %.0fk/s (misses %lu)\n",
+                    frames, batched.usesIoUring() ? "io_uring" : "thread pool",
+                    batched.direct() ? "O_DIRECT" : "buffered",
+                    keys.size() / batchedSeconds / 1e3, (unsigned long)batched.pool().misses(),
+                    keys.size() / singleSeconds / 1e3, (unsigned long)single.pool().misses());
+    }
+    std::remove(path.c_str());
+    return 0;
+}
@@ -0,0 +1,51 @@
+/**
+ * @file bench_shared_pool.cc
+ * @brief 共有プールのスレッドが生きているかどうかで、1 スレッドの挿入と検索の速さを比べる
+ * @details 2 本目のスレッドができると libstdc++ は shared_ptr の参照数を原子的に
+ *          増減するようになる。共有プールを作る前と後で、20000 キーをかき混ぜた順に
+ *          挿入し、50 周検索する。
+ *          g++ -std=c++17 -O2 -pthread bench/bench_shared_pool.cc && ./a.out
+ */
+#define BPLUSTREE_NO_MAIN
+#include "../b_pluss_tree.cc"
+#include "timer.h"
+
+#include <algorithm>
+#include <numeric>
+#include <random>
+
+/**
+ * @brief keys を新しい木へ挿入し、続けて 50 周検索する時間を表示する
+ * @param label
+ * @param keys
+ */
+void run(const char* label, const std::vector<int>& keys) {
+    BPlusTree::BPlusTree<int, int> tree;
+    double insert = measureSeconds([&] {
+        for (int key : keys) {
+            tree.insert(key, key);
+        }
+    });
+    long sum = 0;
+    double search = measureSeconds([&] {
+        for (int round = 0; round < 50; round++) {
+            for (int key : keys) {
+                sum += *tree.search(key);
+            }
+        }
+    });
+    std::printf("%-22s: insert %.2fs, search %.2fs (%ld)\n", label, insert, search, sum);
+}
+
+int main(int argc, char** argv) {
+    bool pool = argc > 1 && std::string(argv[1]) == "pool";
+    const int n = 20000;
+    std::vector<int> keys(n);
+    std::iota(keys.begin(), keys.end(), 0);
+    std::shuffle(keys.begin(), keys.end(), std::mt19937(1));
+    if (pool) {
+        BPlusTree::WorkStealingPool::shared();
+    }
+    run(pool ? "with pool threads" : "without pool threads", keys);
+    return 0;
+}
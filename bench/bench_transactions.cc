@@ -0,0 +1,74 @@
+/**
+ * @file bench_transactions.cc
+ * @brief 2 キーの読み取り・更新トランザクションのスループットと中断率
+ * @details 20000 キーの木で、キーを一様に選ぶ場合 (低競合) と 8 個の熱いキーから
+ *          選ぶ場合 (高競合) を、スレッド数を変えて測る。中断したら再試行する。
+ *          高競合は更新の待ち行列 (enableWriterQueue) を有効にした木でも測る。
+ *          g++ -std=c++17 -O2 -pthread bench/bench_transactions.cc && ./a.out
+ */
+#define BPLUSTREE_NO_MAIN
+#include "../b_pluss_tree.cc"
+#include "timer.h"
+
+#include <random>
+#include <thread>
+
+using Tree = BPlusTree::BPlusTree<int, long>;
+
+int main() {
+    const int n = 20000;
+    const int perThread = 20000;
+    struct Config {
+        const char* name;
+        int hot;
+        bool queue;
+    };
+    for (auto config : {Config{"low contention        ", n, false}, Config{"high contention       ", 8, false},
+                        Config{"high contention, queue", 8, true}}) {
+        int hot = config.hot;
+        for (int threads : {1, 4, 8}) {
+            Tree tree;
+            if (config.queue) {
+                tree.enableWriterQueue();
+            }
+            for (int i = 0; i < n; i++) {
+                tree.insert(i, 0);
+            }
+            std::atomic<long> commits{0};
+            std::atomic<long> aborts{0};
+            double seconds = measureSeconds([&] {
+                std::vector<std::thread> workers;
+                for (int t = 0; t < threads; t++) {
+                    workers.emplace_back([&, t] {
+                        std::mt19937 rng(t);
+                        for (int i = 0; i < perThread; i++) {
+                            int a = rng() % hot * (n / hot);
+                            int b = rng() % hot * (n / hot);
+                            for (;;) {
+                                auto tx = tree.begin();
+                                long va = *tx.get(a);
+                                long vb = *tx.get(b);
+                                tx.insert(a, va + 1);
+                                tx.insert(b, (b == a ? va + 1 : vb) + 1);
+                                if (tx.commit()) {
+                                    commits++;
+                                    break;
+                                }
+                                aborts++;
+                            }
+                        }
+                    });
+                }
+                for (auto& worker : workers) {
+                    worker.join();
+                }
+            });
+            long sum = 0;
+            tree.forEachInRange({}, [&](int, long value) { sum += value; });
+            std::printf("%s, %d threads: %.0fk txn/s, %.2f%% aborts%s\n", config.name, threads,
+                        commits / seconds / 1e3, 100.0 * aborts / (commits + aborts),
+                        sum == 2 * commits ? "" : " (SUM MISMATCH)");
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,87 @@
+/**
+ * @file bench_writer_latch.cc
+ * @brief 更新の待ち行列 (enableWriterQueue) の有無と、回る回数による違い
+ * @details 10000 キーの木に、zipf 分布 (s = 0.99) でキーを選ぶ 8 本の更新スレッドと
+ *          1 本の読み取りスレッドを走らせる。待ち行列なし (既定)、待ち行列ですぐ眠る、
+ *          256 回回ってから眠る、の 3 通りで、更新のスループットと 1 回の更新に
+ *          かかった時間の分布を測る。待ち行列は到着順に渡すので最悪の待ち時間が
+ *          短くなるが、スループットは落ちる。
+ *          g++ -std=c++17 -O2 -pthread bench/bench_writer_latch.cc && ./a.out
+ */
+#define BPLUSTREE_NO_MAIN
+#include "../b_pluss_tree.cc"
+#include "timer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <thread>
+
+using Tree = BPlusTree::BPlusTree<int, int>;
+
+int main() {
+    const int n = 10000;
+    const int writers = 8;
+    const int perWriter = 20000;
+    std::vector<double> cdf(n);
+    double sum = 0;
+    for (int i = 0; i < n; i++) {
+        sum += 1.0 / std::pow(i + 1, 0.99);
+        cdf[i] = sum;
+    }
+    // 負の値は待ち行列なし
+    for (long budget : {-1L, 0L, 256L}) {
+        Tree tree;
+        if (budget >= 0) {
+            tree.enableWriterQueue(static_cast<uint32_t>(budget));
+        }
+        for (int i = 0; i < n; i++) {
+            tree.insert(i, 0);
+        }
+        std::atomic<bool> done{false};
+        std::atomic<long> reads{0};
+        std::thread reader([&] {
+            std::mt19937 rng(100);
+            while (!done.load(std::memory_order_relaxed)) {
+                tree.search(rng() % n);
+                reads.fetch_add(1, std::memory_order_relaxed);
+            }
+        });
+        std::vector<std::vector<float>> latencies(writers);
+        double seconds = measureSeconds([&] {
+            std::vector<std::thread> threads;
+            for (int t = 0; t < writers; t++) {
+                threads.emplace_back([&, t] {
+                    std::mt19937 rng(t);
+                    std::uniform_real_distribution<double> uniform(0, sum);
+                    latencies[t].reserve(perWriter);
+                    for (int i = 0; i < perWriter; i++) {
+                        int key = std::lower_bound(cdf.begin(), cdf.end(), uniform(rng)) - cdf.begin();
+                        latencies[t].push_back(measureSeconds([&] { tree.insert(key, i); }) * 1e6);
+                    }
+                });
+            }
+            for (auto& thread : threads) {
+                thread.join();
+            }
+        });
+        done = true;
+        reader.join();
+        std::vector<float> all;
+        for (auto& l : latencies) {
+            all.insert(all.end(), l.begin(), l.end());
+        }
+        std::sort(all.begin(), all.end());
+        auto at = [&](double q) { return all[static_cast<size_t>(q * (all.size() - 1))]; };
+        char label[32];
+        if (budget < 0) {
+            std::snprintf(label, sizeof(label), "no queue");
+        } else {
+            std::snprintf(label, sizeof(label), "queue, spin %ld", budget);
+        }
+        std::printf("%-14s: %4.0fk writes/s, %4.0fk reads/s, write us p50 %.1f p99 %.0f p99.9 %.0f p99.99 %.0f max %.0f\n", label,
+                    writers * perWriter / seconds / 1000, reads / seconds / 1000, at(0.5), at(0.99), at(0.999), at(0.9999),
+                    all.back());
+    }
+    return 0;
+}
@@ -0,0 +1,19 @@
+/**
+ * @file timer.h
+ * @brief bench/ で使う時間計測
+ */
+#pragma once
+
+#include <chrono>
+
+/**
+ * @brief fn() の実行にかかった秒数
+ * @param fn 
+ * @return double 
+ */
+template <typename Fn>
+double measureSeconds(Fn&& fn) {
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
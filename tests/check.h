@@ -0,0 +1,35 @@
+/**
+ * @file check.h
+ * @brief tests/ で使う検査マクロ
+ * @details NDEBUG でも消えないよう assert の代わりに使う。失敗すると
+ *          ファイルと行を表示して終了コード 1 で終わる
+ */
+#pragma once
+
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <unistd.h>
+
+#define CHECK(cond)                                                          \
+    do {                                                                     \
+        if (!(cond)) {                                                       \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__,      \
+                         __LINE__, #cond);                                   \
+            std::exit(1);                                                    \
+        }                                                                    \
+    } while (0)
+
+#define CHECK_EQ(a, b) CHECK((a) == (b))
+
+/**
+ * @brief 一時ディレクトリ内のテスト用ファイルのパス
+ * @details 同時に走るテストと衝突しないよう、プロセス ID を名前に含める
+ * @param name 
+ * @return std::string 
+ */
+inline std::string tempPath(const std::string& name) {
+    auto file = "bpt_" + std::to_string(::getpid()) + "_" + name;
+    return (std::filesystem::temp_directory_path() / file).string();
+}
@@ -0,0 +1,187 @@
+/**
+ * @file test_async_page_io.cc
+ * @brief 非同期のページ読み込み (io_uring / pread のスレッドプール)、
+ *        BufferPool の並行な追い出し、DiskBPlusTree::searchMany() のテスト
+ * @details g++ -std=c++17 -O2 -pthread tests/test_async_page_io.cc && ./a.out
+ */
+#define BPLUSTREE_NO_MAIN
+#include "../b_pluss_tree.cc"
+#include "check.h"
+
+#include <cstring>
+#include <random>
+#include <thread>
+
+using namespace BPlusTree;
+using Disk = DiskBPlusTree<int64_t, int64_t>;
+
+namespace {
+
+/**
+ * @brief 8 ページを読み、同期の readPage() と同じ内容になるか。範囲外のページは失敗を返すか
+ */
+void checkReader(AsyncPageReader& reader, PageFile& file) {
+    auto buffer = allocateAligned(kPageSize * 8);
+    std::vector<AsyncPageReader::Request> requests;
+    for (uint32_t i = 0; i < 8; i++) {
+        requests.push_back({i, buffer.get() + i * kPageSize, 100 + i});
+    }
+    CHECK(reader.submit(requests));
+    std::vector<AsyncPageReader::Completion> done;
+    size_t reaped = 0;
+    while (reaped < 8) {
+        reaped += reader.reap(done, 1);
+    }
+    CHECK_EQ(done.size(), 8u);
+    std::vector<bool> seen(8);
+    for (auto& completion : done) {
+        CHECK(completion.ok);
+        CHECK(completion.tag >= 100 && completion.tag < 108);
+        seen[completion.tag - 100] = true;
+    }
+    CHECK(std::all_of(seen.begin(), seen.end(), [](bool b) { return b; }));
+    std::vector<char> expected(kPageSize);
+    for (uint32_t i = 0; i < 8; i++) {
+        CHECK(file.readPage(i, expected.data()));
+        CHECK(std::memcmp(expected.data(), buffer.get() + i * kPageSize, kPageSize) == 0);
+    }
+
+    requests.assign(1, {100000u, buffer.get(), 7});
+    CHECK(reader.submit(requests));
+    done.clear();
+    CHECK_EQ(reader.reap(done, 1), 1u);
+    CHECK_EQ(done[0].tag, 7u);
+    CHECK(!done[0].ok);
+}
+
+/**
+ * @brief 小さいプールで複数スレッドが書き換え、追い出しの書き戻しを並行に起こす
+ * @details 各スレッドは自分のページだけに通し番号を書き、読み直した値が
+ *          最後に書いた値と一致するか確かめる
+ */
+void checkConcurrentEviction(const std::string& path) {
+    PageFile file;
+    CHECK(file.open(path, true, false));
+    BufferPool pool(file, 6);
+    const int threads = 4;
+    const int pages = 40;
+    std::atomic<int> errors{0};
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t] {
+            std::vector<uint64_t> stamps(pages, 0);
+            for (int p = 0; p < pages; p++) {
+                auto page = pool.allocate(t * pages + p);
+                while (!page) {
+                    std::this_thread::yield();
+                    page = pool.allocate(t * pages + p);
+                }
+                std::memcpy(page.data(), &stamps[p], sizeof(uint64_t));
+            }
+            std::mt19937 rng(t);
+            for (int i = 0; i < 3000; i++) {
+                int p = rng() % pages;
+                auto page = pool.pin(t * pages + p);
+                if (!page) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                uint64_t stamp;
+                std::memcpy(&stamp, page.data(), sizeof(uint64_t));
+                if (stamp != stamps[p]) {
+                    errors++;
+                }
+                stamps[p]++;
+                std::memcpy(page.data(), &stamps[p], sizeof(uint64_t));
+                page.markDirty();
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    CHECK_EQ(errors.load(), 0);
+    CHECK(pool.misses() > 0);
+    CHECK(pool.flush());
+}
+
+} // namespace
+
+int main() {
+    const int n = 20000;
+    const std::string path = tempPath("async.db");
+    ::BPlusTree::BPlusTree<int64_t, int64_t> tree;
+    for (int i = 0; i < n; i++) {
+        tree.insert((int64_t)i * 3, i);
+    }
+    CHECK(Disk::build(tree, path));
+
+    {
+        PageFile file;
+        CHECK(file.open(path, false, false));
+        ThreadPoolPageReader threadPool(file.fd(), 4);
+        CHECK(!threadPool.usesIoUring());
+        checkReader(threadPool, file);
+        auto preferred = AsyncPageReader::create(file.fd(), 8);
+        checkReader(*preferred, file);
+    }
+
+    // searchMany() は search() と同じ結果を返す。プールが小さくても詰まらない
+    std::mt19937 rng(3);
+    std::vector<int64_t> keys(20000);
+    for (auto& key : keys) {
+        key = (int64_t)(rng() % (n * 3));
+    }
+    for (size_t frames : {8, 64, 4096}) {
+        Disk disk;
+        CHECK(disk.open(path, frames, true));
+        std::vector<std::optional<int64_t>> results(keys.size());
+        size_t found = disk.searchMany(keys.data(), keys.size(), results.data());
+        size_t expected = 0;
+        for (size_t i = 0; i < keys.size(); i++) {
+            auto value = disk.search(keys[i]);
+            CHECK(value == results[i]);
+            CHECK_EQ((bool)value, keys[i] % 3 == 0);
+            expected += value.has_value();
+        }
+        CHECK_EQ(found, expected);
+    }
+
+    // 複数スレッドからの searchMany()
+    Disk shared;
+    CHECK(shared.open(path, 32, true));
+    std::atomic<int> errors{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&, t] {
+            std::mt19937 local(t);
+            std::vector<int64_t> probes(5000);
+            for (auto& key : probes) {
+                key = (int64_t)(local() % n) * 3;
+            }
+            std::vector<std::optional<int64_t>> results(probes.size());
+            for (int round = 0; round < 3; round++) {
+                if (shared.searchMany(probes.data(), probes.size(), results.data()) != probes.size()) {
+                    errors++;
+                }
+                for (size_t i = 0; i < probes.size(); i++) {
+                    if (results[i] != std::optional<int64_t>(probes[i] / 3)) {
+                        errors++;
+                    }
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    CHECK_EQ(errors.load(), 0);
+
+    const std::string evictionPath = tempPath("eviction.db");
+    checkConcurrentEviction(evictionPath);
+
+    std::remove(path.c_str());
+    std::remove(evictionPath.c_str());
+    std::puts("ok");
+    return 0;
+}
@@ -0,0 +1,150 @@
+/**
+ * @file test_backup.cc
+ * @brief 書き込みを止めないオンラインバックアップのテスト
+ * @details 書き込み中に取ったバックアップを復元した木が、書き込みの履歴の
+ *          ある時点の状態と一致することを確かめる。バックアップは小さくした
+ *          FIFO へ書かせてゆっくり読み出すので、1 CPU の環境でも書き出しの途中で
+ *          書き込みが進む。
+ *          g++ -std=c++17 -O2 -pthread tests/test_backup.cc && ./a.out
+ */
+#define BPLUSTREE_NO_MAIN
+#include "../b_pluss_tree.cc"
+#include "check.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <set>
+#include <thread>
+#include <tuple>
+
+namespace {
+
+using Tree = BPlusTree::BPlusTree<int, int>;
+
+std::map<int, int> dump(Tree& tree) {
+    std::map<int, int> state;
+    tree.forEachInRange(BPlusTree::KeyRange<int>{}, [&](int key, int value) { state[key] = value; });
+    return state;
+}
+
+/**
+ * @brief FIFO 越しにバックアップを取り、受け取った内容を path へ保存する
+ */
+std::optional<uint64_t> slowBackup(Tree& tree, const std::string& path) {
+    std::string fifo = path + ".fifo";
+    CHECK(::mkfifo(fifo.c_str(), 0600) == 0);
+    std::string received;
+    std::thread reader([&] {
+        int fd = ::open(fifo.c_str(), O_RDONLY);
+        CHECK(fd >= 0);
+        ::fcntl(fd, F_SETPIPE_SZ, 4096);
+        char chunk[1024];
+        ssize_t n;
+        while ((n = ::read(fd, chunk, sizeof(chunk))) > 0) {
+            received.append(chunk, n);
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+        ::close(fd);
+    });
+    auto snapshot = tree.backup(fifo);
+    reader.join();
+    std::remove(fifo.c_str());
+    std::ofstream(path, std::ios::binary) << received;
+    return snapshot;
+}
+
+} // namespace
+
+int main() {
+    const int n = 8000;
+    const std::string path = tempPath("backup.bin");
+    Tree tree;
+    for (int i = 0; i < n; i++) {
+        tree.insert(i * 2, i);
+    }
+    auto state = dump(tree);
+
+    // key, value, 削除かどうか
+    std::vector<std::tuple<int, int, bool>> log;
+    std::atomic<bool> stop{false};
+    std::atomic<int> progress{0};
+    std::thread writer([&] {
+        for (int i = 0; !stop; i++) {
+            int added = i * 2 + 1;
+            int overwritten = (i % n) * 2;
+            int erased = (i * 37 % n) * 2;
+            tree.insert(added, -1);
+            log.emplace_back(added, -1, false);
+            tree.insert(overwritten, -7);
+            log.emplace_back(overwritten, -7, false);
+            tree.erase(erased);
+            log.emplace_back(erased, 0, true);
+            progress++;
+            if (i % 50 == 0) {
+                std::this_thread::yield();
+            }
+        }
+    });
+    // 書き込みが始まってからバックアップを取る
+    while (progress < 100) {
+        std::this_thread::yield();
+    }
+    int started = progress;
+    auto snapshot = slowBackup(tree, path);
+    // バックアップの途中で書き込みが進んでいなければ、このテストは何も確かめていない
+    CHECK(progress - started > 100);
+    stop = true;
+    writer.join();
+    CHECK(snapshot);
+
+    Tree restored;
+    CHECK(restored.restore(path));
+    auto actual = dump(restored);
+
+    // 履歴を 1 件ずつ適用し、復元した状態と一致する時点があるか
+    auto same = [&](int key) {
+        auto a = state.find(key);
+        auto b = actual.find(key);
+        return (a == state.end()) == (b == actual.end()) && (a == state.end() || a->second == b->second);
+    };
+    std::set<int> keys;
+    for (auto& [key, value] : state) {
+        keys.insert(key);
+    }
+    for (auto& [key, value] : actual) {
+        keys.insert(key);
+    }
+    long differences = 0;
+    for (int key : keys) {
+        differences += !same(key);
+    }
+    bool matched = differences == 0;
+    for (size_t i = 0; i < log.size() && !matched; i++) {
+        auto [key, value, erase] = log[i];
+        differences -= !same(key);
+        if (erase) {
+            state.erase(key);
+        } else {
+            state[key] = value;
+        }
+        differences += !same(key);
+        matched = differences == 0;
+    }
+    CHECK(matched);
+
+    // 空の木、存在しないファイル
+    Tree empty;
+    CHECK(empty.backup(path));
+    Tree restoredEmpty;
+    CHECK(restoredEmpty.restore(path));
+    CHECK(dump(restoredEmpty).empty());
+    CHECK(!restoredEmpty.restore(tempPath("missing.bin")));
+
+    std::remove(path.c_str());
+    std::puts("ok");
+    return 0;
+}
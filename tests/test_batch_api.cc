@@ -0,0 +1,89 @@
+/**
+ * @file test_batch_api.cc
+ * @brief getMany() と scanInto() のテスト
+ * @details 呼び出し側のバッファに書き込み、呼び出し中にヒープを確保しないことも確かめる。
+ *          g++ -std=c++17 -O2 -pthread tests/test_batch_api.cc && ./a.out
+ */
+#define BPLUSTREE_NO_MAIN
+#include "../b_pluss_tree.cc"
+#include "check.h"
+
+#include <new>
+
+namespace {
+size_t allocations = 0;
+}
+
+void* operator new(size_t size) {
+    allocations++;
+    if (void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+int main() {
+    BPlusTree::BPlusTree<> tree;
+    for (int i = 0; i < 1000; i++) {
+        tree.insert(i * 2, i);
+    }
+
+    // 昇順でない並びや範囲外のキーも含める
+    int keys[] = {0, 1, 2, 3, 4, 100, 101, 1998, 2000, 5, 4};
+    const size_t count = sizeof(keys) / sizeof(keys[0]);
+    int values[count];
+    std::vector<bool> found(count);
+    size_t before = allocations;
+    size_t hits = tree.getMany(keys, count, values, found);
+    CHECK_EQ(allocations, before);
+    CHECK_EQ(hits, 6u);
+    for (size_t i = 0; i < count; i++) {
+        bool present = keys[i] % 2 == 0 && keys[i] < 2000;
+        CHECK_EQ(found[i], present);
+        if (present) {
+            CHECK_EQ(values[i], keys[i] / 2);
+        }
+    }
+
+    // 小さいバッファで再開キーを辿り、範囲をすべて取り出す
+    int keyBuffer[7];
+    int valueBuffer[7];
+    BPlusTree::KeyRange<int> range{5, 101};
+    int total = 0;
+    int last = -1;
+    before = allocations;
+    for (;;) {
+        auto result = tree.scanInto(range, keyBuffer, valueBuffer, 7);
+        CHECK(result.count <= 7);
+        for (size_t i = 0; i < result.count; i++) {
+            CHECK(keyBuffer[i] > last);
+            CHECK_EQ(valueBuffer[i], keyBuffer[i] / 2);
+            last = keyBuffer[i];
+            total++;
+        }
+        if (!result.resumeKey) {
+            break;
+        }
+        CHECK_EQ(result.count, 7u);
+        range.lo = result.resumeKey;
+    }
+    CHECK_EQ(allocations, before);
+    CHECK_EQ(total, 48);
+    CHECK_EQ(last, 100);
+
+    // ちょうど埋まる場合は再開キーを返さない
+    auto exact = tree.scanInto(0, 14, keyBuffer, valueBuffer, 7);
+    CHECK_EQ(exact.count, 7u);
+    CHECK(!exact.resumeKey);
+
+    std::puts("ok");
+    return 0;
+}
@@ -0,0 +1,128 @@
+/**
+ * @file test_bgsave.cc
+ * @brief fork による背景保存 (bgsave) のテスト
+ * @details 保存中も書き込みを続け、保存したファイルが fork した時点の内容だけを
+ *          含むことを確かめる。値を大きくして、子プロセスの書き出し用バッファ
+ *          (1 MiB) を何度も書き出させる。
+ *          g++ -std=c++17 -O2 -pthread tests/test_bgsave.cc && ./a.out
+ */
+#define BPLUSTREE_NO_MAIN
+#include "../b_pluss_tree.cc"
+#include "check.h"
+
+#include <thread>
+
+namespace {
+
+/**
+ * @brief 64 バイトの値
+ */
+struct Record {
+    int key;
+    int serial;
+    char padding[56];
+};
+
+Record makeRecord(int key, int serial) {
+    Record record{key, serial, {}};
+    std::memset(record.padding, key & 0x7f, sizeof(record.padding));
+    return record;
+}
+
+bool validRecord(int key, const Record& record) {
+    if (record.key != key) {
+        return false;
+    }
+    for (char c : record.padding) {
+        if (c != (char)(key & 0x7f)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+using Tree = BPlusTree::BPlusTree<int, Record>;
+
+} // namespace
+
+int main() {
+    const int n = 17000;
+    const std::string path = tempPath("bgsave.bak");
+    const std::string incrementalPath = tempPath("bgsave.inc");
+    Tree tree;
+    for (int i = 0; i < n; i++) {
+        tree.insert(i * 2, makeRecord(i * 2, 0));
+    }
+    CHECK(n * sizeof(Record) > (1u << 20));
+
+    // 新しいキーを昇順に足し続ける書き込みと、メモリ確保を繰り返すスレッドを走らせたまま保存する
+    std::atomic<bool> stop{false};
+    std::atomic<int> written{0};
+    std::thread writer([&] {
+        for (int k = 0; !stop; k++) {
+            tree.insert(n * 2 + k, makeRecord(n * 2 + k, k));
+            written = k + 1;
+        }
+    });
+    std::thread allocator([&] {
+        while (!stop) {
+            std::vector<std::string> strings(64, std::string(100, 'x'));
+            std::this_thread::yield();
+        }
+    });
+    while (written < 100) {
+        std::this_thread::yield();
+    }
+    std::optional<uint64_t> snapshot;
+    for (int round = 0; round < 3; round++) {
+        snapshot = tree.bgsave(path).get();
+        CHECK(snapshot);
+    }
+    stop = true;
+    writer.join();
+    allocator.join();
+
+    // fork した時点で書き込み済みだった新しいキーが、欠けずに連続して入っている
+    Tree restored;
+    CHECK(restored.restore(path));
+    size_t count = 0;
+    int newest = -1;
+    restored.forEachInRange({}, [&](int key, const Record& record) {
+        CHECK(validRecord(key, record));
+        if (key >= n * 2) {
+            CHECK_EQ(key, n * 2 + newest + 1);
+            CHECK_EQ(record.serial, key - n * 2);
+            newest = key - n * 2;
+        } else {
+            CHECK(key % 2 == 0 && record.serial == 0);
+        }
+        count++;
+    });
+    CHECK(newest >= 99);
+    CHECK(newest < written);
+    CHECK_EQ(count, (size_t)n + newest + 1);
+
+    // bgsave のスナップショットは差分バックアップの起点になる
+    for (int i = 0; i < 100; i++) {
+        tree.erase(i * 2);
+    }
+    CHECK(tree.incrementalBackup(*snapshot, incrementalPath));
+    Tree chained;
+    CHECK(chained.restore(path, {incrementalPath}));
+    size_t expected = 0;
+    size_t actual = 0;
+    tree.forEachInRange({}, [&](int, const Record&) { expected++; });
+    chained.forEachInRange({}, [&](int key, const Record& record) {
+        CHECK(validRecord(key, record));
+        actual++;
+    });
+    CHECK_EQ(actual, expected);
+
+    // 書き出せない場所では失敗を返す
+    CHECK(!tree.bgsave("/nonexistent-directory/bgsave.bak").get());
+
+    std::remove(path.c_str());
+    std::remove(incrementalPath.c_str());
+    std::puts("ok");
+    return 0;
+}
@@ -0,0 +1,200 @@
+/**
+ * @file test_combining.cc
+ * @brief 組み合わせ (flat combining) による挿入と削除のテスト
+ * @details g++ -std=c++17 -O2 -pthread tests/test_combining.cc && ./a.out
+ */
+#define BPLUSTREE_NO_MAIN
+#include "../b_pluss_tree.cc"
+#include "check.h"
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <new>
+#include <random>
+#include <thread>
+
+// キャッシュライン境界に揃えた確保の回数 (木でこれを使うのは公開枠だけ)
+static std::atomic<int> alignedAllocations{0};
+
+void* operator new(size_t size, std::align_val_t align) {
+    alignedAllocations++;
+    size_t alignment = static_cast<size_t>(align);
+    if (void* p = std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+void* operator new[](size_t size, std::align_val_t align) {
+    return operator new(size, align);
+}
+void operator delete(void* p, std::align_val_t) noexcept {
+    std::free(p);
+}
+void operator delete[](void* p, std::align_val_t) noexcept {
+    std::free(p);
+}
+void operator delete(void* p, size_t, std::align_val_t) noexcept {
+    std::free(p);
+}
+void operator delete[](void* p, size_t, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+using Tree = BPlusTree::BPlusTree<int, int>;
+
+namespace {
+
+/**
+ * @brief 組み合わせ役が排他ラッチを待つ間に公開した同じキーへの操作は、
+ *        次の 1 回の適用にまとまり、最後に公開したものだけが残る
+ */
+void checkArrivalOrder() {
+    Tree tree;
+    std::mutex seenMutex;
+    std::vector<std::optional<int>> seen;
+    tree.watch(7, 8, [&](const auto& changes) {
+        std::lock_guard<std::mutex> lock(seenMutex);
+        for (auto& change : changes) {
+            seen.push_back(change.value);
+        }
+    });
+
+    // 走査中の共有ラッチで、最初の組み合わせ役を排他ラッチの手前で止める
+    std::atomic<bool> scanning{false};
+    std::atomic<bool> release{false};
+    tree.insert(0, 0);
+    std::thread reader([&] {
+        tree.forEachInRange({}, [&](int, int) {
+            scanning = true;
+            while (!release) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        });
+    });
+    while (!scanning) {
+        std::this_thread::yield();
+    }
+    std::thread first([&] { tree.insertCombining(1, 1); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    // 公開した順: 挿入 1, 削除, 挿入 3, 挿入 4
+    std::vector<std::thread> publishers;
+    publishers.emplace_back([&] { tree.insertCombining(7, 1); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    publishers.emplace_back([&] { tree.eraseCombining(7); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    publishers.emplace_back([&] { tree.insertCombining(7, 3); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    publishers.emplace_back([&] { tree.insertCombining(7, 4); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    release = true;
+    reader.join();
+    first.join();
+    for (auto& publisher : publishers) {
+        publisher.join();
+    }
+    tree.flushWatches();
+
+    CHECK(tree.search(7) == std::optional<int>(4));
+    CHECK(tree.search(1) == std::optional<int>(1));
+    auto [passes, ops] = tree.combiningStats();
+    CHECK_EQ(passes, 2u);
+    CHECK_EQ(ops, 5u);
+    std::lock_guard<std::mutex> lock(seenMutex);
+    CHECK((seen == std::vector<std::optional<int>>{4}));
+}
+
+} // namespace
+
+int main() {
+    // 公開枠は最初の組み合わせ操作で確保する
+    {
+        int before = alignedAllocations.load();
+        Tree tree;
+        for (int i = 0; i < 100; i++) {
+            tree.insert(i, i);
+        }
+        tree.erase(0);
+        CHECK_EQ(alignedAllocations.load(), before);
+        CHECK((tree.combiningStats() == std::pair<uint64_t, uint64_t>{0, 0}));
+        tree.insertCombining(1000, 1);
+        CHECK_EQ(alignedAllocations.load(), before + 1);
+        tree.eraseCombining(1000);
+        CHECK_EQ(alignedAllocations.load(), before + 1);
+        CHECK(!tree.search(1000));
+        CHECK((tree.combiningStats() == std::pair<uint64_t, uint64_t>{2, 2}));
+    }
+
+    // 8 スレッドがそれぞれ自分のキーを挿入・削除し、std::map と同じ結果になる
+    {
+        Tree tree;
+        const int threads = 8;
+        std::vector<std::map<int, int>> expected(threads);
+        std::vector<std::thread> workers;
+        for (int t = 0; t < threads; t++) {
+            workers.emplace_back([&, t] {
+                std::mt19937 rng(t);
+                for (int i = 0; i < 3000; i++) {
+                    int key = (rng() % 500) * threads + t;
+                    if (rng() % 10 == 0) {
+                        tree.eraseCombining(key);
+                        expected[t].erase(key);
+                    } else {
+                        tree.insertCombining(key, i);
+                        expected[t][key] = i;
+                    }
+                }
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        size_t total = 0;
+        for (int t = 0; t < threads; t++) {
+            total += expected[t].size();
+            for (auto& [key, value] : expected[t]) {
+                CHECK(tree.search(key) == std::optional<int>(value));
+            }
+        }
+        size_t count = 0;
+        tree.forEachInRange({}, [&](int key, int value) {
+            CHECK(expected[key % threads].at(key) == value);
+            count++;
+        });
+        CHECK_EQ(count, total);
+        auto [passes, ops] = tree.combiningStats();
+        CHECK_EQ(ops, static_cast<uint64_t>(threads) * 3000);
+        CHECK(passes >= 1 && passes <= ops);
+    }
+
+    // 同じキーへの組み合わせと通常の書き込みが混ざっても壊れない
+    {
+        Tree tree;
+        std::vector<std::thread> workers;
+        for (int t = 0; t < 4; t++) {
+            workers.emplace_back([&, t] {
+                for (int i = 0; i < 2000; i++) {
+                    int key = i % 16;
+                    if (t % 2) {
+                        tree.insertCombining(key, t);
+                    } else {
+                        tree.insert(key, t);
+                    }
+                }
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        for (int key = 0; key < 16; key++) {
+            auto value = tree.search(key);
+            CHECK(value && *value >= 0 && *value < 4);
+        }
+    }
+
+    checkArrivalOrder();
+
+    std::puts("ok");
+    return 0;
+}
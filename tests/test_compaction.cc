@@ -0,0 +1,156 @@
+/**
+ * @file test_compaction.cc
+ * @brief DiskBPlusTree の書き込み、空きページの再利用、ファイルの切り詰めのテスト
+ * @details 乱数の挿入・削除を std::map と比べながら行い、compactStep() / compact() の
+ *          後も内容が変わらず、ファイルが小さくなることを確かめる。
+ *          g++ -std=c++17 -O2 -pthread tests/test_compaction.cc && ./a.out
+ */
+#define BPLUSTREE_NO_MAIN
+#include "../b_pluss_tree.cc"
+#include "check.h"
+
+#include <map>
+#include <random>
+#include <thread>
+
+using Disk = BPlusTree::DiskBPlusTree<int64_t, int64_t>;
+
+namespace {
+
+void checkContents(Disk& disk, const std::map<int64_t, int64_t>& expected) {
+    size_t count = 0;
+    auto it = expected.begin();
+    disk.forEachInRange({}, [&](int64_t key, int64_t value) {
+        CHECK(it != expected.end() && it->first == key && it->second == value);
+        ++it;
+        count++;
+    });
+    CHECK_EQ(count, expected.size());
+    CHECK_EQ(disk.size(), expected.size());
+    for (auto& [key, value] : expected) {
+        CHECK(disk.search(key) == std::optional<int64_t>(value));
+    }
+}
+
+} // namespace
+
+int main() {
+    const std::string path = tempPath("compaction.db");
+    {
+        BPlusTree::BPlusTree<int64_t, int64_t> empty;
+        CHECK(Disk::build(empty, path));
+    }
+    std::map<int64_t, int64_t> expected;
+    std::mt19937 rng(7);
+    {
+        Disk disk;
+        CHECK(disk.open(path, 16, true));
+        for (int i = 0; i < 30000; i++) {
+            int64_t key = rng() % 25000;
+            if (rng() % 4 == 0) {
+                CHECK_EQ(disk.erase(key), expected.erase(key) == 1);
+            } else {
+                CHECK(disk.insert(key, i));
+                expected[key] = i;
+            }
+        }
+        checkContents(disk, expected);
+        CHECK(disk.flush());
+    }
+
+    Disk disk;
+    CHECK(disk.open(path, 16, true));
+    checkContents(disk, expected);
+    uint32_t fullPages = disk.pageCount();
+
+    // ほとんどのキーを消すと空きページができる
+    std::vector<int64_t> keys;
+    for (auto& [key, value] : expected) {
+        keys.push_back(key);
+    }
+    for (size_t i = 0; i < keys.size(); i++) {
+        if ((i / 1000) % 10 != 0) {
+            CHECK(disk.erase(keys[i]));
+            expected.erase(keys[i]);
+        }
+    }
+    checkContents(disk, expected);
+    size_t freePages = disk.freePageCount();
+    CHECK(freePages > 0);
+
+    // 新しいページは空きページから取る
+    uint32_t pagesBefore = disk.pageCount();
+    for (int64_t key = 1000000; key < 1000600; key++) {
+        CHECK(disk.insert(key, 1));
+        expected[key] = 1;
+    }
+    CHECK_EQ(disk.pageCount(), pagesBefore);
+    CHECK(disk.freePageCount() < freePages);
+
+    disk.compactStep(8);
+    checkContents(disk, expected);
+    disk.compact(16);
+    CHECK_EQ(disk.freePageCount(), 0u);
+    checkContents(disk, expected);
+    CHECK_EQ(std::filesystem::file_size(path), (uint64_t)disk.pageCount() * BPlusTree::kPageSize);
+    CHECK(disk.pageCount() < fullPages);
+    CHECK(disk.flush());
+    {
+        Disk reopened;
+        CHECK(reopened.open(path, 8, true));
+        checkContents(reopened, expected);
+    }
+
+    // 全部消してから入れ直す
+    for (auto& [key, value] : expected) {
+        CHECK(disk.erase(key));
+    }
+    expected.clear();
+    checkContents(disk, expected);
+    disk.compact();
+    for (int64_t key = 0; key < 2000; key++) {
+        disk.insert(key, key);
+        expected[key] = key;
+    }
+    checkContents(disk, expected);
+    CHECK(disk.flush());
+    {
+        Disk reopened;
+        CHECK(reopened.open(path, 8, true));
+        checkContents(reopened, expected);
+    }
+
+    // 書き込みと切り詰めの最中も、読み出しは変わらない範囲を正しく返す
+    std::atomic<bool> stop{false};
+    std::atomic<int> errors{0};
+    std::thread reader([&] {
+        while (!stop) {
+            for (int64_t key = 0; key < 2000; key += 97) {
+                if (disk.search(key) != std::optional<int64_t>(key)) {
+                    errors++;
+                }
+            }
+            size_t count = 0;
+            disk.forEachInRange({(int64_t)0, (int64_t)2000}, [&](int64_t, int64_t) { count++; });
+            if (count != 2000) {
+                errors++;
+            }
+        }
+    });
+    for (int round = 0; round < 5; round++) {
+        for (int64_t key = 2000; key < 6000; key++) {
+            disk.insert(key, key);
+        }
+        for (int64_t key = 2000; key < 6000; key++) {
+            disk.erase(key);
+        }
+        disk.compact(4);
+    }
+    stop = true;
+    reader.join();
+    CHECK_EQ(errors.load(), 0);
+
+    std::remove(path.c_str());
+    std::puts("ok");
+    return 0;
+}
@@ -0,0 +1,112 @@
+/**
+ * @file test_comparator.cc
+ * @brief Compare テンプレート引数とノード内探索の特殊化のテスト
+ * @details g++ -std=c++17 -O2 -pthread tests/test_comparator.cc && ./a.out
+ */
+#define BPLUSTREE_NO_MAIN
+#include "../b_pluss_tree.cc"
+#include "check.h"
+
+#include <random>
+#include <string>
+
+namespace {
+
+/**
+ * @brief 年の降順、同じ年なら名前の昇順
+ */
+struct ByYearThenName {
+    bool operator()(const std::pair<int, std::string>& a, const std::pair<int, std::string>& b) const {
+        return a.first != b.first ? a.first > b.first : a.second < b.second;
+    }
+};
+
+template <typename Tree>
+void checkOrder(Tree& tree, bool descending) {
+    std::mt19937 rng(1);
+    std::vector<int> keys;
+    for (int i = 0; i < 3000; i++) {
+        int key = rng() % 5000;
+        keys.push_back(key);
+        tree.insert(key, key * 3);
+    }
+    for (int key = 0; key < 5000; key++) {
+        bool present = std::find(keys.begin(), keys.end(), key) != keys.end();
+        auto value = tree.search(key);
+        CHECK_EQ((bool)value, present);
+        if (value) {
+            CHECK_EQ(*value, key * 3);
+        }
+    }
+    int previous = descending ? 1 << 30 : -1;
+    size_t count = 0;
+    tree.forEachInRange(typename Tree::Range{}, [&](int key, int) {
+        CHECK(descending ? key < previous : key > previous);
+        previous = key;
+        count++;
+    });
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    CHECK_EQ(count, keys.size());
+}
+
+/**
+ * @brief 分岐なしの特殊化と汎用版が同じ位置を返すか
+ */
+template <typename Compare>
+void checkNodeSearch(bool ascending) {
+    using Fast = BPlusTree::NodeSearch<int, Compare>;
+    using Generic = BPlusTree::NodeSearch<int, Compare, int>;
+    std::mt19937 rng(2);
+    for (int round = 0; round < 1000; round++) {
+        std::vector<int> keys(rng() % 9);
+        for (auto& key : keys) {
+            key = rng() % 20;
+        }
+        std::sort(keys.begin(), keys.end());
+        if (!ascending) {
+            std::reverse(keys.begin(), keys.end());
+        }
+        for (int probe = -1; probe <= 20; probe++) {
+            CHECK_EQ(Fast::lowerIndex(keys, probe, Compare()), Generic::lowerIndex(keys, probe, Compare()));
+            CHECK_EQ(Fast::upperIndex(keys, probe, Compare()), Generic::upperIndex(keys, probe, Compare()));
+        }
+    }
+}
+
+} // namespace
+
+int main() {
+    BPlusTree::BPlusTree<> ascending;
+    checkOrder(ascending, false);
+    BPlusTree::BPlusTree<int, int, std::greater<>> descending;
+    checkOrder(descending, true);
+    BPlusTree::BPlusTree<int, int, std::less<int>> typedLess;
+    checkOrder(typedLess, false);
+
+    // 降順の木では範囲も降順で指定する
+    int visited = 0;
+    descending.forEachInRange(100, 50, [&](int key, int) {
+        CHECK(key <= 100 && key > 50);
+        visited++;
+    });
+    CHECK(visited > 0);
+
+    checkNodeSearch<std::less<>>(true);
+    checkNodeSearch<std::less<int>>(true);
+    checkNodeSearch<std::greater<>>(false);
+
+    BPlusTree::BPlusTree<std::pair<int, std::string>, int, ByYearThenName> composite;
+    composite.insert({2020, "b"}, 1);
+    composite.insert({2021, "a"}, 2);
+    composite.insert({2020, "a"}, 3);
+    composite.insert({2019, "z"}, 4);
+    composite.insert({2021, "c"}, 5);
+    std::vector<int> order;
+    composite.forEachInRange(BPlusTree::KeyRange<std::pair<int, std::string>>{},
+                             [&](const auto&, int value) { order.push_back(value); });
+    CHECK((order == std::vector<int>{2, 5, 3, 1, 4}));
+
+    std::puts("ok");
+    return 0;
+}
@@ -0,0 +1,137 @@
+/**
+ * @file test_delegated_tree.cc
+ * @brief シャードごとの持ち主のスレッドへ操作を送る DelegatedTree のテスト
+ * @details g++ -std=c++17 -O2 -pthread tests/test_delegated_tree.cc && ./a.out
+ */
+#define BPLUSTREE_NO_MAIN
+#include "../b_pluss_tree.cc"
+#include "check.h"
+
+#include <map>
+#include <random>
+#include <thread>
+
+using Delegated = BPlusTree::DelegatedTree<int, int>;
+using Tree = Delegated::Tree;
+
+int main() {
+    // 境界キーはそれ以上のキーを担当するシャードの先頭になる
+    {
+        Delegated tree({100, 200, 300});
+        CHECK_EQ(tree.shardCount(), 4u);
+        CHECK_EQ(tree.shardIndex(-5), 0u);
+        CHECK_EQ(tree.shardIndex(99), 0u);
+        CHECK_EQ(tree.shardIndex(100), 1u);
+        CHECK_EQ(tree.shardIndex(299), 2u);
+        CHECK_EQ(tree.shardIndex(300), 3u);
+        CHECK_EQ(tree.shardIndex(100000), 3u);
+    }
+
+    // exchange / search / erase は前の値を返し、キーは担当のシャードに入る
+    {
+        Delegated tree({1000, 2000, 3000});
+        // 更新の待ち行列を数えられるようにする
+        for (size_t shard = 0; shard < tree.shardCount(); shard++) {
+            tree.executeOn(shard, [](Tree& t) { t.enableWriterQueue(); }).get();
+        }
+        CHECK(!tree.exchange(5, 1).get());
+        CHECK(tree.exchange(5, 2).get() == std::optional<int>(1));
+        CHECK(tree.search(5).get() == std::optional<int>(2));
+        CHECK(tree.erase(5).get() == std::optional<int>(2));
+        CHECK(!tree.erase(5).get());
+        CHECK(!tree.search(5).get());
+
+        for (int i = 0; i < 4000; i += 7) {
+            tree.exchange(i, i);
+        }
+        for (size_t shard = 0; shard < tree.shardCount(); shard++) {
+            auto keys = tree.executeOn(shard, [](Tree& t) {
+                std::vector<int> keys;
+                t.forEachInRange({}, [&](int key, int) { keys.push_back(key); });
+                return keys;
+            }).get();
+            CHECK(!keys.empty());
+            for (int key : keys) {
+                CHECK_EQ(tree.shardIndex(key), shard);
+                CHECK_EQ(key % 7, 0);
+            }
+            // 持ち主のスレッドは木のラッチも待ち行列も通らない
+            auto latch = tree.executeOn(shard, [](Tree& t) { return t.writerLatchStats(); }).get();
+            CHECK_EQ(latch.acquisitions, 0u);
+        }
+
+        // 操作はシャードの持ち主のスレッドで走る
+        auto caller = std::this_thread::get_id();
+        auto owner0 = tree.execute(0, [](Tree&) { return std::this_thread::get_id(); }).get();
+        auto owner0Again = tree.execute(999, [](Tree&) { return std::this_thread::get_id(); }).get();
+        auto owner1 = tree.execute(1000, [](Tree&) { return std::this_thread::get_id(); }).get();
+        CHECK(owner0 != caller);
+        CHECK(owner0 == owner0Again);
+        CHECK(owner0 != owner1);
+    }
+
+    // 複数のスレッドから送った操作が std::map と同じ結果になる
+    {
+        Delegated tree({2500, 5000, 7500});
+        const int threads = 4;
+        std::vector<std::map<int, int>> expected(threads);
+        std::vector<std::thread> producers;
+        for (int t = 0; t < threads; t++) {
+            producers.emplace_back([&, t] {
+                std::mt19937 rng(t);
+                std::vector<std::future<std::optional<int>>> pending;
+                for (int i = 0; i < 3000; i++) {
+                    int key = (rng() % 2500) * threads + t;
+                    if (rng() % 5 == 0) {
+                        pending.push_back(tree.erase(key));
+                        expected[t].erase(key);
+                    } else {
+                        pending.push_back(tree.exchange(key, i));
+                        expected[t][key] = i;
+                    }
+                }
+                for (auto& result : pending) {
+                    result.get();
+                }
+            });
+        }
+        for (auto& producer : producers) {
+            producer.join();
+        }
+        size_t total = 0;
+        for (int t = 0; t < threads; t++) {
+            total += expected[t].size();
+            for (auto& [key, value] : expected[t]) {
+                CHECK(tree.search(key).get() == std::optional<int>(value));
+            }
+        }
+        size_t count = 0;
+        for (size_t shard = 0; shard < tree.shardCount(); shard++) {
+            count += tree.executeOn(shard, [](Tree& t) {
+                size_t n = 0;
+                t.forEachInRange({}, [&](int, int) { n++; });
+                return n;
+            }).get();
+        }
+        CHECK_EQ(count, total);
+    }
+
+    // デストラクタは送られた操作をすべて実行してから止まる
+    {
+        std::atomic<int> executed{0};
+        std::vector<std::future<void>> results;
+        {
+            Delegated tree({10});
+            for (int i = 0; i < 2000; i++) {
+                results.push_back(tree.execute(i % 20, [&executed](Tree&) { executed++; }));
+            }
+        }
+        CHECK_EQ(executed.load(), 2000);
+        for (auto& result : results) {
+            result.get();
+        }
+    }
+
+    std::puts("ok");
+    return 0;
+}
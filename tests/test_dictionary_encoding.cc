@@ -0,0 +1,170 @@
+/**
+ * @file test_dictionary_encoding.cc
+ * @brief 葉ノードのキーの辞書符号化のテスト
+ * @details g++ -std=c++17 -O2 -pthread tests/test_dictionary_encoding.cc && ./a.out
+ */
+#define BPLUSTREE_NO_MAIN
+#include "../b_pluss_tree.cc"
+#include "check.h"
+
+#include <random>
+#include <string>
+#include <string_view>
+
+using namespace std::literals;
+
+namespace {
+
+/**
+ * @brief string_view へ変換できない検索用の型 (符号化された葉を復号して比較する経路)
+ */
+struct Probe {
+    std::string text;
+};
+
+bool operator<(const std::string& a, const Probe& b) {
+    return a < b.text;
+}
+
+bool operator<(const Probe& a, const std::string& b) {
+    return a.text < b;
+}
+
+bool operator<(const Probe& a, const Probe& b) {
+    return a.text < b.text;
+}
+
+/**
+ * @brief KeyDictionary::compare() が std::string の順序と一致するか
+ */
+void checkDictionaryCompare() {
+    std::mt19937 rng(3);
+    const char* parts[] = {"a", "ab", "b", "bc", "zz"};
+    std::vector<std::string> keys;
+    for (int i = 0; i < 300; i++) {
+        std::string key;
+        int n = 1 + rng() % 3;
+        for (int j = 0; j < n; j++) {
+            if (j) {
+                key += '/';
+            }
+            key += parts[rng() % 5];
+        }
+        keys.push_back(key);
+    }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    auto buffer = BPlusTree::KeyDictionary::build(keys, '/');
+    BPlusTree::KeyDictionary dictionary(buffer);
+
+    std::vector<std::string> probes = keys;
+    for (const char* extra : {"", "a/", "ab/a/zzz", "b0", "zz/zz/zz/zz"}) {
+        probes.push_back(extra);
+    }
+    std::string decoded;
+    for (size_t i = 0; i < keys.size(); i++) {
+        dictionary.decodeInto(i, decoded);
+        CHECK_EQ(decoded, keys[i]);
+        for (auto& probe : probes) {
+            int actual = dictionary.compare(i, probe);
+            int expected = keys[i].compare(probe);
+            CHECK_EQ(actual < 0, expected < 0);
+            CHECK_EQ(actual == 0, expected == 0);
+        }
+    }
+}
+
+} // namespace
+
+int main() {
+    checkDictionaryCompare();
+
+    BPlusTree::BPlusTree<std::string, int> tree;
+    std::vector<std::string> keys;
+    const char* tenants[] = {"tenant_alpha", "tenant_beta", "tenant_gamma"};
+    const char* metrics[] = {"cpu", "memory", "network"};
+    for (int device = 0; device < 300; device++) {
+        for (auto tenant : tenants) {
+            for (auto metric : metrics) {
+                keys.push_back(std::string(tenant) + "/device_" + std::to_string(device) + "/" + metric);
+            }
+        }
+    }
+    std::mt19937 rng(1);
+    std::shuffle(keys.begin(), keys.end(), rng);
+    for (size_t i = 0; i < keys.size(); i++) {
+        tree.insert(keys[i], (int)i);
+    }
+    // separator 以下の文字 ('-' < '/') を含むキーの葉は符号化されない
+    tree.insert("bad-key/x", -1);
+
+    auto before = tree.keyMemoryUsage();
+    CHECK_EQ(before.encodedLeaves, 0u);
+    size_t encoded = tree.encodeKeys();
+    auto after = tree.keyMemoryUsage();
+    CHECK(encoded > 0 && encoded < after.leaves);
+    CHECK_EQ(after.encodedLeaves, encoded);
+    CHECK(after.bytes < before.bytes);
+
+    for (size_t i = 0; i < keys.size(); i++) {
+        CHECK(tree.search(keys[i]) == std::optional<int>((int)i));
+        CHECK(tree.search(std::string_view(keys[i])) == std::optional<int>((int)i));
+    }
+    CHECK(tree.search("bad-key/x"sv) == std::optional<int>(-1));
+    CHECK(!tree.search("tenant_alpha/device_1/zzz"sv));
+    CHECK(!tree.search("tenant_alpha/device_1"sv));
+
+    // 走査は元のキーを昇順で返す
+    std::vector<std::string> sorted = keys;
+    sorted.push_back("bad-key/x");
+    std::sort(sorted.begin(), sorted.end());
+    size_t index = 0;
+    tree.forEachInRange(BPlusTree::KeyRange<std::string>{}, [&](const std::string& key, int) {
+        CHECK_EQ(key, sorted[index++]);
+    });
+    CHECK_EQ(index, sorted.size());
+    index = 0;
+    tree.forEachInRange("tenant_beta"sv, "tenant_c"sv, [&](const std::string& key, int) {
+        CHECK(key.rfind("tenant_beta", 0) == 0);
+        index++;
+    });
+    CHECK_EQ(index, 900u);
+
+    // getMany は昇順の並びで葉を使い回す。string_view 以外の型では復号して比較する
+    std::vector<int> values(sorted.size());
+    std::vector<bool> found(sorted.size());
+    CHECK_EQ(tree.getMany(sorted.data(), sorted.size(), values.data(), found), sorted.size());
+    std::vector<Probe> probes;
+    for (auto& key : sorted) {
+        probes.push_back({key});
+    }
+    probes.push_back({"zzz"});
+    std::vector<int> probeValues(probes.size());
+    std::vector<bool> probeFound(probes.size());
+    CHECK_EQ(tree.getMany(probes.data(), probes.size(), probeValues.data(), probeFound), sorted.size());
+    CHECK(!probeFound.back());
+    for (size_t i = 0; i < sorted.size(); i++) {
+        CHECK_EQ(values[i], probeValues[i]);
+        CHECK(tree.search(probes[i]) == std::optional<int>(values[i]));
+    }
+
+    // 無いキーの削除、同じ値の書き込み、値だけの書き換えでは葉は符号化されたまま
+    CHECK(!tree.erase("tenant_alpha/device_1/zzz"s));
+    CHECK(!tree.erase(std::string_view("tenant_gamma/device_299/zzz")));
+    CHECK(tree.exchange(keys[0], 0) == std::optional<int>(0));
+    CHECK(tree.exchange(keys[1], -5) == std::optional<int>(1));
+    CHECK_EQ(tree.keyMemoryUsage().encodedLeaves, encoded);
+    CHECK(tree.search(keys[1]) == std::optional<int>(-5));
+    tree.insert(keys[1], 1);
+
+    // 書き換えた葉は通常の表現に戻る
+    tree.insert("tenant_beta/device_5/new", 7);
+    CHECK(tree.search("tenant_beta/device_5/new"sv) == std::optional<int>(7));
+    CHECK(tree.keyMemoryUsage().encodedLeaves < encoded);
+    for (size_t i = 0; i < keys.size(); i++) {
+        CHECK(tree.search(keys[i]) == std::optional<int>((int)i));
+    }
+
+    std::puts("ok");
+    return 0;
+}
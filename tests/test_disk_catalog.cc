@@ -0,0 +1,179 @@
+/**
+ * @file test_disk_catalog.cc
+ * @brief 1 つのファイルとバッファプールを共有する名前付きの木 (DiskCatalog) のテスト
+ * @details g++ -std=c++17 -O2 -pthread tests/test_disk_catalog.cc && ./a.out
+ */
+#define BPLUSTREE_NO_MAIN
+#include "../b_pluss_tree.cc"
+#include "check.h"
+
+#include <sys/wait.h>
+
+#include <thread>
+
+using Catalog = BPlusTree::DiskCatalog;
+template <typename K, typename V>
+using Disk = BPlusTree::DiskBPlusTree<K, V>;
+
+namespace {
+
+template <typename Tree>
+size_t countAll(Tree& tree) {
+    size_t count = 0;
+    tree.forEachInRange({}, [&](const auto&, const auto&) { count++; });
+    return count;
+}
+
+} // namespace
+
+int main() {
+    const std::string path = tempPath("catalog.db");
+    for (auto mode : {Catalog::Durability::InPlace, Catalog::Durability::ShadowPaging}) {
+        {
+            Catalog catalog;
+            CHECK(catalog.create(path, 32, true, mode));
+            std::vector<std::unique_ptr<Disk<int, int>>> small;
+            for (int t = 0; t < 40; t++) {
+                small.push_back(std::make_unique<Disk<int, int>>());
+                CHECK(small.back()->open(catalog, "idx" + std::to_string(t)));
+                for (int i = 0; i < 50 + t; i++) {
+                    small.back()->insert(i, t * 1000 + i);
+                }
+            }
+            // 同じ名前を 2 度開けない。型の違う木としても開けない
+            Disk<uint64_t, double> big;
+            CHECK(big.open(catalog, "big"));
+            Disk<uint64_t, double> duplicate;
+            CHECK(!duplicate.open(catalog, "big"));
+            Disk<int, int> wrongType;
+            CHECK(!wrongType.open(catalog, "big"));
+
+            // 大きい木への並行な書き込み、小さい木の走査、コミットを同時に行う
+            std::vector<std::thread> threads;
+            for (int w = 0; w < 4; w++) {
+                threads.emplace_back([&, w] {
+                    for (uint64_t i = w; i < 20000; i += 4) {
+                        big.insert(i, i * 0.5);
+                    }
+                });
+            }
+            threads.emplace_back([&] {
+                for (int round = 0; round < 20; round++) {
+                    for (auto& tree : small) {
+                        CHECK(countAll(*tree) >= 50);
+                    }
+                }
+            });
+            threads.emplace_back([&] {
+                for (int round = 0; round < 5; round++) {
+                    CHECK(catalog.flush());
+                }
+            });
+            for (auto& thread : threads) {
+                thread.join();
+            }
+            CHECK(catalog.flush());
+            CHECK_EQ(catalog.names().size(), 41u);
+            CHECK_EQ(big.size(), 20000u);
+            for (int t = 0; t < 40; t++) {
+                CHECK_EQ(small[t]->size(), (size_t)(50 + t));
+            }
+
+            // 1 つの木を小さくすると、ファイル全体を切り詰められる
+            for (uint64_t i = 0; i < 18000; i++) {
+                big.erase(i);
+            }
+            CHECK(catalog.flush());
+            uint32_t before = catalog.pageCount();
+            CHECK(catalog.compact(16) > 0);
+            CHECK(catalog.pageCount() < before);
+            CHECK_EQ(countAll(big), 2000u);
+            for (int t = 0; t < 40; t++) {
+                CHECK_EQ(countAll(*small[t]), (size_t)(50 + t));
+                CHECK(small[t]->search(7) == std::optional<int>(t * 1000 + 7));
+            }
+        }
+        {
+            Catalog catalog;
+            CHECK(catalog.open(path, 32, true, mode));
+            CHECK_EQ(catalog.names().size(), 41u);
+            Disk<uint64_t, double> big;
+            CHECK(big.open(catalog, "big"));
+            CHECK_EQ(big.size(), 2000u);
+            CHECK(big.search((uint64_t)19999) == std::optional<double>(19999 * 0.5));
+            Disk<int, int> seventh;
+            CHECK(seventh.open(catalog, "idx7"));
+            CHECK_EQ(seventh.size(), 57u);
+            CHECK(seventh.search(56) == std::optional<int>(7056));
+
+            // 開いていない木のページも正しく移して切り詰める
+            for (uint64_t i = 18000; i < 20000; i++) {
+                big.erase(i);
+            }
+            CHECK(catalog.flush());
+            catalog.compact();
+            Disk<int, int> ninth;
+            CHECK(ninth.open(catalog, "idx9"));
+            CHECK_EQ(countAll(ninth), 59u);
+            CHECK_EQ(countAll(seventh), 57u);
+            CHECK_EQ(big.size(), 0u);
+        }
+        if (mode == Catalog::Durability::ShadowPaging) {
+            // コミットせずに終わった書き込みと木の作成は残らない
+            pid_t pid = ::fork();
+            if (pid == 0) {
+                Catalog catalog;
+                if (!catalog.open(path, 8, true, mode)) {
+                    ::_exit(1);
+                }
+                Disk<int, int> existing;
+                Disk<int, int> created;
+                existing.open(catalog, "idx1");
+                created.open(catalog, "new");
+                for (int i = 0; i < 5000; i++) {
+                    existing.insert(i + 100000, 1);
+                    created.insert(i, i);
+                }
+                ::_exit(0);
+            }
+            int status = 0;
+            CHECK(::waitpid(pid, &status, 0) == pid);
+            CHECK(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+            Catalog catalog;
+            CHECK(catalog.open(path, 32, true, mode));
+            CHECK_EQ(catalog.names().size(), 41u);
+            Disk<int, int> existing;
+            CHECK(existing.open(catalog, "idx1"));
+            CHECK_EQ(existing.size(), 51u);
+            CHECK_EQ(countAll(existing), 51u);
+        }
+    }
+
+    // build() のファイルは名前が空の木を 1 つ持つカタログ
+    BPlusTree::BPlusTree<int, int> tree;
+    for (int i = 0; i < 1000; i++) {
+        tree.insert(i, i);
+    }
+    CHECK((Disk<int, int>::build(tree, path)));
+    {
+        Catalog catalog;
+        CHECK(catalog.open(path));
+        auto names = catalog.names();
+        CHECK(names.size() == 1 && names[0].empty());
+        Disk<int, int> unnamed;
+        CHECK(unnamed.open(catalog, ""));
+        CHECK_EQ(unnamed.size(), 1000u);
+        Disk<int, int> extra;
+        CHECK(extra.open(catalog, "extra"));
+        extra.insert(1, 2);
+    }
+    {
+        Disk<int, int> standalone;
+        CHECK(standalone.open(path));
+        CHECK_EQ(countAll(standalone), 1000u);
+    }
+
+    std::remove(path.c_str());
+    std::puts("ok");
+    return 0;
+}
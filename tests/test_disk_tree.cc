@@ -0,0 +1,125 @@
+/**
+ * @file test_disk_tree.cc
+ * @brief ページファイルへ書き出した木 (DiskBPlusTree) の読み出しのテスト
+ * @details O_DIRECT と通常の I/O の両方で開き、元の木と同じ内容が読めるか確かめる。
+ *          書き出し中に元の木へ書き込めることも確かめる。
+ *          g++ -std=c++17 -O2 -pthread tests/test_disk_tree.cc && ./a.out
+ */
+#define BPLUSTREE_NO_MAIN
+#include "../b_pluss_tree.cc"
+#include "check.h"
+
+#include <random>
+#include <thread>
+
+using BPlusTree::DiskBPlusTree;
+
+namespace {
+
+/**
+ * @brief 元の木への書き込みと並行して build() する
+ * @details build() はラッチを放しながら区切って読むので、区切りの間で木が
+ *          変わっても、書き出し前からあるキーはすべて 1 回ずつ昇順に含まれ、
+ *          それ以外は書き出し中に挿入されたキーだけが含まれること
+ */
+void checkBuildDuringWrites(const std::string& path) {
+    const int n = 8000;
+    BPlusTree::BPlusTree<int64_t, int64_t> tree;
+    for (int i = 0; i < n; i++) {
+        tree.insert((int64_t)i * 2, i);
+    }
+    std::atomic<bool> building{true};
+    std::atomic<int> duringBuild{0};
+    std::thread writer([&] {
+        for (int i = 0; building; i++) {
+            tree.insert((int64_t)(i % n) * 2 + 1, -i);
+            tree.erase((int64_t)((i * 7) % n) * 2 + 1);
+            duringBuild++;
+        }
+    });
+    // 書き込みが始まってから書き出す
+    while (duringBuild == 0) {
+        std::this_thread::yield();
+    }
+    int before = duringBuild;
+    CHECK((DiskBPlusTree<int64_t, int64_t>::build(tree, path, true)));
+    int after = duringBuild;
+    building = false;
+    writer.join();
+    CHECK(after > before);
+
+    DiskBPlusTree<int64_t, int64_t> disk;
+    CHECK(disk.open(path, 64, true));
+    for (int i = 0; i < n; i++) {
+        CHECK(disk.search((int64_t)i * 2) == std::optional<int64_t>(i));
+    }
+    int64_t previous = -1;
+    size_t count = 0;
+    disk.forEachInRange({}, [&](int64_t key, int64_t value) {
+        CHECK(key > previous);
+        if (key % 2 != 0) {
+            CHECK(value <= 0);
+        }
+        previous = key;
+        count++;
+    });
+    CHECK_EQ(count, disk.size());
+    CHECK(count >= (size_t)n);
+}
+
+} // namespace
+
+int main() {
+    const int n = 20000;
+    const std::string path = tempPath("disk.db");
+    BPlusTree::BPlusTree<int64_t, int64_t> tree;
+    for (int i = 0; i < n; i++) {
+        tree.insert((int64_t)i * 3, i);
+    }
+    CHECK((DiskBPlusTree<int64_t, int64_t>::build(tree, path, true)));
+
+    for (bool direct : {false, true}) {
+        // 全体より小さいプールで、追い出しを起こしながら読む
+        DiskBPlusTree<int64_t, int64_t> disk;
+        CHECK(disk.open(path, 64, direct));
+        CHECK_EQ(disk.size(), (uint64_t)n);
+        for (int i = 0; i < n; i++) {
+            CHECK(disk.search((int64_t)i * 3) == std::optional<int64_t>(i));
+            CHECK(!disk.search((int64_t)i * 3 + 1));
+        }
+        CHECK(disk.pool().misses() > 0);
+
+        int64_t previous = -1;
+        size_t count = 0;
+        disk.forEachInRange({(int64_t)30, (int64_t)3000}, [&](int64_t key, int64_t value) {
+            CHECK(key > previous && key >= 30 && key < 3000);
+            CHECK_EQ(value, key / 3);
+            previous = key;
+            count++;
+        });
+        CHECK_EQ(count, 990u);
+        count = 0;
+        CHECK(!disk.forEachInRange({}, [&](int64_t, int64_t) { return ++count < 10; }));
+        CHECK_EQ(count, 10u);
+    }
+
+    // 空の木、存在しないファイル、型の違うファイル
+    const std::string emptyPath = tempPath("empty.db");
+    BPlusTree::BPlusTree<int64_t, int64_t> empty;
+    CHECK((DiskBPlusTree<int64_t, int64_t>::build(empty, emptyPath)));
+    DiskBPlusTree<int64_t, int64_t> emptyDisk;
+    CHECK(emptyDisk.open(emptyPath));
+    CHECK(!emptyDisk.search((int64_t)1));
+    CHECK(emptyDisk.forEachInRange({}, [&](int64_t, int64_t) { CHECK(false); }));
+    DiskBPlusTree<int64_t, int64_t> missing;
+    CHECK(!missing.open(tempPath("missing.db")));
+    DiskBPlusTree<int, int> wrongType;
+    CHECK(!wrongType.open(path));
+
+    checkBuildDuringWrites(path);
+
+    std::remove(path.c_str());
+    std::remove(emptyPath.c_str());
+    std::puts("ok");
+    return 0;
+}
@@ -0,0 +1,57 @@
+/**
+ * @file test_for_each_in_range.cc
+ * @brief forEachInRange() の内部イテレーションのテスト
+ * @details g++ -std=c++17 -O2 -pthread tests/test_for_each_in_range.cc && ./a.out
+ */
+#define BPLUSTREE_NO_MAIN
+#include "../b_pluss_tree.cc"
+#include "check.h"
+
+int main() {
+    BPlusTree::BPlusTree<> tree;
+    for (int i = 0; i < 1000; i++) {
+        tree.insert(i * 2, i);
+    }
+
+    // 1 要素ずつ受け取る形: [lo, hi) の要素を昇順に
+    std::vector<int> keys;
+    CHECK(tree.forEachInRange(10, 21, [&](int key, int value) {
+        CHECK_EQ(value, key / 2);
+        keys.push_back(key);
+    }));
+    CHECK((keys == std::vector<int>{10, 12, 14, 16, 18, 20}));
+
+    // false を返すとそこで打ち切り、戻り値も false になる
+    int visited = 0;
+    CHECK(!tree.forEachInRange({}, [&](int, int) { return ++visited < 5; }));
+    CHECK_EQ(visited, 5);
+
+    // 葉ごとの連続領域を受け取る形: 範囲の端で切られ、合計は要素数に一致する
+    size_t total = 0;
+    int previous = -1;
+    CHECK(tree.forEachInRange(3, 1500, [&](const int* k, const int* v, size_t count) {
+        CHECK(count > 0);
+        CHECK(k[0] >= 3 && k[count - 1] < 1500);
+        CHECK(k[0] > previous);
+        for (size_t i = 0; i < count; i++) {
+            CHECK_EQ(v[i], k[i] / 2);
+        }
+        previous = k[count - 1];
+        total += count;
+    }));
+    CHECK_EQ(total, 748u);
+
+    // 連続領域の形でも打ち切れる
+    size_t spans = 0;
+    CHECK(!tree.forEachInRange({}, [&](const int*, const int*, size_t) { return ++spans < 3; }));
+    CHECK_EQ(spans, 3u);
+
+    // 空の範囲と空の木では visitor を呼ばない
+    CHECK(tree.forEachInRange(10, 5, [&](int, int) { CHECK(false); }));
+    CHECK(tree.forEachInRange(2001, 3000, [&](int, int) { CHECK(false); }));
+    BPlusTree::BPlusTree<> empty;
+    CHECK(empty.forEachInRange({}, [&](int, int) { CHECK(false); }));
+
+    std::puts("ok");
+    return 0;
+}
@@ -0,0 +1,82 @@
+/**
+ * @file test_heterogeneous_lookup.cc
+ * @brief std::string キーの木を Key 以外の型で引くテスト
+ * @details Probe は std::string へ変換できないので、コンパイルが通ること自体が
+ *          キーを作らずに比較していることの確認になる。
+ *          g++ -std=c++17 -O2 -pthread tests/test_heterogeneous_lookup.cc && ./a.out
+ */
+#define BPLUSTREE_NO_MAIN
+#include "../b_pluss_tree.cc"
+#include "check.h"
+
+#include <string>
+#include <string_view>
+
+using namespace std::literals;
+
+namespace {
+
+/**
+ * @brief "k" + 4 桁の番号で表されるキーを、文字列を作らずに比較する型
+ */
+struct Probe {
+    int number;
+};
+
+int compareProbe(const std::string& key, const Probe& probe) {
+    char digits[8];
+    std::snprintf(digits, sizeof(digits), "k%04d", probe.number);
+    return key.compare(digits);
+}
+
+bool operator<(const std::string& key, const Probe& probe) {
+    return compareProbe(key, probe) < 0;
+}
+
+bool operator<(const Probe& probe, const std::string& key) {
+    return compareProbe(key, probe) > 0;
+}
+
+} // namespace
+
+int main() {
+    BPlusTree::BPlusTree<std::string, int> tree;
+    for (int i = 0; i < 500; i++) {
+        char key[16];
+        std::snprintf(key, sizeof(key), "k%04d", i * 2);
+        tree.insert(key, i);
+    }
+
+    // string_view と文字列リテラル
+    CHECK(tree.search("k0010"sv) == std::optional<int>(5));
+    CHECK(!tree.search("k0011"sv));
+    CHECK(tree.search("k0998") == std::optional<int>(499));
+
+    // std::string へ変換できない型
+    CHECK(tree.search(Probe{10}) == std::optional<int>(5));
+    CHECK(!tree.search(Probe{11}));
+    auto lower = tree.lowerBound(Probe{11});
+    CHECK(lower && lower->first == "k0012");
+    CHECK(!tree.lowerBound("z"sv));
+
+    int visited = 0;
+    tree.forEachInRange(Probe{100}, Probe{200}, [&](const std::string&, int) { visited++; });
+    CHECK_EQ(visited, 50);
+
+    std::string_view probes[] = {"k0000", "k0001", "k0002", "k0500"};
+    int values[4];
+    std::vector<bool> found(4);
+    CHECK_EQ(tree.getMany(probes, 4, values, found), 3u);
+    CHECK(found[0] && !found[1] && found[2] && found[3]);
+    CHECK_EQ(values[3], 250);
+
+    std::string keyBuffer[8];
+    int valueBuffer[8];
+    auto result = tree.scanInto("k0100"sv, "k0200"sv, keyBuffer, valueBuffer, 8);
+    CHECK_EQ(result.count, 8u);
+    CHECK(result.resumeKey && *result.resumeKey == "k0116");
+    CHECK_EQ(keyBuffer[0], "k0100");
+
+    std::puts("ok");
+    return 0;
+}
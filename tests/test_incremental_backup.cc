@@ -0,0 +1,114 @@
+/**
+ * @file test_incremental_backup.cc
+ * @brief 差分バックアップと、全体バックアップからの連鎖した復元のテスト
+ * @details g++ -std=c++17 -O2 -pthread tests/test_incremental_backup.cc && ./a.out
+ */
+#define BPLUSTREE_NO_MAIN
+#include "../b_pluss_tree.cc"
+#include "check.h"
+
+#include <map>
+#include <random>
+
+namespace {
+
+using Tree = BPlusTree::BPlusTree<int, long>;
+
+std::map<int, long> dump(Tree& tree) {
+    std::map<int, long> state;
+    tree.forEachInRange(BPlusTree::KeyRange<int>{}, [&](int key, long value) { state[key] = value; });
+    return state;
+}
+
+long fileSize(const std::string& path) {
+    return (long)std::filesystem::file_size(path);
+}
+
+} // namespace
+
+int main() {
+    Tree tree;
+    std::mt19937 rng(1);
+    for (int i = 0; i < 5000; i++) {
+        tree.insert(rng() % 20000, i);
+    }
+    const std::string base = tempPath("full.bin");
+    auto baseSnapshot = tree.backup(base);
+    CHECK(baseSnapshot);
+    auto baseState = dump(tree);
+
+    // 削除を含む書き換えのたびに差分を取る
+    std::vector<std::string> incrementals;
+    std::vector<std::map<int, long>> states;
+    uint64_t last = *baseSnapshot;
+    for (int round = 0; round < 4; round++) {
+        for (int i = 0; i < 300; i++) {
+            int key = rng() % 20000;
+            if (rng() % 3 == 0) {
+                tree.erase(key);
+            } else {
+                tree.insert(key, round * 100000 + i);
+            }
+        }
+        std::string path = tempPath("incremental" + std::to_string(round) + ".bin");
+        auto snapshot = tree.incrementalBackup(last, path);
+        CHECK(snapshot && *snapshot > last);
+        last = *snapshot;
+        incrementals.push_back(path);
+        states.push_back(dump(tree));
+    }
+
+    // 書き換えていない葉は差分に含まれない
+    CHECK(fileSize(incrementals[0]) < fileSize(base));
+
+    // 連鎖の途中までの復元は、それぞれの時点の状態になる
+    for (size_t n = 0; n <= incrementals.size(); n++) {
+        Tree restored;
+        std::vector<std::string> chain(incrementals.begin(), incrementals.begin() + n);
+        CHECK(restored.restore(base, chain));
+        CHECK(dump(restored) == (n == 0 ? baseState : states[n - 1]));
+    }
+
+    // 書き換えがなければ差分は空
+    std::string unchanged = tempPath("unchanged.bin");
+    auto snapshot = tree.incrementalBackup(last, unchanged);
+    CHECK(snapshot);
+    Tree restored;
+    std::vector<std::string> chain = incrementals;
+    chain.push_back(unchanged);
+    CHECK(restored.restore(base, chain));
+    CHECK(dump(restored) == states.back());
+
+    // 無いキーの削除と同じ値の書き込みは葉を書き換えないので、差分は空のまま
+    for (int key = -100; key < 0; key++) {
+        CHECK(!tree.erase(key));
+    }
+    for (auto& [key, value] : states.back()) {
+        tree.insert(key, value);
+    }
+    std::string noops = tempPath("noops.bin");
+    auto noopSnapshot = tree.incrementalBackup(*snapshot, noops);
+    CHECK(noopSnapshot);
+    CHECK_EQ(fileSize(noops), fileSize(unchanged));
+    chain.push_back(noops);
+    Tree restoredNoops;
+    CHECK(restoredNoops.restore(base, chain));
+    CHECK(dump(restoredNoops) == states.back());
+
+    // 連鎖が途切れている、差分を全体として使う、未知のスナップショットから取る
+    Tree bad;
+    CHECK(!bad.restore(base, {incrementals[1]}));
+    CHECK(dump(bad).empty());
+    CHECK(!bad.restore(incrementals[0]));
+    CHECK(!tree.incrementalBackup(0, tempPath("invalid.bin")));
+
+    for (auto& path : incrementals) {
+        std::remove(path.c_str());
+    }
+    std::remove(base.c_str());
+    std::remove(unchanged.c_str());
+    std::remove(noops.c_str());
+    std::remove(tempPath("invalid.bin").c_str());
+    std::puts("ok");
+    return 0;
+}
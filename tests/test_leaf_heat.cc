@@ -0,0 +1,142 @@
+/**
+ * @file test_leaf_heat.cc
+ * @brief leafHeat() が返す葉ノードごとの書き込み回数と待ち時間のテスト
+ * @details g++ -std=c++17 -O2 -pthread tests/test_leaf_heat.cc && ./a.out
+ */
+#define BPLUSTREE_NO_MAIN
+#include "../b_pluss_tree.cc"
+#include "check.h"
+
+#include <thread>
+
+using Tree = BPlusTree::BPlusTree<int, int>;
+
+namespace {
+
+/**
+ * @brief key を含む葉の位置
+ * @param heat
+ * @param key
+ * @return size_t
+ */
+size_t leafOf(const std::vector<BPlusTree::LeafHeat<int>>& heat, int key) {
+    size_t found = 0;
+    for (size_t i = 0; i < heat.size(); i++) {
+        if (heat[i].firstKey && *heat[i].firstKey <= key) {
+            found = i;
+        }
+    }
+    return found;
+}
+
+} // namespace
+
+int main() {
+    Tree tree;
+    CHECK(tree.leafHeat().empty());
+    for (int i = 0; i < 1000; i++) {
+        tree.insert(i, i);
+    }
+
+    // 葉はキー順に並び、キーの数の合計は木の要素数になる
+    auto before = tree.leafHeat();
+    CHECK(before.size() > 100);
+    size_t total = 0;
+    for (size_t i = 0; i < before.size(); i++) {
+        total += before[i].size;
+        if (i > 0) {
+            CHECK(*before[i - 1].firstKey < *before[i].firstKey);
+        }
+        // 1 スレッドなら更新は待たない
+        CHECK_EQ(before[i].waitNanos, 0u);
+    }
+    CHECK_EQ(total, 1000u);
+
+    // 1 つのキーへ書き続けると、その葉だけが熱くなる
+    const int hot = 500;
+    for (int i = 0; i < 5000; i++) {
+        tree.insert(hot, i);
+    }
+    CHECK(!tree.erase(hot + 10000));
+    auto after = tree.leafHeat();
+    CHECK_EQ(after.size(), before.size());
+    size_t h = leafOf(after, hot);
+    CHECK(h > 0 && h + 1 < after.size());
+    CHECK_EQ(after[h].writes - before[h].writes, 5000u);
+    CHECK_EQ(after[h - 1].writes, before[h - 1].writes);
+    CHECK_EQ(after[h + 1].writes, before[h + 1].writes);
+    CHECK(after[h].writes > after[h - 1].writes);
+    CHECK(after[h].writes > after[h + 1].writes);
+
+    // 共有ラッチを持つ読み取りの後ろで待った更新の時間は、書き換えた葉に数える
+    std::atomic<bool> holding{false};
+    std::atomic<bool> writerStarted{false};
+    std::thread reader([&] {
+        tree.forEachInRange(BPlusTree::KeyRange<int>{0, 1}, [&](int, int) {
+            holding = true;
+            while (!writerStarted) {
+                std::this_thread::yield();
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        });
+    });
+    std::thread writer([&] {
+        while (!holding) {
+            std::this_thread::yield();
+        }
+        writerStarted = true;
+        tree.insert(hot, -1);
+    });
+    reader.join();
+    writer.join();
+    auto waited = tree.leafHeat();
+    CHECK(waited[h].waitNanos >= 1000000u);
+    CHECK_EQ(waited[h - 1].waitNanos, 0u);
+    CHECK_EQ(waited[h + 1].waitNanos, 0u);
+
+    // 待ち行列があるときも、並んだ時間を含めて数える
+    tree.enableWriterQueue();
+    holding = false;
+    writerStarted = false;
+    std::thread queuedReader([&] {
+        tree.forEachInRange(BPlusTree::KeyRange<int>{0, 1}, [&](int, int) {
+            holding = true;
+            while (!writerStarted) {
+                std::this_thread::yield();
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        });
+    });
+    std::thread queuedWriter([&] {
+        while (!holding) {
+            std::this_thread::yield();
+        }
+        writerStarted = true;
+        tree.insert(hot, -2);
+    });
+    queuedReader.join();
+    queuedWriter.join();
+    auto queued = tree.leafHeat();
+    CHECK(queued[h].waitNanos >= waited[h].waitNanos + 1000000u);
+    CHECK_EQ(queued[h - 1].waitNanos, 0u);
+
+    // 分割すると両方の半分で折半する
+    Tree small;
+    for (int i = 0; i < 3; i++) {
+        small.insert(i * 10, 0);
+    }
+    for (int i = 1; i <= 100; i++) {
+        small.insert(0, i);
+    }
+    auto one = small.leafHeat();
+    CHECK_EQ(one.size(), 1u);
+    CHECK(one[0].writes >= 100);
+    small.insert(5, 0);
+    auto two = small.leafHeat();
+    CHECK_EQ(two.size(), 2u);
+    CHECK_EQ(two[0].writes + two[1].writes, one[0].writes + 1);
+    CHECK(two[0].writes >= 50 && two[1].writes >= 50);
+
+    std::puts("ok");
+    return 0;
+}
@@ -0,0 +1,155 @@
+/**
+ * @file test_mcs_latch.cc
+ * @brief 更新が並ぶキュー型ラッチ McsLatch のテスト
+ * @details g++ -std=c++17 -O2 -pthread tests/test_mcs_latch.cc && ./a.out
+ */
+#define BPLUSTREE_NO_MAIN
+#include "../b_pluss_tree.cc"
+#include "check.h"
+
+#include <thread>
+#include <vector>
+
+using BPlusTree::McsLatch;
+using Tree = BPlusTree::BPlusTree<int, int>;
+
+/**
+ * @brief threads 本のスレッドで、ラッチの中から守られていないカウンタを増やす
+ * @param latch
+ * @param threads
+ * @param iterations スレッドごとの回数
+ */
+void hammer(McsLatch& latch, int threads, int iterations) {
+    long counter = 0;
+    std::atomic<int> inside{0};
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&] {
+            for (int i = 0; i < iterations; i++) {
+                McsLatch::Guard guard(latch);
+                CHECK_EQ(inside.fetch_add(1), 0);
+                counter++;
+                inside.fetch_sub(1);
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    CHECK_EQ(counter, static_cast<long>(threads) * iterations);
+}
+
+/**
+ * @brief 眠ったスレッドが延べ parked 回になるまで待つ
+ * @param latch
+ * @param parked
+ */
+void waitParked(const McsLatch& latch, uint64_t parked) {
+    while (latch.stats().parked < parked) {
+        std::this_thread::yield();
+    }
+}
+
+int main() {
+    // 競合がなければ、取得は数えても競合も眠りもしない
+    {
+        McsLatch latch;
+        for (int i = 0; i < 10; i++) {
+            McsLatch::Guard guard(latch);
+        }
+        auto stats = latch.stats();
+        CHECK_EQ(stats.acquisitions, 10u);
+        CHECK_EQ(stats.contended, 0u);
+        CHECK_EQ(stats.parked, 0u);
+    }
+
+    // 回る回数によらず排他する
+    for (uint32_t budget : {0u, 64u, McsLatch::defaultSpinBudget()}) {
+        McsLatch latch(budget);
+        hammer(latch, 8, 5000);
+        auto stats = latch.stats();
+        CHECK_EQ(stats.acquisitions, 40000u);
+        CHECK(stats.parked <= stats.contended);
+    }
+
+    // kSpinForever は眠らない (1 コアでは横取りされるまで回るので回数は控えめ)
+    {
+        McsLatch latch(McsLatch::kSpinForever);
+        hammer(latch, 2, 500);
+        CHECK_EQ(latch.stats().parked, 0u);
+    }
+
+    // 先に眠った方から順に渡る
+    {
+        McsLatch latch(0);
+        std::vector<int> order;
+        std::vector<std::thread> waiters;
+        {
+            McsLatch::Guard holder(latch);
+            for (int id = 0; id < 4; id++) {
+                waiters.emplace_back([&, id] {
+                    McsLatch::Guard guard(latch);
+                    order.push_back(id);
+                });
+                waitParked(latch, id + 1);
+            }
+            auto stats = latch.stats();
+            CHECK_EQ(stats.contended, 4u);
+            CHECK_EQ(stats.parked, 4u);
+        }
+        for (auto& waiter : waiters) {
+            waiter.join();
+        }
+        CHECK((order == std::vector<int>{0, 1, 2, 3}));
+    }
+
+    // 既定の木には待ち行列がない
+    {
+        Tree tree;
+        tree.insert(1, 1);
+        tree.erase(1);
+        auto stats = tree.writerLatchStats();
+        CHECK_EQ(stats.acquisitions, 0u);
+        CHECK_EQ(stats.contended, 0u);
+        CHECK_EQ(stats.parked, 0u);
+    }
+
+    // 待ち行列を有効にした木の更新は 1 回ずつ並び、読み取りは並ばない
+    {
+        Tree tree;
+        tree.enableWriterQueue();
+        for (int i = 0; i < 1000; i++) {
+            tree.insert(i, i);
+        }
+        for (int i = 0; i < 1000; i += 2) {
+            tree.erase(i);
+        }
+        for (int i = 0; i < 1000; i++) {
+            tree.search(i);
+        }
+        auto stats = tree.writerLatchStats();
+        CHECK_EQ(stats.acquisitions, 1500u);
+        CHECK_EQ(stats.contended, 0u);
+
+        std::vector<std::thread> writers;
+        for (int t = 0; t < 4; t++) {
+            writers.emplace_back([&, t] {
+                for (int i = 0; i < 2000; i++) {
+                    tree.insert(10000 + t * 2000 + i, t);
+                }
+            });
+        }
+        for (auto& writer : writers) {
+            writer.join();
+        }
+        CHECK_EQ(tree.writerLatchStats().acquisitions, 1500u + 8000u);
+        for (int t = 0; t < 4; t++) {
+            for (int i = 0; i < 2000; i += 97) {
+                CHECK(tree.search(10000 + t * 2000 + i) == std::optional<int>(t));
+            }
+        }
+    }
+
+    std::puts("ok");
+    return 0;
+}
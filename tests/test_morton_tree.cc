@@ -0,0 +1,63 @@
+/**
+ * @file test_morton_tree.cc
+ * @brief MortonTree の符号化と矩形検索のテスト
+ * @details 矩形検索の結果を全点の総当たりと比べる。
+ *          g++ -std=c++17 -O2 -pthread tests/test_morton_tree.cc && ./a.out
+ */
+#define BPLUSTREE_NO_MAIN
+#include "../b_pluss_tree.cc"
+#include "check.h"
+
+#include <random>
+#include <set>
+
+int main() {
+    using Point = std::pair<uint32_t, uint32_t>;
+    BPlusTree::MortonTree<int> tree;
+    std::mt19937 rng(3);
+    std::vector<Point> points;
+    for (int i = 0; i < 10000; i++) {
+        uint32_t x = rng() % 1000;
+        uint32_t y = rng() % 1000;
+        points.push_back({x, y});
+        tree.insert(x, y, i);
+    }
+
+    for (auto [x, y] : points) {
+        CHECK(tree.decode(tree.encode(x, y)) == Point(x, y));
+    }
+    CHECK_EQ(tree.encode(1, 0), 1u);
+    CHECK_EQ(tree.encode(0, 1), 2u);
+    CHECK(tree.decode(tree.encode(UINT32_MAX, 12345)) == Point(UINT32_MAX, 12345));
+
+    auto query = [&](uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1) {
+        std::set<Point> expected;
+        for (auto& p : points) {
+            if (p.first >= x0 && p.first <= x1 && p.second >= y0 && p.second <= y1) {
+                expected.insert(p);
+            }
+        }
+        std::set<Point> actual;
+        CHECK(tree.boxQuery(x0, y0, x1, y1, [&](uint32_t x, uint32_t y, int) {
+            CHECK(x >= x0 && x <= x1 && y >= y0 && y <= y1);
+            actual.insert({x, y});
+        }));
+        CHECK(actual == expected);
+    };
+    for (int q = 0; q < 200; q++) {
+        uint32_t a = rng() % 1000, b = rng() % 1000, c = rng() % 1000, d = rng() % 1000;
+        query(std::min(a, b), std::min(c, d), std::max(a, b), std::max(c, d));
+    }
+    // 細長い矩形と 1 点だけの矩形
+    query(0, 500, 999, 500);
+    query(500, 0, 500, 999);
+    query(points[0].first, points[0].second, points[0].first, points[0].second);
+
+    // 打ち切り
+    int visited = 0;
+    CHECK(!tree.boxQuery(0, 0, UINT32_MAX, UINT32_MAX, [&](uint32_t, uint32_t, int) { return ++visited < 10; }));
+    CHECK_EQ(visited, 10);
+
+    std::puts("ok");
+    return 0;
+}
@@ -0,0 +1,63 @@
+/**
+ * @file test_partition.cc
+ * @brief partition() と並列アルゴリズムのテスト
+ * @details g++ -std=c++17 -O2 -pthread tests/test_partition.cc && ./a.out
+ */
+#define BPLUSTREE_NO_MAIN
+#include "../b_pluss_tree.cc"
+#include "check.h"
+
+#include <atomic>
+
+int main() {
+    BPlusTree::BPlusTree<> tree;
+    const int n = 10000;
+    for (int i = 0; i < n; i++) {
+        tree.insert((i * 7919) % 10007, i);
+    }
+
+    // 部分範囲は昇順に隣接し、合わせると元の範囲を過不足なく覆う
+    for (int parts : {1, 2, 3, 8, 64}) {
+        auto ranges = tree.partition({100, 9000}, parts);
+        CHECK(!ranges.empty());
+        CHECK(ranges.size() <= (size_t)parts);
+        CHECK(ranges.front().lo == std::optional<int>(100));
+        CHECK(ranges.back().hi == std::optional<int>(9000));
+        size_t total = 0;
+        for (size_t i = 0; i < ranges.size(); i++) {
+            if (i > 0) {
+                CHECK(ranges[i - 1].hi == ranges[i].lo);
+            }
+            total += tree.parallelCountIf(ranges[i], [](int, int) { return true; }, 1);
+        }
+        size_t expected = 0;
+        tree.forEachInRange(BPlusTree::KeyRange<int>{100, 9000}, [&](int, int) { expected++; });
+        CHECK_EQ(total, expected);
+        if (parts > 1) {
+            CHECK(ranges.size() > 1);
+        }
+    }
+
+    // 空の木と片側だけ開いた範囲
+    BPlusTree::BPlusTree<> empty;
+    CHECK_EQ(empty.partition({}, 4).size(), 1u);
+    CHECK_EQ(empty.parallelCountIf({}, [](int, int) { return true; }, 4), 0u);
+
+    long sum = tree.parallelTransformReduce({}, 5L, std::plus<long>(),
+                                            [](int key, int) { return (long)key; }, 4);
+    long expected = 5;
+    for (int i = 0; i < n; i++) {
+        expected += (i * 7919) % 10007;
+    }
+    CHECK_EQ(sum, expected);
+
+    std::atomic<long> visited{0};
+    tree.parallelForEach({std::nullopt, 5000}, [&](int key, int) {
+        CHECK(key < 5000);
+        visited++;
+    }, 3);
+    CHECK_EQ((size_t)visited.load(), tree.parallelCountIf({}, [](int key, int) { return key < 5000; }, 5));
+
+    std::puts("ok");
+    return 0;
+}
@@ -0,0 +1,116 @@
+/**
+ * @file test_range_watch.cc
+ * @brief 範囲の監視と、まとめて配送される変更通知のテスト
+ * @details g++ -std=c++17 -O2 -pthread tests/test_range_watch.cc && ./a.out
+ */
+#define BPLUSTREE_NO_MAIN
+#include "../b_pluss_tree.cc"
+#include "check.h"
+
+#include <chrono>
+#include <map>
+#include <random>
+#include <thread>
+
+namespace {
+
+struct Watch {
+    int lo;
+    int hi;
+    std::map<int, std::optional<int>> seen;
+    int batches = 0;
+};
+
+/**
+ * @brief 木を書き換えるコールバックの実行中に unwatch() してもデッドロックしない
+ */
+void checkUnwatchDuringWritingCallback() {
+    BPlusTree::BPlusTree<> tree;
+    std::atomic<int> calls{0};
+    uint64_t id = tree.watch(0, 100, [&](const auto&) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        tree.insert(1000 + calls++, 1);
+    });
+    tree.insert(5, 5);
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    std::thread unwatcher([&] { CHECK(tree.unwatch(id)); });
+    std::thread writer([&] {
+        for (int i = 0; i < 50; i++) {
+            tree.insert(i, i);
+        }
+    });
+    unwatcher.join();
+    writer.join();
+    int after = calls.load();
+    tree.insert(6, 6);
+    tree.flushWatches();
+    CHECK_EQ(calls.load(), after);
+}
+
+} // namespace
+
+int main() {
+    BPlusTree::BPlusTree<> tree;
+    std::mt19937 rng(9);
+    std::vector<Watch> watches(50);
+    std::vector<uint64_t> ids;
+    for (auto& watch : watches) {
+        int a = rng() % 1000;
+        int b = rng() % 1000;
+        watch.lo = std::min(a, b);
+        watch.hi = std::max(a, b) + 1;
+        ids.push_back(tree.watch(watch.lo, watch.hi, [&watch](const auto& changes) {
+            CHECK(!changes.empty());
+            watch.batches++;
+            for (auto& change : changes) {
+                CHECK(change.key >= watch.lo && change.key < watch.hi);
+                watch.seen[change.key] = change.value;
+            }
+        }));
+    }
+    size_t unbounded = 0;
+    tree.watch(BPlusTree::KeyRange<int>{}, [&](const auto& changes) { unbounded += changes.size(); });
+
+    std::map<int, std::optional<int>> last;
+    size_t mutations = 0;
+    for (int i = 0; i < 20000; i++) {
+        int key = rng() % 1000;
+        if (rng() % 3 == 0) {
+            if (tree.erase(key)) {
+                last[key] = std::nullopt;
+                mutations++;
+            }
+        } else {
+            tree.insert(key, i);
+            last[key] = i;
+            mutations++;
+        }
+    }
+    tree.flushWatches();
+
+    // 各監視は範囲内のキーの最後の状態を受け取り、範囲外のキーは受け取らない
+    for (auto& watch : watches) {
+        for (auto& [key, value] : last) {
+            if (key >= watch.lo && key < watch.hi) {
+                CHECK(watch.seen.count(key) && watch.seen[key] == value);
+            }
+        }
+        for (auto& [key, value] : watch.seen) {
+            CHECK(last.count(key));
+        }
+    }
+    CHECK_EQ(unbounded, mutations);
+
+    // 解除後は呼ばれない
+    CHECK(tree.unwatch(ids[0]));
+    CHECK(!tree.unwatch(ids[0]));
+    int before = watches[0].batches;
+    tree.insert(watches[0].lo, 1);
+    tree.flushWatches();
+    CHECK_EQ(watches[0].batches, before);
+
+    checkUnwatchDuringWritingCallback();
+
+    std::puts("ok");
+    return 0;
+}
@@ -0,0 +1,114 @@
+/**
+ * @file test_read_ahead.cc
+ * @brief DiskBPlusTree の範囲走査の先読みのテスト
+ * @details 先読みの有無で走査の結果が変わらないこと、範囲の上限を越えて
+ *          先読みしないこと、並行した走査が互いを待ち続けないことを確かめる。
+ *          g++ -std=c++17 -O2 -pthread tests/test_read_ahead.cc && ./a.out
+ */
+#define BPLUSTREE_NO_MAIN
+#include "../b_pluss_tree.cc"
+#include "check.h"
+
+#include <thread>
+
+using Disk = BPlusTree::DiskBPlusTree<int64_t, int64_t>;
+
+int main() {
+    const int n = 20000;
+    const std::string path = tempPath("read_ahead.db");
+    BPlusTree::BPlusTree<int64_t, int64_t> tree;
+    for (int i = 0; i < n; i++) {
+        tree.insert((int64_t)i * 3, i);
+    }
+    CHECK(Disk::build(tree, path));
+
+    // 根から葉までの読み込み回数 (冷えたプールで 1 件引く)
+    uint64_t depth = 0;
+    {
+        Disk disk;
+        CHECK(disk.open(path, 64, true));
+        CHECK(disk.search((int64_t)0));
+        depth = disk.pool().misses();
+        CHECK(depth >= 2);
+    }
+
+    for (size_t frames : {8, 64, 1024}) {
+        Disk disk;
+        CHECK(disk.open(path, frames, true));
+        int64_t previous = -1;
+        size_t count = 0;
+        disk.forEachInRange({}, [&](int64_t key, int64_t value) {
+            CHECK(key > previous);
+            CHECK_EQ(value, key / 3);
+            previous = key;
+            count++;
+        });
+        CHECK_EQ(count, (size_t)n);
+
+        count = 0;
+        previous = -1;
+        disk.forEachInRange({(int64_t)3001, (int64_t)60000}, [&](int64_t key, int64_t) {
+            CHECK(key > previous && key > 3001 && key < 60000);
+            previous = key;
+            count++;
+        });
+        CHECK_EQ(count, 18999u);
+
+        // 途中で打ち切っても、残った先読みが後の走査を妨げない
+        count = 0;
+        CHECK(!disk.forEachInRange({}, [&](int64_t, int64_t) { return ++count < 5000; }));
+        CHECK_EQ(count, 5000u);
+        count = 0;
+        disk.forEachInRange({}, [&](int64_t, int64_t) { count++; });
+        CHECK_EQ(count, (size_t)n);
+    }
+
+    // 上限のある走査は、範囲の外の葉を読まない
+    {
+        Disk disk;
+        CHECK(disk.open(path, 1024, true));
+        size_t count = 0;
+        disk.forEachInRange({(int64_t)30, (int64_t)40}, [&](int64_t, int64_t) { count++; });
+        CHECK_EQ(count, 4u);
+        CHECK(disk.pool().misses() <= depth + 1);
+    }
+    {
+        // 約 6000 件を走査する。上限のない走査を同じ件数で打ち切った場合は
+        // 先読みの窓の分だけ先の葉まで読むが、上限のある走査は範囲の終わりで止まる
+        Disk bounded;
+        CHECK(bounded.open(path, 1024, true));
+        size_t count = 0;
+        bounded.forEachInRange({(int64_t)0, (int64_t)18000}, [&](int64_t, int64_t) { count++; });
+        CHECK_EQ(count, 6000u);
+        Disk unbounded;
+        CHECK(unbounded.open(path, 1024, true));
+        count = 0;
+        unbounded.forEachInRange({}, [&](int64_t, int64_t) { return ++count < 6000; });
+        CHECK(bounded.pool().misses() < unbounded.pool().misses());
+    }
+
+    // 複数スレッドが同時に全件走査する
+    Disk shared;
+    CHECK(shared.open(path, 32, true));
+    std::atomic<int> errors{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 3; t++) {
+        threads.emplace_back([&] {
+            for (int round = 0; round < 3; round++) {
+                size_t count = 0;
+                shared.forEachInRange({}, [&](int64_t, int64_t) { count++; });
+                if (count != (size_t)n) {
+                    errors++;
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    CHECK_EQ(errors.load(), 0);
+
+    std::remove(path.c_str());
+    std::puts("ok");
+    return 0;
+}
@@ -0,0 +1,162 @@
+/**
+ * @file test_shadow_paging.cc
+ * @brief シャドウページング (Durability::ShadowPaging) のクラッシュ整合性のテスト
+ * @details 子プロセスでコミット後に書き込みを続けて異常終了させ、開き直した
+ *          内容が最後のコミットの時点と一致することを確かめる。
+ *          g++ -std=c++17 -O2 -pthread tests/test_shadow_paging.cc && ./a.out
+ */
+#define BPLUSTREE_NO_MAIN
+#include "../b_pluss_tree.cc"
+#include "check.h"
+
+#include <sys/wait.h>
+
+#include <cstddef>
+
+using Disk = BPlusTree::DiskBPlusTree<int, int>;
+using Durability = Disk::Durability;
+using Catalog = BPlusTree::DiskCatalog;
+
+namespace {
+
+size_t countAll(Disk& disk) {
+    size_t count = 0;
+    disk.forEachInRange({}, [&](int, int) { count++; });
+    return count;
+}
+
+/**
+ * @brief fn を子プロセスで実行し、その終了コードを返す
+ * @details fn の中で _exit() するとデストラクタが走らず、異常終了の代わりになる
+ */
+template <typename Fn>
+int runChild(Fn fn) {
+    pid_t pid = ::fork();
+    if (pid == 0) {
+        ::_exit(fn());
+    }
+    int status = 0;
+    CHECK(::waitpid(pid, &status, 0) == pid);
+    CHECK(WIFEXITED(status));
+    return WEXITSTATUS(status);
+}
+
+} // namespace
+
+int main() {
+    const std::string path = tempPath("shadow.db");
+    BPlusTree::BPlusTree<int, int> tree;
+    for (int i = 0; i < 20000; i++) {
+        tree.insert(i * 2, i);
+    }
+    CHECK(Disk::build(tree, path, true));
+
+    // コミットの後、小さいプールから追い出されるほどの書き込みを残したまま終わる
+    CHECK_EQ(runChild([&] {
+        Disk disk;
+        if (!disk.open(path, 8, true, Durability::ShadowPaging)) {
+            return 1;
+        }
+        for (int i = 0; i < 5000; i++) {
+            disk.insert(i * 2 + 1, -i);
+        }
+        if (!disk.flush()) {
+            return 2;
+        }
+        for (int i = 0; i < 20000; i++) {
+            disk.insert(i * 2, 777);
+        }
+        for (int i = 0; i < 8000; i++) {
+            disk.erase(i * 2 + 1);
+        }
+        for (int i = 100000; i < 110000; i++) {
+            disk.insert(i, 1);
+        }
+        // 閉じる (コミットする) 前に終わる
+        ::_exit(0);
+        return 0;
+    }), 0);
+
+    {
+        Disk disk;
+        CHECK(disk.open(path, 64, true, Durability::ShadowPaging));
+        CHECK_EQ(disk.size(), 25000u);
+        CHECK_EQ(countAll(disk), 25000u);
+        for (int i = 0; i < 20000; i++) {
+            CHECK(disk.search(i * 2) == std::optional<int>(i));
+        }
+        for (int i = 0; i < 5000; i++) {
+            CHECK(disk.search(i * 2 + 1) == std::optional<int>(-i));
+        }
+        CHECK(!disk.search(100000));
+
+        // 異常終了で使われなくなったページがあっても、削除と切り詰めはできる
+        for (int i = 0; i < 20000; i++) {
+            disk.erase(i * 2);
+        }
+        CHECK(disk.flush());
+        uint32_t before = disk.pageCount();
+        disk.compact(16);
+        CHECK(disk.pageCount() < before);
+        CHECK_EQ(countAll(disk), 5000u);
+    }
+    {
+        Disk disk;
+        CHECK(disk.open(path, 64, true, Durability::ShadowPaging));
+        CHECK_EQ(disk.size(), 5000u);
+        CHECK_EQ(countAll(disk), 5000u);
+    }
+
+    // 新しい世代をコミットしてから、その世代のスーパーブロックを壊す。
+    // 開くと 1 つ前の世代に戻る
+    CHECK_EQ(runChild([&] {
+        Disk disk;
+        if (!disk.open(path, 64, true, Durability::ShadowPaging)) {
+            return 1;
+        }
+        disk.insert(-5, 5);
+        // 閉じるとさらに世代が進むので、コミットした直後に終わる
+        ::_exit(disk.flush() ? 0 : 2);
+        return 0;
+    }), 0);
+    {
+        int fd = ::open(path.c_str(), O_RDWR);
+        CHECK(fd >= 0);
+        std::vector<char> page(BPlusTree::kPageSize);
+        CHECK(::pread(fd, page.data(), page.size(), 0) == (ssize_t)page.size());
+        auto generationAt = [&](size_t slot) {
+            uint64_t generation;
+            std::memcpy(&generation, page.data() + slot + offsetof(Catalog::Superblock, generation), sizeof(generation));
+            return generation;
+        };
+        size_t newest = generationAt(Catalog::kSuperSlot) > generationAt(0) ? Catalog::kSuperSlot : 0;
+        page[newest + offsetof(Catalog::Superblock, catalogHead)] ^= 0x55;
+        CHECK(::pwrite(fd, page.data(), page.size(), 0) == (ssize_t)page.size());
+        ::close(fd);
+
+        Disk disk;
+        CHECK(disk.open(path, 64, true, Durability::ShadowPaging));
+        CHECK_EQ(disk.size(), 5000u);
+        CHECK(!disk.search(-5));
+    }
+
+    // その場で書き換える既定のモードでも開いて書ける
+    {
+        Disk disk;
+        CHECK(disk.open(path, 64, true));
+        for (int i = 0; i < 3000; i++) {
+            disk.insert(i * 3, i);
+        }
+        CHECK(disk.flush());
+    }
+    {
+        Disk disk;
+        CHECK(disk.open(path, 64, true));
+        CHECK_EQ(countAll(disk), disk.size());
+        CHECK(disk.search(2999 * 3) == std::optional<int>(2999));
+    }
+
+    std::remove(path.c_str());
+    std::puts("ok");
+    return 0;
+}
@@ -0,0 +1,111 @@
+/**
+ * @file test_transaction.cc
+ * @brief 読み取った葉の版で検証する楽観的トランザクションのテスト
+ * @details g++ -std=c++17 -O2 -pthread tests/test_transaction.cc && ./a.out
+ */
+#define BPLUSTREE_NO_MAIN
+#include "../b_pluss_tree.cc"
+#include "check.h"
+
+#include <random>
+#include <thread>
+
+using Tree = BPlusTree::BPlusTree<int, long>;
+
+int main() {
+    // 自分の書き込みは読める。空の木を読んだ後に別のコミットがあれば中断する
+    {
+        Tree tree;
+        auto first = tree.begin();
+        CHECK(!first.get(5));
+        auto second = tree.begin();
+        second.insert(5, 1);
+        CHECK(second.get(5) == std::optional<long>(1));
+        CHECK(second.commit());
+        first.insert(6, 1);
+        CHECK(!first.commit());
+        CHECK(!tree.search(6));
+
+        auto third = tree.begin();
+        CHECK(third.get(5) == std::optional<long>(1));
+        third.erase(5);
+        CHECK(!third.get(5));
+        CHECK(third.commit());
+        CHECK(!tree.search(5));
+    }
+
+    // 読んだ葉が書き換えられると中断し、読んでいない葉への書き込みでは中断しない
+    {
+        Tree tree;
+        for (int i = 0; i < 1000; i++) {
+            tree.insert(i, i);
+        }
+        auto reader = tree.begin();
+        CHECK(reader.get(10) == std::optional<long>(10));
+        reader.insert(500, -1);
+        tree.insert(900, 0);
+        CHECK(reader.commit());
+        CHECK(tree.search(500) == std::optional<long>(-1));
+
+        auto stale = tree.begin();
+        CHECK(stale.get(10) == std::optional<long>(10));
+        stale.insert(11, -1);
+        tree.insert(10, 100);
+        CHECK(!stale.commit());
+        CHECK(tree.search(11) == std::optional<long>(11));
+
+        // 書き込みだけのトランザクションは検証するものがない
+        auto blind = tree.begin();
+        blind.insert(10, 7);
+        tree.insert(10, 8);
+        CHECK(blind.commit());
+        CHECK(tree.search(10) == std::optional<long>(7));
+    }
+
+    // 並行した読み取り・更新: 成功したコミットの分だけ合計が増える
+    const int n = 2000;
+    for (int hot : {n, 8}) {
+        Tree tree;
+        for (int i = 0; i < n; i++) {
+            tree.insert(i, 0);
+        }
+        std::atomic<long> commits{0};
+        std::atomic<long> aborts{0};
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; t++) {
+            threads.emplace_back([&, t] {
+                std::mt19937 rng(t);
+                for (int i = 0; i < 2000; i++) {
+                    int a = rng() % hot * (n / hot);
+                    int b = rng() % hot * (n / hot);
+                    for (;;) {
+                        auto tx = tree.begin();
+                        long va = *tx.get(a);
+                        long vb = *tx.get(b);
+                        tx.insert(a, va + 1);
+                        if (b != a) {
+                            tx.insert(b, vb + 1);
+                        } else {
+                            tx.insert(a, va + 2);
+                        }
+                        if (tx.commit()) {
+                            commits++;
+                            break;
+                        }
+                        aborts++;
+                    }
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        long sum = 0;
+        tree.forEachInRange({}, [&](int, long value) { sum += value; });
+        CHECK_EQ(commits.load(), 4 * 2000);
+        CHECK_EQ(sum, 2 * commits.load());
+    }
+
+    std::puts("ok");
+    return 0;
+}
@@ -0,0 +1,206 @@
+/**
+ * @file test_value_index.cc
+ * @brief ValueIndexedTree の値の索引と、BPlusTree::exchange() / erase() のテスト
+ * @details 乱数の挿入・上書き・削除の後、索引を std::map から求めた結果と比べる。
+ *          g++ -std=c++17 -O2 -pthread tests/test_value_index.cc && ./a.out
+ */
+#define BPLUSTREE_NO_MAIN
+#include "../b_pluss_tree.cc"
+#include "check.h"
+
+#include <map>
+#include <numeric>
+#include <random>
+#include <thread>
+
+int main() {
+    BPlusTree::BPlusTree<> plain;
+    CHECK(!plain.exchange(1, 1));
+    CHECK(plain.exchange(1, 2) == std::optional<int>(1));
+    CHECK(plain.erase(1) == std::optional<int>(2));
+    CHECK(!plain.search(1));
+    CHECK(!plain.erase(1));
+    plain.insert(1, 3);
+    CHECK(plain.search(1) == std::optional<int>(3));
+
+    BPlusTree::ValueIndexedTree<int, int> tree;
+    std::map<int, int> reference;
+    std::mt19937 rng(5);
+    for (int i = 0; i < 20000; i++) {
+        int key = rng() % 3000;
+        int value = rng() % 50;
+        if (rng() % 4 == 0) {
+            auto erased = tree.erase(key);
+            auto it = reference.find(key);
+            CHECK_EQ((bool)erased, it != reference.end());
+            if (erased) {
+                CHECK_EQ(*erased, it->second);
+                reference.erase(it);
+            }
+        } else {
+            tree.insert(key, value);
+            reference[key] = value;
+        }
+    }
+
+    // 値ごとのキーはキーの昇順
+    for (int value = 0; value < 50; value++) {
+        std::vector<int> expected;
+        for (auto [key, v] : reference) {
+            if (v == value) {
+                expected.push_back(key);
+            }
+        }
+        std::vector<int> actual;
+        tree.forEachKeyWithValue(value, [&](int key) { actual.push_back(key); });
+        CHECK(actual == expected);
+    }
+
+    // 値の範囲は (値, キー) の昇順
+    std::vector<std::pair<int, int>> expected;
+    for (auto [key, value] : reference) {
+        if (value >= 10 && value < 20) {
+            expected.push_back({value, key});
+        }
+    }
+    std::sort(expected.begin(), expected.end());
+    std::vector<std::pair<int, int>> actual;
+    tree.forEachInValueRange(10, 20, [&](int value, int key) { actual.push_back({value, key}); });
+    CHECK(actual == expected);
+
+    // 上書きや削除で古い索引が残らない
+    size_t indexed = 0;
+    tree.forEachInIndexRange({}, [&](int, int) { indexed++; });
+    CHECK_EQ(indexed, reference.size());
+
+    // 索引もバッファへ書き出して続きから読める
+    std::vector<std::pair<int, int>> all;
+    for (int value = 0; value < 50; value++) {
+        tree.forEachKeyWithValue(value, [&](int key) { all.push_back({value, key}); });
+    }
+    std::vector<std::pair<int, int>> scanned;
+    BPlusTree::KeyRange<std::pair<int, int>> range;
+    std::pair<int, int> buffer[100];
+    for (;;) {
+        auto result = tree.scanIndexInto(range, buffer, 100);
+        scanned.insert(scanned.end(), buffer, buffer + result.count);
+        if (!result.resumeKey) {
+            break;
+        }
+        range.lo = result.resumeKey;
+    }
+    CHECK(scanned == all);
+
+    // (値, キー) の境界は値の途中から始められる
+    std::vector<std::pair<int, int>> tail;
+    tree.forEachInIndexRange({std::pair<int, int>{10, 1500}, std::pair<int, int>{11, 0}},
+                             [&](int value, int key) { tail.push_back({value, key}); });
+    std::vector<std::pair<int, int>> expectedTail;
+    for (auto entry : all) {
+        if (entry.first == 10 && entry.second >= 1500) {
+            expectedTail.push_back(entry);
+        }
+    }
+    CHECK(tail == expectedTail);
+
+    // 値ごとの最小のキーを一括で引く
+    std::vector<int> values = {0, 25, 49, 50, 7};
+    std::vector<int> firstKeys(values.size(), -1);
+    std::vector<bool> found(values.size());
+    size_t hits = tree.getManyByValue(values.data(), values.size(), firstKeys.data(), found);
+    CHECK_EQ(hits, 4u);
+    CHECK(!found[3]);
+    CHECK_EQ(firstKeys[3], -1);
+    for (size_t i = 0; i < values.size(); i++) {
+        if (found[i]) {
+            auto it = std::find_if(all.begin(), all.end(), [&](auto entry) { return entry.first == values[i]; });
+            CHECK_EQ(firstKeys[i], it->second);
+        }
+    }
+
+    // 主の木の一括検索と範囲の書き出し
+    std::vector<int> probes = {0, 1, 2, 2999, 3000};
+    std::vector<int> probed(probes.size());
+    found.assign(probes.size(), false);
+    size_t present = 0;
+    for (int key : probes) {
+        present += reference.count(key);
+    }
+    CHECK_EQ(tree.getMany(probes.data(), probes.size(), probed.data(), found), present);
+    for (size_t i = 0; i < probes.size(); i++) {
+        CHECK_EQ((bool)found[i], reference.count(probes[i]) == 1);
+        if (found[i]) {
+            CHECK_EQ(probed[i], reference[probes[i]]);
+        }
+    }
+    int keyBuffer[64];
+    int valueBuffer[64];
+    auto page = tree.scanInto({100, 1000}, keyBuffer, valueBuffer, 64);
+    auto it = reference.lower_bound(100);
+    CHECK_EQ(page.count, 64u);
+    for (size_t i = 0; i < page.count; i++, ++it) {
+        CHECK_EQ(keyBuffer[i], it->first);
+        CHECK_EQ(valueBuffer[i], it->second);
+    }
+    CHECK(page.resumeKey == std::optional<int>(it->first));
+    for (int key = 0; key < 3000; key++) {
+        auto it = reference.find(key);
+        auto value = tree.search(key);
+        CHECK_EQ((bool)value, it != reference.end());
+        if (value) {
+            CHECK_EQ(*value, it->second);
+        }
+    }
+
+    // 並行して更新しても、木と索引の要素数が一致する
+    BPlusTree::ValueIndexedTree<int, int> shared;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&shared, t] {
+            std::mt19937 local(t);
+            for (int i = 0; i < 2000; i++) {
+                int key = local() % 500;
+                if (local() % 3 == 0) {
+                    shared.erase(key);
+                } else {
+                    shared.insert(key, (int)(local() % 20));
+                }
+            }
+        });
+    }
+    // 更新と並行して一括検索と索引の書き出しを呼べる
+    std::atomic<int> running{4};
+    threads.emplace_back([&shared, &running] {
+        std::vector<int> probes(500);
+        std::iota(probes.begin(), probes.end(), 0);
+        std::vector<int> values(500);
+        std::vector<bool> found(500);
+        std::pair<int, int> entries[500];
+        while (running > 0) {
+            shared.getMany(probes.data(), probes.size(), values.data(), found);
+            auto result = shared.scanIndexInto({}, entries, 500);
+            CHECK(!result.resumeKey);
+            CHECK(std::is_sorted(entries, entries + result.count));
+        }
+    });
+    for (size_t i = 0; i < 4; i++) {
+        threads[i].join();
+        running--;
+    }
+    threads.back().join();
+    size_t keys = 0;
+    size_t entries = 0;
+    for (int key = 0; key < 500; key++) {
+        if (auto value = shared.search(key)) {
+            keys++;
+            bool listed = false;
+            shared.forEachKeyWithValue(*value, [&](int k) { listed = listed || k == key; });
+            CHECK(listed);
+        }
+    }
+    shared.forEachInIndexRange({}, [&](int, int) { entries++; });
+    CHECK_EQ(keys, entries);
+
+    std::puts("ok");
+    return 0;
+}
@@ -0,0 +1,167 @@
+/**
+ * @file test_work_stealing.cc
+ * @brief ワークスティーリングのスレッドプールと、それを使う並列操作のテスト
+ * @details g++ -std=c++17 -O2 -pthread tests/test_work_stealing.cc && ./a.out
+ */
+#define BPLUSTREE_NO_MAIN
+#include "../b_pluss_tree.cc"
+#include "check.h"
+
+#include <filesystem>
+#include <thread>
+
+using BPlusTree::WorkStealingPool;
+using Tree = BPlusTree::BPlusTree<int, int>;
+
+namespace {
+
+/**
+ * @brief プロセス内のスレッドの数
+ * @return size_t
+ */
+size_t threadCount() {
+    return std::distance(std::filesystem::directory_iterator("/proc/self/task"),
+                         std::filesystem::directory_iterator());
+}
+
+/**
+ * @brief 実行済みの数が n になるまで待つ (future の完了は数える前に見える)
+ * @param pool
+ * @param n
+ */
+void waitExecuted(const WorkStealingPool& pool, uint64_t n) {
+    while (pool.stats().executed < n) {
+        std::this_thread::yield();
+    }
+}
+
+/**
+ * @brief 入れ子に投入して待つ再帰で 0 から n - 1 までの和を求める
+ * @param pool
+ * @param lo
+ * @param hi
+ * @return long
+ */
+long nestedSum(WorkStealingPool& pool, long lo, long hi) {
+    if (hi - lo <= 4) {
+        long sum = 0;
+        for (long i = lo; i < hi; i++) {
+            sum += i;
+        }
+        return sum;
+    }
+    long mid = (lo + hi) / 2;
+    auto left = pool.submit([&pool, lo, mid] { return nestedSum(pool, lo, mid); });
+    long right = nestedSum(pool, mid, hi);
+    return pool.wait(left) + right;
+}
+
+} // namespace
+
+int main() {
+    // 共有プールは最初に分割して走る並列操作が作る
+    Tree tree;
+    for (int i = 0; i < 10000; i++) {
+        tree.insert(i, i);
+    }
+    size_t baseline = threadCount();
+    tree.forEachInRange({}, [](int, int) {});
+    CHECK_EQ(tree.parallelCountIf({}, [](int, int) { return true; }, 1), 10000u);
+    CHECK_EQ(threadCount(), baseline);
+    CHECK_EQ(tree.parallelCountIf({}, [](int key, int) { return key % 2 == 0; }, 4), 5000u);
+    CHECK(threadCount() >= baseline + WorkStealingPool::shared().size());
+
+    // 投入したタスクはすべて 1 度ずつ実行される
+    {
+        WorkStealingPool pool(4);
+        std::atomic<int> counter{0};
+        std::vector<std::future<int>> results;
+        for (int i = 0; i < 1000; i++) {
+            results.push_back(pool.submit([&counter, i] {
+                counter++;
+                return i;
+            }));
+        }
+        for (int i = 0; i < 1000; i++) {
+            CHECK_EQ(results[i].get(), i);
+        }
+        CHECK_EQ(counter.load(), 1000);
+        waitExecuted(pool, 1000);
+        CHECK_EQ(pool.stats().executed, 1000u);
+    }
+
+    // ワーカーの中で投入して待っても、ワーカー 1 本で止まらない
+    {
+        WorkStealingPool pool(1);
+        auto result = pool.submit([&pool] { return nestedSum(pool, 0, 1000); });
+        CHECK_EQ(result.get(), 999L * 1000 / 2);
+    }
+
+    // ワーカーが自分のキューに積んだタスクは、手の空いたワーカーが先頭から盗む
+    {
+        WorkStealingPool pool(2, {0});
+        std::atomic<int> done{0};
+        auto outer = pool.submit([&] {
+            for (int i = 0; i < 50; i++) {
+                pool.submit([&done] { done++; });
+            }
+            while (done < 50) {
+                std::this_thread::yield();
+            }
+        });
+        outer.get();
+        waitExecuted(pool, 51);
+        CHECK(pool.stats().stolen >= 50);
+    }
+
+    // デストラクタは投入済みのタスクをすべて実行してから止まる
+    {
+        std::atomic<int> counter{0};
+        {
+            WorkStealingPool pool(2);
+            for (int i = 0; i < 500; i++) {
+                pool.submit([&counter] { counter++; });
+            }
+        }
+        CHECK_EQ(counter.load(), 500);
+    }
+
+    // 並列操作は setExecutor() したプールで走り、逐次と同じ結果になる
+    {
+        WorkStealingPool pool(3);
+        tree.setExecutor(pool);
+        CHECK(&tree.executor() == &pool);
+        std::atomic<long> sum{0};
+        std::atomic<int> visited{0};
+        tree.parallelForEach({}, [&](int key, int value) {
+            CHECK_EQ(key, value);
+            sum += value;
+            visited++;
+        }, 4);
+        CHECK_EQ(visited.load(), 10000);
+        CHECK_EQ(sum.load(), 9999L * 10000 / 2);
+        waitExecuted(pool, 1);
+
+        // 範囲順に畳み込む (結合的だが可換でない reduce)
+        auto keys = tree.parallelTransformReduce(
+            {2000, 7000}, std::vector<int>{},
+            [](std::vector<int> a, std::vector<int> b) {
+                a.insert(a.end(), b.begin(), b.end());
+                return a;
+            },
+            [](int key, int) { return std::vector<int>{key}; }, 4);
+        CHECK_EQ(keys.size(), 5000u);
+        for (size_t i = 0; i < keys.size(); i++) {
+            CHECK_EQ(keys[i], 2000 + static_cast<int>(i));
+        }
+
+        // プールのタスクの中から並列操作を入れ子に呼んでも止まらない
+        WorkStealingPool single(1);
+        tree.setExecutor(single);
+        auto nested = single.submit([&tree] { return tree.parallelCountIf({}, [](int, int) { return true; }, 4); });
+        CHECK_EQ(nested.get(), 10000u);
+    }
+
+    std::puts("ok");
+    return 0;
+}
@@ -0,0 +1,102 @@
+/**
+ * @file test_write_batch.cc
+ * @brief 複数キーの書き込みをまとめて原子的に適用する WriteBatch のテスト
+ * @details g++ -std=c++17 -O2 -pthread tests/test_write_batch.cc && ./a.out
+ */
+#define BPLUSTREE_NO_MAIN
+#include "../b_pluss_tree.cc"
+#include "check.h"
+
+#include <map>
+#include <random>
+#include <thread>
+
+using Tree = BPlusTree::BPlusTree<int, int>;
+
+int main() {
+    // 乱数のバッチを std::map と比べる。同じキーへの操作は後のものが勝つ
+    Tree tree;
+    std::map<int, int> reference;
+    std::mt19937 rng(1);
+    for (int round = 0; round < 200; round++) {
+        Tree::WriteBatch batch;
+        int ops = rng() % 300;
+        for (int i = 0; i < ops; i++) {
+            int key = rng() % 5000;
+            if (rng() % 4 == 0) {
+                batch.erase(key);
+                reference.erase(key);
+            } else {
+                int value = rng();
+                batch.insert(key, value);
+                reference[key] = value;
+            }
+        }
+        tree.write(batch);
+    }
+    size_t count = 0;
+    tree.forEachInRange({}, [&](int key, int value) {
+        auto it = reference.find(key);
+        CHECK(it != reference.end() && it->second == value);
+        count++;
+    });
+    CHECK_EQ(count, reference.size());
+    for (auto& [key, value] : reference) {
+        CHECK(tree.search(key) == std::optional<int>(value));
+    }
+
+    // 空のバッチ、同じキーへの挿入と削除
+    tree.write(Tree::WriteBatch());
+    Tree::WriteBatch overwrite;
+    overwrite.insert(-1, 1);
+    overwrite.erase(-1);
+    overwrite.insert(-2, 1);
+    overwrite.insert(-2, 2);
+    tree.write(overwrite);
+    CHECK(!tree.search(-1));
+    CHECK(tree.search(-2) == std::optional<int>(2));
+
+    // 読み手には、バッチの途中の状態が見えない
+    Tree versions;
+    {
+        Tree::WriteBatch batch;
+        for (int key = 0; key < 1000; key++) {
+            batch.insert(key * 7, 0);
+        }
+        versions.write(batch);
+    }
+    std::atomic<bool> stop{false};
+    std::atomic<int> torn{0};
+    std::atomic<int> scans{0};
+    std::thread reader([&] {
+        while (!stop) {
+            int first = -1;
+            bool consistent = true;
+            versions.forEachInRange({}, [&](int, int value) {
+                if (first < 0) {
+                    first = value;
+                } else if (value != first) {
+                    consistent = false;
+                }
+            });
+            torn += !consistent;
+            scans++;
+        }
+    });
+    while (scans == 0) {
+        std::this_thread::yield();
+    }
+    for (int version = 1; version <= 300; version++) {
+        Tree::WriteBatch batch;
+        for (int key = 999; key >= 0; key--) {
+            batch.insert(key * 7, version);
+        }
+        versions.write(batch);
+    }
+    stop = true;
+    reader.join();
+    CHECK_EQ(torn.load(), 0);
+
+    std::puts("ok");
+    return 0;
+}